@@ -70,6 +70,23 @@ static struct irq_chip nvic_chip = {
 	.unmask		= nvic_unmask_irq,
 };
 
+/*
+ * Lower values preempt higher ones.  Only the implemented top bits of
+ * the byte are significant, the rest read as zero.
+ */
+void nvic_set_priority(unsigned int irq, u8 priority)
+{
+	writeb(priority, NVIC_PRIORITY + irq);
+}
+
+void __init nvic_set_priorities(const struct nvic_priority *map, unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++)
+		nvic_set_priority(map[i].irq, map[i].priority);
+}
+
 void __init nvic_init(void)
 {
 	unsigned int max_irq, i;
@@ -83,7 +100,7 @@ void __init nvic_init(void)
   for (i = 0; i < max_irq / 32; i++)
     writel(~0, NVIC_CLEAR_ENABLE + i * 4);
 #else
-  max_irq = NR_IRQS;
+  max_irq = LM3S_NVIC_IRQS;
 
   writel(~0, NVIC_CLEAR_ENABLE);
   writel(~0, NVIC_CLEAR_ENABLE + 4);
@@ -96,9 +113,10 @@ void __init nvic_init(void)
 		writel(0, NVIC_PRIORITY + i);
 
 	/*
-	 * Setup the Linux IRQ subsystem.
+	 * Setup the Linux IRQ subsystem.  Interrupt numbers above the
+	 * NVIC lines belong to secondary (chained) controllers.
 	 */
-	for (i = 0; i < NR_IRQS; i++) {
+	for (i = 0; i < max_irq && i < NR_IRQS; i++) {
 		set_irq_chip(i, &nvic_chip);
 		set_irq_handler(i, handle_level_irq);
 		set_irq_flags(i, IRQF_VALID | IRQF_PROBE);
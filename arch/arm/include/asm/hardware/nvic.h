@@ -11,6 +11,7 @@
 #define __ASM_ARM_HARDWARE_NVIC_H
 
 #include <linux/compiler.h>
+#include <linux/types.h>
 
 #define V7M_SCS				0xe000e000
 #define NVIC_INTR_CTRL			(V7M_SCS + 0x004)
@@ -25,10 +26,21 @@
 #define NVIC_ACTIVE_BIT			(V7M_SCS + 0x300)
 #define NVIC_PRIORITY			(V7M_SCS + 0x400)
 #define NVIC_INTR_CTRL_STATE		(V7M_SCS + 0xd04)
+#define NVIC_AIRCR			(V7M_SCS + 0xd0c)
 #define NVIC_SOFTWARE_INTR		(V7M_SCS + 0xf00)
 
+#define NVIC_AIRCR_VECTKEY		(0x05fa << 16)
+#define NVIC_AIRCR_PRIGROUP(n)		(((n) & 7) << 8)
+
 #ifndef __ASSEMBLY__
+struct nvic_priority {
+	unsigned int	irq;
+	u8		priority;
+};
+
 void nvic_init(void);
+void nvic_set_priority(unsigned int irq, u8 priority);
+void nvic_set_priorities(const struct nvic_priority *map, unsigned int nr);
 #endif
 
 #endif
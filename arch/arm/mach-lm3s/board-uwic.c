@@ -15,6 +15,7 @@
 #include <mach/memory.h>
 #include <mach/irqs.h>
 #include <mach/lm3s_gpio.h>
+#include <mach/gpio.h>
 #include <mach/lm3s_clock.h>
 #include <asm/mach-types.h>
 #include <asm/hardware/nvic.h>
@@ -43,7 +44,11 @@ static struct resource lm3s_spi_resources0[] = {
   },
 };
 
+#ifdef CONFIG_MACH_UWIC_ETH_SSI1
+static int lm3s_spi_cs[] = {GPIO_SSI0_CS_SF, GPIO_SSI0_CS_EE};
+#else
 static int lm3s_spi_cs[] = {GPIO_SSI0_CS_SF, GPIO_SSI0_CS_EE, GPIO_SSI0_CS_ETH};
+#endif
 
 #ifdef CONFIG_LM3S_DMA
 char __sramdata ssi0_dma_rx_buffer[DMA_MAX_TRANSFER_SIZE];
@@ -53,6 +58,7 @@ char __sramdata ssi0_dma_tx_buffer[DMA_MAX_TRANSFER_SIZE];
 static struct spi_lm3s_master lm3s_spi_0_data = {
   .chipselect = lm3s_spi_cs,
   .num_chipselect = ARRAY_SIZE(lm3s_spi_cs),
+  .rcgc1_mask = SYSCON_RCGC1_SSI0,
 #ifdef CONFIG_LM3S_DMA
 	.dma_rx_channel = DMA_CHANNEL_SSI0_RX,
 	.dma_tx_channel = DMA_CHANNEL_SSI0_TX,
@@ -69,6 +75,58 @@ struct platform_device lm3s_spi_device0 = {
   .dev.platform_data = &lm3s_spi_0_data,
 };
 
+#ifdef CONFIG_MACH_UWIC_ETH_SSI1
+static struct resource lm3s_spi_resources1[] = {
+  {
+         .start = LM3S_SSI1_BASE,
+         .end = LM3S_SSI1_BASE + SZ_1K - 1,
+         .flags = IORESOURCE_MEM,
+  }, {
+         .start = LM3S1D21_SSI1_IRQ,
+         .end = LM3S1D21_SSI1_IRQ,
+         .flags = IORESOURCE_IRQ,
+  },
+};
+
+static int lm3s_spi1_cs[] = {GPIO_SSI1_CS_ETH};
+
+/* The boot loader only sets up SSI0 */
+static int lm3s_spi1_pins[] = {GPIO_SSI1_CLK, GPIO_SSI1_RX, GPIO_SSI1_TX};
+
+#ifdef CONFIG_LM3S_DMA
+char __sramdata ssi1_dma_rx_buffer[DMA_MAX_TRANSFER_SIZE];
+char __sramdata ssi1_dma_tx_buffer[DMA_MAX_TRANSFER_SIZE];
+#endif
+
+static struct spi_lm3s_master lm3s_spi_1_data = {
+  .chipselect = lm3s_spi1_cs,
+  .num_chipselect = ARRAY_SIZE(lm3s_spi1_cs),
+  .rcgc1_mask = SYSCON_RCGC1_SSI1,
+  .pins = lm3s_spi1_pins,
+  .num_pins = ARRAY_SIZE(lm3s_spi1_pins),
+#ifdef CONFIG_LM3S_DMA
+	.dma_rx_channel = DMA_CHANNEL_SSI1_RX,
+	.dma_tx_channel = DMA_CHANNEL_SSI1_TX,
+	.dma_rx_buffer = ssi1_dma_rx_buffer,
+	.dma_tx_buffer = ssi1_dma_tx_buffer,
+#endif
+};
+
+static struct platform_device lm3s_spi_device1 = {
+  .name = "lm3s-spi",
+  .id = 1,
+  .num_resources = ARRAY_SIZE(lm3s_spi_resources1),
+  .resource = lm3s_spi_resources1,
+  .dev.platform_data = &lm3s_spi_1_data,
+};
+
+#define UWIC_ETH_SPI_BUS  1
+#define UWIC_ETH_SPI_CS   0
+#else
+#define UWIC_ETH_SPI_BUS  0
+#define UWIC_ETH_SPI_CS   2
+#endif
+
 static struct mtd_partition uwic_flash_partitions[] = {
   {
     .name = "root",
@@ -109,9 +167,9 @@ static struct spi_board_info uwic_spi_board_info[] = {
   {
     .modalias      = "ks8851",
     .max_speed_hz  = 5 * 1000000,
-    .bus_num       = 0,
-    .chip_select   = 2,
-    .irq           = LM3S1D21_GPIOG_IRQ, // ETH IRQ on PG5
+    .bus_num       = UWIC_ETH_SPI_BUS,
+    .chip_select   = UWIC_ETH_SPI_CS,
+    .irq           = LM3S_GPIO_IRQ(GPIO_ETH_INTRN), // ETH IRQ on PG5
   },
 };
 
@@ -210,6 +268,9 @@ static struct platform_device cpu_led = {
 static struct platform_device *lm3s_devices[] = {
   &uart_device,
   &lm3s_spi_device0,
+#ifdef CONFIG_MACH_UWIC_ETH_SSI1
+  &lm3s_spi_device1,
+#endif
 	&wdt_device,
 #ifdef CONFIG_LEDS_LM3S
 	&cpu_led,
@@ -218,41 +279,58 @@ static struct platform_device *lm3s_devices[] = {
 
 /***************************************************************************/
 
-#ifdef CONFIG_LM3S_COPY_TO_SRAM
-extern unsigned int __sram_start[], __sram_end[], __sram_load_address[];
-#endif
-
-/***************************************************************************/
-
 static void __init uwic_init(void)
 {
 	uint32_t regval;
 
-#ifdef CONFIG_LM3S_COPY_TO_SRAM
-	memcpy(__sram_start, __sram_load_address,
-	       (unsigned long)__sram_end - (unsigned long)__sram_start);
-#endif
-
 	regval = SYSCON_DSLPCLKCFG_DSDIVORIDE(0) | SYSCON_DSLPCLKCFG_DSOSCSRC_30KHZ;
 	lm3s_putreg32(regval, LM3S_SYSCON_DSLPCLKCFG);
 
 	platform_add_devices(lm3s_devices, ARRAY_SIZE(lm3s_devices));
 	spi_register_board_info(uwic_spi_board_info, ARRAY_SIZE(uwic_spi_board_info));
 
-	lm3s_gpioirqenable(GPIO_ETH_INTRN);
-
 	lm3s_power_init(GPIO_POWER_HOLD);
 
 #ifdef CONFIG_MACH_UWIC_ENABLE_PWRSWITCH
-	lm3s_power_switch_init(GPIO_POWER_FAIL, LM3S1D21_GPIOB_IRQ, CONFIG_MACH_UWIC_POWER_OFF_DELAY);
+	lm3s_power_switch_init(GPIO_POWER_FAIL, LM3S_GPIO_IRQ(GPIO_POWER_FAIL), CONFIG_MACH_UWIC_POWER_OFF_DELAY);
 #endif
 }
 
 /***************************************************************************/
 
+/*
+ * NVIC priorities, the LM3S implements the top three bits.  The UART RX
+ * FIFOs and the SSI transfers (uDMA completion is signalled on the
+ * peripheral's own line) preempt the timers, everything else runs at
+ * the default.  All of them stay above SVCall and PendSV at 0x80.
+ */
+
+#define UWIC_IRQ_PRIORITY_DEFAULT 0x60
+
+static const struct nvic_priority uwic_irq_priorities[] __initdata = {
+  { LM3S1D21_UART0_IRQ,  0x00 },
+  { LM3S1D21_UART1_IRQ,  0x00 },
+  { LM3S1D21_UART2_IRQ,  0x00 },
+  { LM3S1D21_SSI0_IRQ,   0x20 },
+  { LM3S1D21_SSI1_IRQ,   0x20 },
+  { LM3S1D21_TIMER0_IRQ, 0x40 },
+  { LM3S1D21_TIMER1_IRQ, 0x40 },
+};
+
 static void __init uwic_init_irq(void)
 {
+  unsigned int i;
+
   nvic_init();
+
+  /* All priority bits select the preemption group, no subpriority */
+  lm3s_putreg32(NVIC_AIRCR_VECTKEY | NVIC_AIRCR_PRIGROUP(0), NVIC_AIRCR);
+
+  for (i = 0; i < LM3S_NVIC_IRQS; i++)
+    nvic_set_priority(i, UWIC_IRQ_PRIORITY_DEFAULT);
+  nvic_set_priorities(uwic_irq_priorities, ARRAY_SIZE(uwic_irq_priorities));
+
+  lm3s_gpio_init();
 }
 
 /***************************************************************************/
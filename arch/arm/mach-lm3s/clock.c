@@ -4,9 +4,25 @@
 #include <linux/clocksource.h>
 #include <linux/clockchips.h>
 #include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/sched.h>
+#include <asm/div64.h>
 
 #include <mach/hardware.h>
 #include <mach/timex.h>
+#include <mach/lm3s_clock.h>
+
+/*
+ * Timer1 is a free running 32-bit up counter. Its wrap interrupt extends it
+ * to 64 bits for the clocksource, and its match register provides the
+ * clockevent, so programming the next event never stops or restarts the
+ * counter.
+ *
+ * Timer0 is only used to wake us up from Deep-Sleep, see below.
+ */
+
+/* smallest delta which can be programmed before the counter passes it */
+#define TIMER_MIN_DELTA   0x40
 
 /***************************************************************************/
 
@@ -19,6 +35,7 @@ static int timer_set_next_event(unsigned long evt,
 static void __init clockevents_init(unsigned int irqn);
 static void __init clocksource_init(void);
 static irqreturn_t timer_interrupt(int irq, void *dev_id);
+static irqreturn_t wakeup_interrupt(int irq, void *dev_id);
 static cycle_t clock_get_cycles(struct clocksource *cs);
 
 /***************************************************************************/
@@ -26,7 +43,7 @@ static cycle_t clock_get_cycles(struct clocksource *cs);
 static struct clock_event_device sysclk_clockevent =   {
   .name   = "sysclk_int",
   .shift    = 32,
-  .features       = CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT,
+  .features       = CLOCK_EVT_FEAT_ONESHOT,
   .set_mode = timer_set_mode,
   .set_next_event = timer_set_next_event,
   .rating   = 300,
@@ -39,13 +56,27 @@ static struct clocksource sysclk_clocksource = {
   .name = "sysclk_poll",
   .rating = 200,
   .read = clock_get_cycles,
-  .mask = CLOCKSOURCE_MASK(32),
+  .mask = CLOCKSOURCE_MASK(64),
   .shift  = 20,
   .flags  = CLOCK_SOURCE_IS_CONTINUOUS,
 };
 
 /***************************************************************************/
 
+/* upper half of the clocksource, bumped on every wrap of Timer1 */
+static u32 clocksource_hi;
+
+/* cycles Timer1 has missed while it was stopped in Deep-Sleep */
+static u64 clocksource_offset;
+
+/* Timer1 value of the programmed event */
+static u32 event_match;
+
+/* Timer1 is clocked and counting */
+static int timer1_running;
+
+/***************************************************************************/
+
 static void enable_timer(unsigned int num)
 {
   uint32_t regval;
@@ -66,6 +97,26 @@ static void disable_timer(unsigned int num)
 
 /***************************************************************************/
 
+static void mask_event(void)
+{
+  uint32_t regval;
+  regval = lm3s_getreg32(LM3S_TIMER_GPTMIMR(1));
+  regval &= ~TIMER_GPTMIMR_TAMIM_MASK;
+  lm3s_putreg32(regval, LM3S_TIMER_GPTMIMR(1));
+}
+
+/***************************************************************************/
+
+static void unmask_event(void)
+{
+  uint32_t regval;
+  regval = lm3s_getreg32(LM3S_TIMER_GPTMIMR(1));
+  regval |= TIMER_GPTMIMR_TAMIM_MASK;
+  lm3s_putreg32(regval, LM3S_TIMER_GPTMIMR(1));
+}
+
+/***************************************************************************/
+
 static void timer_set_mode(enum clock_event_mode mode,
          struct clock_event_device *clk)
 {
@@ -75,55 +126,56 @@ static void timer_set_mode(enum clock_event_mode mode,
     return;
   }
 
-  disable_timer(0);
-
   switch(mode) {
-  case CLOCK_EVT_MODE_PERIODIC:
-    printk(KERN_DEBUG "%s\n", "\tCLOCK_EVT_MODE_PERIODIC");
-    // Clear configuration register
-    lm3s_putreg32(0, LM3S_TIMER_GPTMCFG(0));
-    // Setup periodic timer with decrimenting counter
-    lm3s_putreg32(TIMER_GPTMTAMR_TAMR_PERIODIC, LM3S_TIMER_GPTMTAMR(0));
-    // Set CONFIG_HZ interval
-    lm3s_putreg32(CLOCK_TICK_RATE / CONFIG_HZ, LM3S_TIMER_GPTMTAILR(0));
-    // Enable timer interrupt
-    lm3s_putreg32(TIMER_GPTMIMR_TATOIM_MASK, LM3S_TIMER_GPTMIMR(0));
-    // Enable timer
-    enable_timer(0);
-    break;
   case CLOCK_EVT_MODE_ONESHOT:
     printk(KERN_DEBUG "%s\n", "\tCLOCK_EVT_MODE_ONESHOT");
-    lm3s_putreg32(0, LM3S_TIMER_GPTMCFG(0));
-    // Setup one shot timer with decrimenting counter
-    lm3s_putreg32(TIMER_GPTMTAMR_TAMR_ONESHOT, LM3S_TIMER_GPTMTAMR(0));
-
     break;
 	case CLOCK_EVT_MODE_RESUME:
 		printk(KERN_DEBUG "%s\n", "\tCLOCK_EVT_MODE_RESUME");
 		break;
+  case CLOCK_EVT_MODE_PERIODIC:
+    /* not advertised, the core emulates it with oneshot events */
+    break;
   case CLOCK_EVT_MODE_UNUSED:
     printk(KERN_DEBUG "%s\n", "\tCLOCK_EVT_MODE_UNUSED");
+    mask_event();
     break;
   case CLOCK_EVT_MODE_SHUTDOWN:
     printk(KERN_DEBUG "%s\n", "\tCLOCK_EVT_MODE_SHUTDOWN");
+    mask_event();
     break;
   }
 }
 
 /***************************************************************************/
 
+/*
+ * Called with interrupts disabled
+ */
 static int timer_set_next_event(unsigned long evt,
         struct clock_event_device *clk)
 {
+  u32 now;
+
   if( clk != &sysclk_clockevent )
   {
     printk(KERN_ERR "%s: unknown clock device %s\n", __func__, clk->name);
     return -1;
   }
 
-  disable_timer(0);
-  lm3s_putreg32(evt, LM3S_TIMER_GPTMTAILR(0));
-  enable_timer(0);
+  now = lm3s_getreg32(LM3S_TIMER_GPTMTAR(1));
+  event_match = now + evt;
+
+  lm3s_putreg32(event_match, LM3S_TIMER_GPTMTAMATCHR(1));
+  lm3s_putreg32(TIMER_GPTMICR_TAMCINT_MASK, LM3S_TIMER_GPTMICR(1));
+  unmask_event();
+
+  /* the counter keeps running, it may already have passed the match */
+  if( lm3s_getreg32(LM3S_TIMER_GPTMTAR(1)) - now >= evt )
+  {
+    mask_event();
+    return -ETIME;
+  }
 
   return 0;
 }
@@ -138,16 +190,66 @@ static void __init clockevents_init(unsigned int irqn)
   sysclk_clockevent.max_delta_ns =
     clockevent_delta2ns(0xffffffff, &sysclk_clockevent);
   sysclk_clockevent.min_delta_ns =
-    clockevent_delta2ns(0xf, &sysclk_clockevent);
+    clockevent_delta2ns(TIMER_MIN_DELTA, &sysclk_clockevent);
 
   clockevents_register_device(&sysclk_clockevent);
 }
 
 /***************************************************************************/
 
+static u64 timer1_read(void)
+{
+  unsigned long flags;
+  u32 hi, lo;
+
+  local_irq_save(flags);
+
+  hi = clocksource_hi;
+  lo = lm3s_getreg32(LM3S_TIMER_GPTMTAR(1));
+  if( lm3s_getreg32(LM3S_TIMER_GPTMRIS(1)) & TIMER_GPTMRIS_TATORIS_MASK )
+  {
+    /* wrapped and not accounted yet, read again to be after the wrap */
+    hi++;
+    lo = lm3s_getreg32(LM3S_TIMER_GPTMTAR(1));
+  }
+
+  local_irq_restore(flags);
+
+  return ((u64)hi << 32) | lo;
+}
+
+/***************************************************************************/
+
 static cycle_t clock_get_cycles(struct clocksource *cs)
 {
-  return lm3s_getreg32(LM3S_TIMER_GPTMTAR(1));
+  return timer1_read() + clocksource_offset;
+}
+
+/***************************************************************************/
+
+/*
+ * sched_clock() with the resolution of the system clock instead of jiffies.
+ *
+ * It is read from the clocksource counter rather than from the DWT cycle
+ * counter: CYCCNT counts core clocks, which stop in every idle state, while
+ * Timer1 keeps counting in Sleep and is corrected after Deep-Sleep.
+ */
+unsigned long long sched_clock(void)
+{
+  u64 cycles;
+
+  /* printk asks before the timers are set up */
+  if( !timer1_running )
+    return (unsigned long long)(jiffies - INITIAL_JIFFIES) * (NSEC_PER_SEC / HZ);
+
+  cycles = timer1_read() + clocksource_offset;
+
+#if (NSEC_PER_SEC % CLOCK_TICK_RATE) == 0
+  return cycles * (NSEC_PER_SEC / CLOCK_TICK_RATE);
+#else
+  return clocksource_cyc2ns(cycles, sysclk_clocksource.mult,
+                            sysclk_clocksource.shift);
+#endif
 }
 
 /***************************************************************************/
@@ -157,11 +259,15 @@ static void __init clocksource_init()
   disable_timer(1);
 
   lm3s_putreg32(0, LM3S_TIMER_GPTMCFG(1));
-  // Setup periodic timer with incrementing counter
-  lm3s_putreg32(TIMER_GPTMTAMR_TAMR_PERIODIC | TIMER_GPTMTAMR_TACDIR_UP, LM3S_TIMER_GPTMTAMR(1));
+  // Setup periodic timer with incrementing counter and match interrupt
+  lm3s_putreg32(TIMER_GPTMTAMR_TAMR_PERIODIC | TIMER_GPTMTAMR_TACDIR_UP |
+                TIMER_GPTMTAMR_TAMIE_MASK, LM3S_TIMER_GPTMTAMR(1));
   lm3s_putreg32(0xFFFFFFFF, LM3S_TIMER_GPTMTAILR(1));
+  // Wrap interrupt only, the match interrupt is enabled per event
+  lm3s_putreg32(TIMER_GPTMIMR_TATOIM_MASK, LM3S_TIMER_GPTMIMR(1));
   // Enable timer
   enable_timer(1);
+  timer1_running = 1;
 
   sysclk_clocksource.mult =
     clocksource_khz2mult(CLOCK_TICK_RATE / 1000, sysclk_clocksource.shift);
@@ -171,21 +277,191 @@ static void __init clocksource_init()
 
 /***************************************************************************/
 
+/*
+ * In Deep-Sleep the timers run from the 30 kHz deep sleep clock. Timer1 is
+ * gated and stops, Timer0 is kept clocked and loaded in deep sleep ticks to
+ * wake us up for the next event. On the way out the time Timer1 has missed
+ * is taken from what Timer0 has counted meanwhile and added to the
+ * clocksource, and the match is pulled in by the same amount.
+ *
+ * The result is only as accurate as the 30 kHz oscillator.
+ */
+
+static u32 deep_sleep_load;
+static u32 deep_sleep_timer1;
+static int deep_sleep_event;
+static int deep_sleep_woken;
+
+static u32 cycles_to_ticks(u32 cycles)
+{
+  u64 t = (u64)cycles * DEEP_SLEEP_CLOCK_RATE;
+
+  do_div(t, CLOCK_TICK_RATE);
+  return t;
+}
+
+static u64 ticks_to_cycles(u32 ticks)
+{
+  u64 t = (u64)ticks * CLOCK_TICK_RATE;
+
+  do_div(t, DEEP_SLEEP_CLOCK_RATE);
+  return t;
+}
+
+/*
+ * Called with interrupts disabled right before Deep-Sleep, fails if the
+ * next event is too close or the clockevent is not in oneshot mode.
+ */
+int lm3s_timer_deep_sleep_enter(void)
+{
+  u32 load = 0xffffffff;
+  u32 ticks;
+
+  if( sysclk_clockevent.mode != CLOCK_EVT_MODE_ONESHOT )
+    return -EBUSY;
+
+  /* an event or a wrap is waiting to be handled */
+  if( lm3s_getreg32(LM3S_TIMER_GPTMRIS(1)) &
+      (TIMER_GPTMRIS_TATORIS_MASK | TIMER_GPTMRIS_TAMRIS_MASK) )
+    return -EBUSY;
+
+  deep_sleep_event = lm3s_getreg32(LM3S_TIMER_GPTMIMR(1)) & TIMER_GPTMIMR_TAMIM_MASK;
+  if( deep_sleep_event )
+  {
+    ticks = cycles_to_ticks(event_match - lm3s_getreg32(LM3S_TIMER_GPTMTAR(1)));
+    if( ticks < 2 )
+      return -EBUSY;
+    load = ticks;
+  }
+
+  /* with no event pending Timer0 only measures how long we slept */
+  lm3s_putreg32(load, LM3S_TIMER_GPTMTAILR(0));
+  enable_timer(0);
+
+  deep_sleep_load = load;
+  deep_sleep_timer1 = lm3s_getreg32(LM3S_TIMER_GPTMTAR(1));
+  deep_sleep_woken = 0;
+
+  return 0;
+}
+
+/*
+ * Called with interrupts disabled right after Deep-Sleep
+ */
+void lm3s_timer_deep_sleep_exit(void)
+{
+  int expired;
+  u32 left, run, slept, now;
+  u64 cycles;
+
+  expired = lm3s_getreg32(LM3S_TIMER_GPTMRIS(0)) & TIMER_GPTMRIS_TATORIS_MASK;
+  left = expired ? 0 : lm3s_getreg32(LM3S_TIMER_GPTMTAR(0));
+  disable_timer(0);
+  lm3s_putreg32(TIMER_GPTMICR_TATOCINT_MASK, LM3S_TIMER_GPTMICR(0));
+
+  /* Timer0 also counted the cycles we were running, Timer1 only those */
+  now = lm3s_getreg32(LM3S_TIMER_GPTMTAR(1));
+  run = now - deep_sleep_timer1;
+
+  slept = deep_sleep_load - left;
+  if( !expired )
+    slept = slept > run ? slept - run : 0;
+
+  cycles = ticks_to_cycles(slept);
+  clocksource_offset += cycles;
+
+  if( !deep_sleep_event )
+    return;
+
+  /* passed while we were running again, the interrupt is pending */
+  if( lm3s_getreg32(LM3S_TIMER_GPTMRIS(1)) & TIMER_GPTMRIS_TAMRIS_MASK )
+  {
+    deep_sleep_woken = 1;
+    return;
+  }
+
+  if( expired || cycles >= event_match - now )
+  {
+    /* the event is due, let it fire as soon as interrupts are enabled */
+    event_match = now + TIMER_MIN_DELTA;
+    deep_sleep_woken = 1;
+  }
+  else
+    event_match -= cycles;
+
+  lm3s_putreg32(event_match, LM3S_TIMER_GPTMTAMATCHR(1));
+}
+
+/* Has the clockevent fired, interrupts are disabled by the caller */
+int lm3s_timer_expired(void)
+{
+  int woken = deep_sleep_woken;
+
+  deep_sleep_woken = 0;
+  return woken ||
+    (lm3s_getreg32(LM3S_TIMER_GPTMRIS(1)) & TIMER_GPTMRIS_TAMRIS_MASK);
+}
+
+ktime_t lm3s_timer_next_event(void)
+{
+  return sysclk_clockevent.next_event;
+}
+
+/***************************************************************************/
+
+static void __init wakeup_timer_init(void)
+{
+  disable_timer(0);
+
+  lm3s_putreg32(0, LM3S_TIMER_GPTMCFG(0));
+  // Setup one shot timer with decrimenting counter
+  lm3s_putreg32(TIMER_GPTMTAMR_TAMR_ONESHOT, LM3S_TIMER_GPTMTAMR(0));
+  lm3s_putreg32(TIMER_GPTMIMR_TATOIM_MASK, LM3S_TIMER_GPTMIMR(0));
+}
+
+/***************************************************************************/
+
 /*
  * IRQ handler for the timer
  */
 static irqreturn_t timer_interrupt(int irq, void *dev_id)
 {
   struct clock_event_device *evt = (struct clock_event_device *)dev_id;
+  uint32_t status;
+
+  if( evt != &sysclk_clockevent )
+  {
+    printk(KERN_ERR "%s: unknown clock device\n", __func__);
+    return IRQ_HANDLED;
+  }
+
+  status = lm3s_getreg32(LM3S_TIMER_GPTMMIS(1));
 
-  if( evt == &sysclk_clockevent )
+  if( status & TIMER_GPTMMIS_TATOMIS_MASK )
   {
-    /* clear the interrupt */
-    lm3s_putreg32(TIMER_GPTMICR_TATOCINT_MASK, LM3S_TIMER_GPTMICR(0));
+    lm3s_putreg32(TIMER_GPTMICR_TATOCINT_MASK, LM3S_TIMER_GPTMICR(1));
+    clocksource_hi++;
+  }
+
+  if( status & TIMER_GPTMMIS_TAMMIS_MASK )
+  {
+    /* the match would fire again on the next lap otherwise */
+    mask_event();
+    lm3s_putreg32(TIMER_GPTMICR_TAMCINT_MASK, LM3S_TIMER_GPTMICR(1));
     evt->event_handler(evt);
   }
-  else
-    printk(KERN_ERR "%s: unknown clock device\n", __func__);
+
+  return IRQ_HANDLED;
+}
+
+/***************************************************************************/
+
+/*
+ * Timer0 only wakes us up, lm3s_timer_deep_sleep_exit() does the rest
+ */
+static irqreturn_t wakeup_interrupt(int irq, void *dev_id)
+{
+  lm3s_putreg32(TIMER_GPTMICR_TATOCINT_MASK, LM3S_TIMER_GPTMICR(0));
 
   return IRQ_HANDLED;
 }
@@ -199,6 +475,12 @@ static struct irqaction timer_irqaction = {
   .dev_id   = &sysclk_clockevent,
 };
 
+static struct irqaction wakeup_irqaction = {
+  .name     = "LM3S1D21 Deep-Sleep Wakeup",
+  .flags    = IRQF_DISABLED | IRQF_TIMER,
+  .handler  = wakeup_interrupt,
+};
+
 /***************************************************************************/
 
 void __init lm3s1d21_timer_init(void)
@@ -210,7 +492,15 @@ void __init lm3s1d21_timer_init(void)
   regval |= SYSCON_RCGC1_TIMER1; // Enable Timer1
   lm3s_putreg32(regval, LM3S_SYSCON_RCGC1);
 
-  setup_irq(LM3S1D21_TIMER0_IRQ, &timer_irqaction);
+  // Only Timer0 keeps running in Deep-Sleep, to wake us up
+  regval = lm3s_getreg32(LM3S_SYSCON_DCGC1);
+  regval |= SYSCON_DCGC1_TIMER0;
+  regval &= ~SYSCON_DCGC1_TIMER1;
+  lm3s_putreg32(regval, LM3S_SYSCON_DCGC1);
+
+  setup_irq(LM3S1D21_TIMER0_IRQ, &wakeup_irqaction);
+  setup_irq(LM3S1D21_TIMER1_IRQ, &timer_irqaction);
+  wakeup_timer_init();
   clocksource_init();
-  clockevents_init(LM3S1D21_TIMER0_IRQ);
-}
\ No newline at end of file
+  clockevents_init(LM3S1D21_TIMER1_IRQ);
+}
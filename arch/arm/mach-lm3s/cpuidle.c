@@ -9,36 +9,87 @@
  * warranty of any kind, whether express or implied.
  *
  * The cpu idle uses Sleep, Deep-Sleep and RAM self refresh in order
- * to implement two idle states -
+ * to implement three idle states -
  * #1 Sleep
- * #2 Deep-Sleep and RAM self refresh
+ * #2 Sleep and RAM self refresh
+ * #3 Deep-Sleep and RAM self refresh
+ *
+ * The exit latency of every state is measured on the fly: whenever the
+ * clockevent wakes us up, the time between the programmed event and the
+ * moment we are running again is read from the GPTM clocksource. Once a
+ * state has collected enough samples its exit_latency and target_residency
+ * are replaced by the measured values. Residency histograms and the
+ * measured latencies are found in
+ * /sys/devices/system/cpu/cpu0/cpuidle/lm3s/.
  */
 
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/platform_device.h>
 #include <linux/cpuidle.h>
+#include <linux/ktime.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
 #include <asm/proc-fns.h>
 #include <asm/cpu-single.h>
 #include <linux/io.h>
 #include <mach/hardware.h>
 #include <mach/sram.h>
+#include <mach/lm3s_clock.h>
+#ifdef CONFIG_LM3S_DMA
+#  include <mach/dma.h>
+#endif
 #include <linux/delay.h>
 #include <linux/leds.h>
 
-#define LM3S_MAX_STATES 2
+#define LM3S_MAX_STATES 3
 #define DRIVER_NAME "lm3s-idle"
 
+/* state used when Deep-Sleep is not possible right now */
+#define LM3S_SLEEP_STATE 1
+
+/* timer wakeups needed before the measured latency is used */
+#define LM3S_CALIBRATION_SAMPLES  32
+/* target residency in units of the exit latency */
+#define LM3S_RESIDENCY_FACTOR     4
+
+/* residency buckets: <10us, <100us, ... <1s, >=1s */
+#define LM3S_RESIDENCY_BUCKETS    7
+
+#ifdef CONFIG_LM3S_DMA
+#define DMA_CHANNEL_MASK(ch) (1 << ((ch) & ~DMA_CHANNEL_ALT))
+
+/*
+ * uDMA channels which are only enabled while a transfer is in flight. The
+ * UART RX channels are left out: they stay armed for as long as the port
+ * is open, whether anything arrives or not.
+ */
+#define DMA_BUSY_CHANNELS                   \
+  (DMA_CHANNEL_MASK(DMA_CHANNEL_SSI0_RX)  | \
+   DMA_CHANNEL_MASK(DMA_CHANNEL_SSI0_TX)  | \
+   DMA_CHANNEL_MASK(DMA_CHANNEL_SSI1_RX)  | \
+   DMA_CHANNEL_MASK(DMA_CHANNEL_SSI1_TX)  | \
+   DMA_CHANNEL_MASK(DMA_CHANNEL_UART0_TX) | \
+   DMA_CHANNEL_MASK(DMA_CHANNEL_UART1_TX) | \
+   DMA_CHANNEL_MASK(DMA_CHANNEL_UART2_TX))
+#endif
+
 #ifdef CONFIG_LEDS_TRIGGER_CPUIDLE
 DEFINE_LED_TRIGGER(cpuidle_led_trigger);
 #endif
 
 struct lm3s_idle_state
 {
+  int (*prepare)(void);
   int (*enter)(void);
+  void (*finish)(void);
+
+  unsigned int samples;
+  unsigned int exit_latency_max;
+  unsigned long demotions;
+  unsigned long residency[LM3S_RESIDENCY_BUCKETS];
 };
 
-/*
 static inline void __sram enable_deep_sleep(void)
 {
   uint32_t regval;
@@ -54,12 +105,10 @@ static inline void __sram disable_deep_sleep(void)
   regval &= ~SCB_SYSCTRL_SLEEPDEEP_MASK;
   lm3s_putreg32(regval, LM3S_SCB_SYSCTRL);
 }
-*/
 
+/* Called with interrupts disabled, wfi returns on a pending interrupt */
 static int __sram cpu_do_sleep(void)
 {
-	local_irq_disable();
-  //enable_deep_sleep();
   asm(
     "ldr r0, =%0\n"     /* r0 = LM3S_EPI0_SDRAMCFG */
     "ldr r1, [r0]\n"    /* r1 = lm3s_getreg32(r0) */
@@ -76,28 +125,147 @@ static int __sram cpu_do_sleep(void)
   : "n"(LM3S_EPI0_SDRAMCFG), "n"(EPI_SDRAMCFG_SLEEP_ON)
   : "r0", "r1", "r2"
   );
-	local_irq_enable();
-  //disable_deep_sleep();
   return 0;
 }
 
+/*
+ * In Deep-Sleep only Timer0 and the GPIO ports are clocked, from the 30 kHz
+ * deep sleep clock; every other peripheral, uDMA included, gets no clock at
+ * all. Refuse to go there while a transfer is in flight on DMA, SSI or UART,
+ * or while a UART is open for receiving: its baud rate is derived from the
+ * run mode clock, so it could neither take in a byte nor wake us with it.
+ */
+static int lm3s_peripherals_idle(void)
+{
+  uint32_t rcgc1 = lm3s_getreg32(LM3S_SYSCON_RCGC1);
+  int i;
+
+#ifdef CONFIG_LM3S_DMA
+  if( lm3s_getreg32(LM3S_DMA_ENASET) & DMA_BUSY_CHANNELS )
+    return 0;
+#endif
+
+  for( i = 0; i < 2; i++ )
+    if( (rcgc1 & (SYSCON_RCGC1_SSI0 << i)) &&
+        (lm3s_getreg32(LM3S_SSI_SR(i)) & SSI_SR_BSY) )
+      return 0;
+
+  for( i = 0; i < 3; i++ )
+    if( (rcgc1 & (SYSCON_RCGC1_UART0 << i)) &&
+        ((lm3s_getreg32(LM3S_UART_FR(i)) & UART_FR_BUSY) ||
+         (lm3s_getreg32(LM3S_UART_IM(i)) & (UART_IM_RXIM | UART_IM_RTIM))) )
+      return 0;
+
+  return 1;
+}
+
+static int cpu_prepare_deep_sleep(void)
+{
+  if( !lm3s_peripherals_idle() )
+    return -EBUSY;
+
+  if( lm3s_timer_deep_sleep_enter() )
+    return -EBUSY;
+
+  enable_deep_sleep();
+  return 0;
+}
+
+static void cpu_finish_deep_sleep(void)
+{
+  disable_deep_sleep();
+  lm3s_timer_deep_sleep_exit();
+}
+
+static struct lm3s_idle_state lm3s_idle_states[LM3S_MAX_STATES] =
+{
+  { .enter = cpu_do_idle },
+  { .enter = cpu_do_sleep },
+  {
+    .prepare = cpu_prepare_deep_sleep,
+    .enter   = cpu_do_sleep,
+    .finish  = cpu_finish_deep_sleep,
+  },
+};
+
+static void lm3s_account_residency(struct lm3s_idle_state *lm3s_state,
+             unsigned int us)
+{
+  int bucket = 0;
+
+  while( bucket < LM3S_RESIDENCY_BUCKETS - 1 && us >= 10 )
+  {
+    us /= 10;
+    bucket++;
+  }
+
+  lm3s_state->residency[bucket]++;
+}
+
+static void lm3s_account_latency(struct cpuidle_state *state,
+             struct lm3s_idle_state *lm3s_state, unsigned int latency)
+{
+  if( latency > lm3s_state->exit_latency_max )
+    lm3s_state->exit_latency_max = latency;
+
+  if( lm3s_state->samples < LM3S_CALIBRATION_SAMPLES )
+  {
+    if( ++lm3s_state->samples < LM3S_CALIBRATION_SAMPLES )
+      return;
+  }
+  else if( latency <= state->exit_latency )
+    return;
+
+  state->exit_latency = max(lm3s_state->exit_latency_max, 1U);
+  state->target_residency = state->exit_latency * LM3S_RESIDENCY_FACTOR;
+}
+
 /* Actual code that puts the SoC in different idle states */
 static int lm3s_enter_idle(struct cpuidle_device *dev,
              struct cpuidle_state *state)
 {
-	struct timeval before, after;
-	int idle_time;
 	struct lm3s_idle_state *lm3s_state = state->driver_data;
+	ktime_t before, after, event;
+	s64 late;
+	int idle_time, woken_by_timer;
 
 #ifdef CONFIG_LEDS_TRIGGER_CPUIDLE
 	led_trigger_event(cpuidle_led_trigger, LED_OFF);
 #endif
 
-	do_gettimeofday(&before);
+	local_irq_disable();
+
+	before = ktime_get();
+
+	if( lm3s_state->prepare && lm3s_state->prepare() )
+	{
+		lm3s_state->demotions++;
+		state = &dev->states[LM3S_SLEEP_STATE];
+		dev->last_state = state;
+		lm3s_state = state->driver_data;
+	}
+
 	lm3s_state->enter();
-	do_gettimeofday(&after);
-	idle_time = (after.tv_sec - before.tv_sec) * USEC_PER_SEC +
-			(after.tv_usec - before.tv_usec);
+
+	if( lm3s_state->finish )
+		lm3s_state->finish();
+
+	after = ktime_get();
+	woken_by_timer = lm3s_timer_expired();
+	event = lm3s_timer_next_event();
+
+	local_irq_enable();
+
+	idle_time = ktime_to_us(ktime_sub(after, before));
+	lm3s_account_residency(lm3s_state, idle_time);
+
+	/* only an event which was due while we were sleeping tells the latency */
+	if( woken_by_timer && ktime_to_ns(ktime_sub(event, before)) > 0 )
+	{
+		late = ktime_to_us(ktime_sub(after, event));
+		if( late >= 0 )
+			lm3s_account_latency(state, lm3s_state, late);
+	}
 
 #ifdef CONFIG_LEDS_TRIGGER_CPUIDLE
 	led_trigger_event(cpuidle_led_trigger, LED_FULL);
@@ -106,12 +274,10 @@ static int lm3s_enter_idle(struct cpuidle_device *dev,
 	return idle_time;
 }
 
-static struct lm3s_idle_state lm3s_idle_states[LM3S_MAX_STATES] =
-{
-	{ .enter = cpu_do_idle },
-	{ .enter = cpu_do_sleep },
-};
-
+/*
+ * Until they are measured, exit latencies are rough guesses on the high side
+ * so that the governor does not pick the deeper states too eagerly.
+ */
 struct cpuidle_device lm3s_cpuidle_device =
 {
 	.state_count = LM3S_MAX_STATES,
@@ -120,19 +286,30 @@ struct cpuidle_device lm3s_cpuidle_device =
 		{
 			.name             = "idle0",
 			.desc             = "MCU Sleep",
+			.flags            = CPUIDLE_FLAG_TIME_VALID | CPUIDLE_FLAG_SHALLOW,
 			.exit_latency     = 1,
-			.target_residency = 50000,
+			.target_residency = 4,
 			.driver_data      = &lm3s_idle_states[0],
 			.enter            = lm3s_enter_idle,
 		},
 		{
 			.name             = "idle1",
 			.desc             = "MCU Sleep & DRAM Self Refresh",
+			.flags            = CPUIDLE_FLAG_TIME_VALID | CPUIDLE_FLAG_BALANCED,
 			.exit_latency     = 20,
-			.target_residency = 250000,
+			.target_residency = 80,
 			.driver_data      = &lm3s_idle_states[1],
 			.enter            = lm3s_enter_idle,
 		},
+		{
+			.name             = "idle2",
+			.desc             = "MCU Deep-Sleep & DRAM Self Refresh",
+			.flags            = CPUIDLE_FLAG_TIME_VALID | CPUIDLE_FLAG_DEEP,
+			.exit_latency     = 2000,
+			.target_residency = 8000,
+			.driver_data      = &lm3s_idle_states[2],
+			.enter            = lm3s_enter_idle,
+		},
 	},
 };
 
@@ -141,9 +318,86 @@ static struct cpuidle_driver lm3s_idle_driver = {
 	.owner = THIS_MODULE,
 };
 
+/***************************************************************************/
+
+static ssize_t residency_show(struct kobject *kobj,
+             struct kobj_attribute *attr, char *buf)
+{
+  static const char *buckets[LM3S_RESIDENCY_BUCKETS] =
+  {
+    "<10us", "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s",
+  };
+  ssize_t len;
+  int i, j;
+
+  len = sprintf(buf, "%-8s", "");
+  for( j = 0; j < LM3S_MAX_STATES; j++ )
+    len += sprintf(buf + len, " %10s", lm3s_cpuidle_device.states[j].name);
+  len += sprintf(buf + len, "\n");
+
+  for( i = 0; i < LM3S_RESIDENCY_BUCKETS; i++ )
+  {
+    len += sprintf(buf + len, "%-8s", buckets[i]);
+    for( j = 0; j < LM3S_MAX_STATES; j++ )
+      len += sprintf(buf + len, " %10lu", lm3s_idle_states[j].residency[i]);
+    len += sprintf(buf + len, "\n");
+  }
+
+  return len;
+}
+
+static ssize_t latency_show(struct kobject *kobj,
+             struct kobj_attribute *attr, char *buf)
+{
+  struct cpuidle_state *state;
+  struct lm3s_idle_state *lm3s_state;
+  ssize_t len = 0;
+  int i;
+
+  for( i = 0; i < LM3S_MAX_STATES; i++ )
+  {
+    state = &lm3s_cpuidle_device.states[i];
+    lm3s_state = &lm3s_idle_states[i];
+
+    len += sprintf(buf + len,
+                   "%s: exit_latency %uus target_residency %uus "
+                   "max %uus samples %u%s demotions %lu\n",
+                   state->name, state->exit_latency, state->target_residency,
+                   lm3s_state->exit_latency_max, lm3s_state->samples,
+                   lm3s_state->samples < LM3S_CALIBRATION_SAMPLES ?
+                     " (calibrating)" : "",
+                   lm3s_state->demotions);
+  }
+
+  return len;
+}
+
+static struct kobj_attribute residency_attr = __ATTR_RO(residency);
+static struct kobj_attribute latency_attr = __ATTR_RO(latency);
+
+static struct attribute *lm3s_idle_attrs[] = {
+  &residency_attr.attr,
+  &latency_attr.attr,
+  NULL,
+};
+
+static struct attribute_group lm3s_idle_attr_group = {
+  .attrs = lm3s_idle_attrs,
+};
+
+/***************************************************************************/
+
 /* Initialize CPU idle by registering the idle states */
 static int __init lm3s_init_cpuidle(void)
 {
+  struct kobject *kobj;
+  uint32_t regval;
+
+  /* keep the GPIO ports clocked in Deep-Sleep so their interrupts wake us */
+  regval = lm3s_getreg32(LM3S_SYSCON_DCGC2);
+  regval |= lm3s_getreg32(LM3S_SYSCON_RCGC2) & (SYSCON_DCGC2_GPIO(9) - 1);
+  lm3s_putreg32(regval, LM3S_SYSCON_DCGC2);
+
   cpuidle_register_driver(&lm3s_idle_driver);
 
   if (cpuidle_register_device(&lm3s_cpuidle_device)) {
@@ -151,6 +405,10 @@ static int __init lm3s_init_cpuidle(void)
     return -EIO;
   }
 
+  kobj = kobject_create_and_add("lm3s", &lm3s_cpuidle_device.kobj);
+  if( !kobj || sysfs_create_group(kobj, &lm3s_idle_attr_group) )
+    printk(KERN_WARNING "%s: no sysfs statistics\n", __func__);
+
 #ifdef CONFIG_LEDS_TRIGGER_CPUIDLE
   led_trigger_register_simple("cpuidle", &cpuidle_led_trigger);
 #endif
@@ -8,6 +8,8 @@
  * published by the Free Software Foundation.
  *
  */
+#include <linux/kernel.h>
+#include <linux/errno.h>
 #include <linux/slab.h>
 #include <linux/mman.h>
 #include <linux/init.h>
@@ -25,104 +27,6 @@ void printascii(const char *str);
 #define __dma_channels __sramdata __attribute__((aligned(DMA_CHANNEL_TABLE_ALIGNMENT)))
 #define CHANNEL_NUMBER(channel) ((channel) & 0xff)
 
-struct lm3s_dma_channel {
-  uint32_t DMASRCENDP;
-  uint32_t DMADSTENDP;
-  struct {
-		/*
-		 * DMA Transfer Mode
-		 *
-		 * 0x0 Stop
-		 * 0x1 Basic
-		 * 0x2 Auto-Request
-		 * 0x3 Ping-Pong
-		 * 0x4 Memory Scatter-Gather
-		 * 0x5 Alternate Memory Scatter-Gather
-		 * 0x6 Peripheral Scatter-Gather
-		 * 0x7 Alternate Peripheral Scatter-Gather
-		 */
-		uint32_t XFERMODE:3;
-
-		/*
-		 * Next Useburst
-		 */
-		uint32_t NXTUSEBURST:1;
-
-		/*
-		 * Transfer Size (minus 1)
-		 */
-		uint32_t XFERSIZE:10;
-
-		/*
-		 * Arbitration Size
-		 *
-		 * 0x0 1 Transfer
-		 * Arbitrates after each μDMA transfer
-		 * 0x1 2 Transfers
-		 * 0x2 4 Transfers
-		 * 0x3 8 Transfers
-		 * 0x4 16 Transfers
-		 * 0x5 32 Transfers
-		 * 0x6 64 Transfers
-		 * 0x7 128 Transfers
-		 * 0x8 256 Transfers
-		 * 0x9 512 Transfers
-		 * 0xA-0xF 1024 Transfers
-		 * In this configuration, no arbitration occurs during the μDMA
-		 * transfer because the maximum transfer size is 1024.
-		 */
-		uint32_t ARBSIZE:4;
-
-		/*
-		 * reserved
-		 */
-		uint32_t reserved:6;
-
-		/*
-		 * Source Data Size
-		 *
-		 * 0x0 Byte
-		 * 8-bit data size.
-		 * 0x1 Half-word
-		 * 16-bit data size.
-		 * 0x2 Word
-		 * 32-bit data size.
-		 * 0x3 Reserved
-		 */
-		uint32_t SRCSIZE:2;
-
-		/*
-		 * Source Address Increment
-		 *
-		 * 0x0 Byte
-		 * Increment by 8-bit locations
-		 * 0x1 Half-word
-		 * Increment by 16-bit locations
-		 * 0x2 Word
-		 * Increment by 32-bit locations
-		 * 0x3 No increment
-		 * Address remains set to the value of the Source Address End
-		 * Pointer (DMASRCENDP) for the chann
-		 */
-		uint32_t SRCINC:2;
-
-		/*
-		 * Destination Data Size
-		 *
-		 * See description of SRCSIZE
-		 */
-		uint32_t DSTSIZE:2;
-
-		/*
-		 * Destination Address Increment
-		 *
-		 * See description of SRCINC
-		 */
-		uint32_t DSTINC:2;
-	} DMACHCTL;
-  uint32_t unused;
-};
-
 static struct lm3s_dma_channel __dma_channels lm3s_dma_channels[LM3S_NUDMA * 2];
 
 void dma_setup_channel(unsigned int channel, unsigned int config)
@@ -148,16 +52,12 @@ void dma_setup_channel(unsigned int channel, unsigned int config)
 		lm3s_putreg32(chmask, LM3S_DMA_USEBURSTCLR);
 }
 
-void __sram dma_setup_xfer(unsigned int channel, void *dst, void *src, size_t size, unsigned int flags)
+static void __sram dma_fill_channel(struct lm3s_dma_channel *dma_channel,
+                                    void *dst, void *src, size_t size, unsigned int flags)
 {
-	int ch = CHANNEL_NUMBER(channel);
-	int chmask = 1 << ch;
 	int transfer_unit_size_code = 0;
 	size_t length;
-	struct lm3s_dma_channel *dma_channel = lm3s_dma_channels + ch;
-
-	if( flags & DMA_XFER_ALT )
-		dma_channel += LM3S_NUDMA;
+	size_t last_offset;
 
 	if( flags & DMA_XFER_UNIT_BYTE )
 		transfer_unit_size_code = 0;
@@ -168,16 +68,26 @@ void __sram dma_setup_xfer(unsigned int channel, void *dst, void *src, size_t si
 
 	length = size >> transfer_unit_size_code;
 
-	if( flags & DMA_XFER_DEVICE_TO_MEMORY )
+	/* End pointers address the last unit of the buffer, not its last byte */
+	last_offset = (length - 1) << transfer_unit_size_code;
+
+	if( flags & DMA_XFER_MEMORY_TO_MEMORY )
+	{
+		dma_channel->DMASRCENDP = (uint32_t)((char*)src + last_offset);
+		dma_channel->DMADSTENDP = (uint32_t)((char*)dst + last_offset);
+		dma_channel->DMACHCTL.DSTINC = transfer_unit_size_code;
+		dma_channel->DMACHCTL.SRCINC = transfer_unit_size_code;
+	}
+	else if( flags & DMA_XFER_DEVICE_TO_MEMORY )
 	{
 		dma_channel->DMASRCENDP = (uint32_t)src;
-		dma_channel->DMADSTENDP = (uint32_t)((char*)dst + length - 1);
+		dma_channel->DMADSTENDP = (uint32_t)((char*)dst + last_offset);
 		dma_channel->DMACHCTL.DSTINC = transfer_unit_size_code;
 		dma_channel->DMACHCTL.SRCINC = 3;
 	}
 	else
 	{
-		dma_channel->DMASRCENDP = (uint32_t)((char*)src + length - 1);
+		dma_channel->DMASRCENDP = (uint32_t)((char*)src + last_offset);
 		dma_channel->DMADSTENDP = (uint32_t)dst;
 		dma_channel->DMACHCTL.DSTINC = 3;
 		dma_channel->DMACHCTL.SRCINC = transfer_unit_size_code;
@@ -189,15 +99,127 @@ void __sram dma_setup_xfer(unsigned int channel, void *dst, void *src, size_t si
 	dma_channel->DMACHCTL.ARBSIZE = 0;
 	dma_channel->DMACHCTL.XFERSIZE = length - 1;
 	dma_channel->DMACHCTL.NXTUSEBURST = 0;
+}
+
+void __sram dma_setup_xfer(unsigned int channel, void *dst, void *src, size_t size, unsigned int flags)
+{
+	int ch = CHANNEL_NUMBER(channel);
+	struct lm3s_dma_channel *dma_channel = lm3s_dma_channels + ch;
+
+	if( flags & DMA_XFER_ALT )
+		dma_channel += LM3S_NUDMA;
+
+	dma_fill_channel(dma_channel, dst, src, size, flags);
 
 	if( flags & DMA_XFER_MODE_PINGPONG )
-		dma_channel->DMACHCTL.XFERMODE = 3;
+		dma_channel->DMACHCTL.XFERMODE = DMA_CHCTL_XFERMODE_PING_PONG;
 	else
-		dma_channel->DMACHCTL.XFERMODE = 1;
+		dma_channel->DMACHCTL.XFERMODE = DMA_CHCTL_XFERMODE_BASIC;
 
 	//printk("DMA transfer: ch# %i, dst %p, src %p, size %u\n", ch, dst, src, dma_channel->DMACHCTL.XFERSIZE);
 }
 
+/*
+ * Scatter-gather support.
+ *
+ * A task list is an array of channel control structures which the primary
+ * control structure of the channel copies, one by one, into the alternate
+ * control structure. Each copied task is then executed before the next one
+ * is fetched, so a chain of up to DMA_MAX_SG_TASKS buffers is handled by the
+ * hardware with a single completion interrupt at the end.
+ *
+ * The task list must stay untouched in DMA-reachable memory (SRAM or EPI
+ * SDRAM) until the chain completes.
+ */
+
+/*
+ * Describe one buffer of a chain. The transfer mode of the task is set
+ * by dma_setup_sg_xfer() once the whole list is known.
+ */
+void __sram dma_setup_sg_task(struct lm3s_dma_channel *task, void *dst, void *src, size_t size, unsigned int flags)
+{
+	dma_fill_channel(task, dst, src, size, flags);
+	task->DMACHCTL.XFERMODE = DMA_CHCTL_XFERMODE_STOP;
+	task->unused = 0;
+}
+
+/*
+ * Split a buffer larger than DMA_MAX_TRANSFER_SIZE units into consecutive
+ * tasks. Returns the number of tasks used or -EINVAL when the buffer does
+ * not fit into max_tasks entries.
+ */
+int __sram dma_build_sg_list(struct lm3s_dma_channel *tasks, int max_tasks, void *dst, void *src, size_t size, unsigned int flags)
+{
+	int ntasks = 0;
+	size_t max_chunk = DMA_MAX_TRANSFER_SIZE;
+
+	if( flags & DMA_XFER_UNIT_WORD )
+		max_chunk <<= 1;
+	else if( flags & DMA_XFER_UNIT_DOUBLE_WORD )
+		max_chunk <<= 2;
+
+	while( size )
+	{
+		size_t chunk = min(size, max_chunk);
+
+		if( ntasks >= max_tasks )
+			return -EINVAL;
+
+		dma_setup_sg_task(tasks + ntasks, dst, src, chunk, flags);
+		ntasks++;
+
+		if( flags & (DMA_XFER_DEVICE_TO_MEMORY | DMA_XFER_MEMORY_TO_MEMORY) )
+			dst = (char*)dst + chunk;
+		if( !(flags & DMA_XFER_DEVICE_TO_MEMORY) )
+			src = (char*)src + chunk;
+		size -= chunk;
+	}
+
+	return ntasks;
+}
+
+/*
+ * Program the primary control structure of a channel to run the task list.
+ * Peripheral scatter-gather is used unless DMA_XFER_MEMORY_TO_MEMORY is
+ * given, in which case the chain is started with dma_request_xfer().
+ */
+void __sram dma_setup_sg_xfer(unsigned int channel, struct lm3s_dma_channel *tasks, int ntasks, unsigned int flags)
+{
+	int ch = CHANNEL_NUMBER(channel);
+	int i;
+	struct lm3s_dma_channel *dma_channel = lm3s_dma_channels + ch;
+	struct lm3s_dma_channel *alt_channel = dma_channel + LM3S_NUDMA;
+	int memory_sg = flags & DMA_XFER_MEMORY_TO_MEMORY;
+
+	BUG_ON(ntasks <= 0 || ntasks > DMA_MAX_SG_TASKS);
+
+	/* Every task but the last one returns control to the primary structure */
+	for( i = 0; i < ntasks - 1; i++ )
+		tasks[i].DMACHCTL.XFERMODE = memory_sg ? DMA_CHCTL_XFERMODE_ALT_MEM_SG
+		                                       : DMA_CHCTL_XFERMODE_ALT_PER_SG;
+	tasks[ntasks - 1].DMACHCTL.XFERMODE = memory_sg ? DMA_CHCTL_XFERMODE_AUTO
+	                                                : DMA_CHCTL_XFERMODE_BASIC;
+
+	/* Copy the list word by word into the alternate structure */
+	dma_channel->DMASRCENDP = (uint32_t)&tasks[ntasks - 1].unused;
+	dma_channel->DMADSTENDP = (uint32_t)&alt_channel->unused;
+	dma_channel->DMACHCTL.DSTINC = 2;
+	dma_channel->DMACHCTL.SRCINC = 2;
+	dma_channel->DMACHCTL.DSTSIZE = 2;
+	dma_channel->DMACHCTL.SRCSIZE = 2;
+	dma_channel->DMACHCTL.reserved = 0;
+	dma_channel->DMACHCTL.ARBSIZE = 2; /* one task (4 words) per arbitration */
+	dma_channel->DMACHCTL.XFERSIZE = ntasks * 4 - 1;
+	dma_channel->DMACHCTL.NXTUSEBURST = 0;
+	dma_channel->DMACHCTL.XFERMODE = memory_sg ? DMA_CHCTL_XFERMODE_MEM_SG
+	                                           : DMA_CHCTL_XFERMODE_PER_SG;
+}
+
+void __sram dma_request_xfer(unsigned int channel)
+{
+	lm3s_putreg32(1 << CHANNEL_NUMBER(channel), LM3S_DMA_SWREQ);
+}
+
 void __sram dma_start_xfer(unsigned int channel)
 {
 	int chmask = 1 << CHANNEL_NUMBER(channel);
@@ -214,6 +236,25 @@ void __sram dma_stop_xfer(unsigned int channel)
 	lm3s_putreg32(chmask, LM3S_DMA_ENACLR);
 }
 
+/*
+ * Ignore requests from the peripheral without touching the control
+ * structures, so the transfer carries on where it left off once resumed.
+ */
+void __sram dma_pause_xfer(unsigned int channel)
+{
+	lm3s_putreg32(1 << CHANNEL_NUMBER(channel), LM3S_DMA_REQMASKSET);
+}
+
+void __sram dma_resume_xfer(unsigned int channel)
+{
+	lm3s_putreg32(1 << CHANNEL_NUMBER(channel), LM3S_DMA_REQMASKCLR);
+}
+
+int __sram dma_xfer_running(unsigned int channel)
+{
+	return (lm3s_getreg32(LM3S_DMA_ENASET) >> CHANNEL_NUMBER(channel)) & 1;
+}
+
 void dma_wait_xfer_complete(unsigned int channel)
 {
 	int ch = CHANNEL_NUMBER(channel);
@@ -38,6 +38,13 @@
  * Included Files
  ****************************************************************************/
 
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/irq.h>
+#include <linux/spinlock.h>
+#include <linux/gpio.h>
+
+#include <asm/mach/irq.h>
 #include <mach/hardware.h>
 
 /****************************************************************************
@@ -112,6 +119,14 @@ struct gpio_func_s
   uint8_t clrbits;  /* A set of GPIO register bits to clear */
 };
 
+struct lm3s_gpio_port
+{
+  struct gpio_chip chip;      /* gpiolib view of the 8 port pins */
+  unsigned int     port;      /* Port number, index into g_gpiobase */
+  unsigned int     irq;       /* NVIC port interrupt, NO_IRQ if not demultiplexed */
+  spinlock_t       lock;      /* Serialises read-modify-write of DIR/IS/IBE/... */
+};
+
 /****************************************************************************
  * Private Data
  ****************************************************************************/
@@ -128,7 +143,9 @@ static const struct gpio_func_s g_funcbits[] =
   {GPIO_INTERRUPT_SETBITS, GPIO_INTERRUPT_CLRBITS}, /* GPIO_FUNC_INTERRUPT */
 };
 
-static const uint32_t g_gpiobase[LM3S_NPORTS] =
+/* Switched to the AHB aperture by lm3s_gpio_init() */
+
+static uint32_t g_gpiobase[LM3S_NPORTS] =
 {
   /* All support LM3S parts have at least 7 ports, GPIOA-G */
 
@@ -148,6 +165,56 @@ static const uint32_t g_gpiobase[LM3S_NPORTS] =
 #endif
 };
 
+#ifdef LM3S_GPIOAAHB_BASE
+static const uint32_t g_gpioahbbase[LM3S_NPORTS] =
+{
+  LM3S_GPIOAAHB_BASE, LM3S_GPIOBAHB_BASE, LM3S_GPIOCAHB_BASE, LM3S_GPIODAHB_BASE,
+  LM3S_GPIOEAHB_BASE, LM3S_GPIOFAHB_BASE, LM3S_GPIOGAHB_BASE,
+#if LM3S_NPORTS > 7
+  LM3S_GPIOHAHB_BASE,
+#endif
+#if LM3S_NPORTS > 8
+  LM3S_GPIOJAHB_BASE,
+#endif
+};
+#endif
+
+/* Port interrupts demultiplexed into per-pin interrupts.  GPIOJ has its
+ * NVIC line above LM3S_NVIC_IRQS and is left as a plain gpio_chip.
+ */
+
+static const unsigned int g_gpioirq[LM3S_NPORTS] =
+{
+  LM3S1D21_GPIOA_IRQ, LM3S1D21_GPIOB_IRQ, LM3S1D21_GPIOC_IRQ, LM3S1D21_GPIOD_IRQ,
+  LM3S1D21_GPIOE_IRQ, LM3S1D21_GPIOF_IRQ, LM3S1D21_GPIOG_IRQ,
+#if LM3S_NPORTS > 7
+  LM3S1D21_GPIOH_IRQ,
+#endif
+#if LM3S_NPORTS > 8
+  NO_IRQ,
+#endif
+};
+
+static const char * const g_gpiolabel[LM3S_NPORTS] =
+{
+  "GPIOA", "GPIOB", "GPIOC", "GPIOD", "GPIOE", "GPIOF", "GPIOG",
+#if LM3S_NPORTS > 7
+  "GPIOH",
+#endif
+#if LM3S_NPORTS > 8
+  "GPIOJ",
+#endif
+};
+
+static struct lm3s_gpio_port g_gpioports[LM3S_NPORTS] =
+{
+  [0 ... LM3S_NPORTS - 1] =
+    {
+      .irq  = NO_IRQ,
+      .lock = __SPIN_LOCK_UNLOCKED(g_gpioports.lock),
+    },
+};
+
 /****************************************************************************
  * Public Data
  ****************************************************************************/
@@ -175,6 +242,55 @@ static uint32_t lm3s_gpiobaseaddress(unsigned int port)
   return gpiobase;
 }
 
+/****************************************************************************
+ * Name: lm3s_gpioclock
+ *
+ * Description:
+ *   Enable clocking for a GPIO port. "To use the GPIO, the peripheral
+ *   clock must be enabled by setting the appropriate GPIO Port bit field
+ *   (GPIOn) in the RCGC2 register."
+ *
+ ****************************************************************************/
+
+static void lm3s_gpioclock(unsigned int port)
+{
+  unsigned long flags;
+  uint32_t regval;
+
+  local_irq_save(flags);
+  regval = lm3s_getreg32(LM3S_SYSCON_RCGC2);
+  if ((regval & SYSCON_RCGC2_GPIO(port)) == 0)
+    {
+      lm3s_putreg32(regval | SYSCON_RCGC2_GPIO(port), LM3S_SYSCON_RCGC2);
+    }
+  local_irq_restore(flags);
+}
+
+/****************************************************************************
+ * Name: lm3s_gpiomodify
+ *
+ * Description:
+ *   Read-modify-write one per-port register under the port lock.  Used for
+ *   everything that can race with the interrupt demultiplexer or gpiolib.
+ *
+ ****************************************************************************/
+
+static void lm3s_gpiomodify(unsigned int port, unsigned int offset,
+                            uint32_t clrbits, uint32_t setbits)
+{
+  struct lm3s_gpio_port *gp = &g_gpioports[port];
+  uint32_t base = g_gpiobase[port];
+  unsigned long flags;
+  uint32_t regval;
+
+  spin_lock_irqsave(&gp->lock, flags);
+  regval  = lm3s_getreg32(base + offset);
+  regval &= ~clrbits;
+  regval |= setbits;
+  lm3s_putreg32(regval, base + offset);
+  spin_unlock_irqrestore(&gp->lock, flags);
+}
+
 /****************************************************************************
  * Name: lm3s_gpiofunc
  *
@@ -657,7 +773,7 @@ static inline void lm3s_interrupt(uint32_t base, uint32_t pin, uint32_t cfgset)
    */
 
   regval  = lm3s_getreg32(base + LM3S_GPIO_IS_OFFSET);
-  regval &= isclr;
+  regval &= ~isclr;
   regval |= isset;
   lm3s_putreg32(regval, base + LM3S_GPIO_IS_OFFSET);
 
@@ -671,7 +787,7 @@ static inline void lm3s_interrupt(uint32_t base, uint32_t pin, uint32_t cfgset)
    */
 
   regval  = lm3s_getreg32(base + LM3S_GPIO_IBE_OFFSET);
-  regval &= ibeclr;
+  regval &= ~ibeclr;
   regval |= ibeset;
   lm3s_putreg32(regval, base + LM3S_GPIO_IBE_OFFSET);
 
@@ -684,7 +800,7 @@ static inline void lm3s_interrupt(uint32_t base, uint32_t pin, uint32_t cfgset)
    */
 
   regval  = lm3s_getreg32(base + LM3S_GPIO_IEV_OFFSET);
-  regval &= iveclr;
+  regval &= ~iveclr;
   regval |= iveset;
   lm3s_putreg32(regval, base + LM3S_GPIO_IEV_OFFSET);
 }
@@ -709,7 +825,6 @@ int lm3s_configgpio(uint32_t cfgset)
   unsigned int pinno;
   uint32_t     pin;
   uint32_t     base;
-  uint32_t     regval;
 
   /* Decode the basics */
 
@@ -723,14 +838,9 @@ int lm3s_configgpio(uint32_t cfgset)
 
   base = lm3s_gpiobaseaddress(port);
 
-  /* Enable clocking for this GPIO peripheral. "To use the GPIO, the peripheral
-   * clock must be enabled by setting the appropriate GPIO Port bit field (GPIOn)
-   * in the RCGC2 register."
-   */
+  /* Enable clocking for this GPIO peripheral */
 
-  regval = lm3s_getreg32(LM3S_SYSCON_RCGC2);
-  regval |= SYSCON_RCGC2_GPIO(port);
-  lm3s_putreg32(regval, LM3S_SYSCON_RCGC2);
+  lm3s_gpioclock(port);
 
   /* First, set the port to digital input.  This is the safest state in which
    * to perform reconfiguration.
@@ -805,7 +915,7 @@ void lm3s_gpiowrite(uint32_t pinset, int value)
    * "... All bits are cleared by a reset."
    */
 
-  lm3s_putreg32((uint32_t)value << pinno, base + LM3S_GPIO_DATA_OFFSET + (1 << (pinno + 2)));
+  lm3s_putreg32((uint32_t)value << pinno, LM3S_GPIO_DATA_MASKED(base, 1 << pinno));
 }
 
 /****************************************************************************
@@ -844,57 +954,90 @@ int lm3s_gpioread(uint32_t pinset, int value)
    *  are cleared by a reset."
    */
 
-  return (lm3s_getreg32(base + LM3S_GPIO_DATA_OFFSET + (1 << (pinno + 2))) != 0);
+  return (lm3s_getreg32(LM3S_GPIO_DATA_MASKED(base, 1 << pinno)) != 0);
 }
 
+/****************************************************************************
+ * Name: lm3s_gpiodata / lm3s_gpioportdata
+ *
+ * Description:
+ *   Address of the masked DATA alias of a pin or a set of pins
+ *
+ ****************************************************************************/
+
+uint32_t lm3s_gpioportdata(uint32_t pinset, uint8_t pinmask)
+{
+  unsigned int port = (pinset & GPIO_PORT_MASK) >> GPIO_PORT_SHIFT;
+
+  return LM3S_GPIO_DATA_MASKED(lm3s_gpiobaseaddress(port), pinmask);
+}
+
+uint32_t lm3s_gpiodata(uint32_t pinset)
+{
+  return lm3s_gpioportdata(pinset, 1 << (pinset & GPIO_NUMBER_MASK));
+}
+
+/****************************************************************************
+ * Name: lm3s_gpiowriteport
+ *
+ * Description:
+ *   Drive a set of pins of one port in one store
+ *
+ ****************************************************************************/
+
+void lm3s_gpiowriteport(uint32_t pinset, uint8_t pinmask, uint8_t value)
+{
+  lm3s_gpioputdata(lm3s_gpioportdata(pinset, pinmask), value);
+}
+
+/****************************************************************************
+ * Name: lm3s_gpioirqenable / lm3s_gpioirqdisable
+ *
+ * Description:
+ *   Unmask or mask the interrupt of one pin.  The IM bit is written through
+ *   its bit-band alias, which is atomic without taking the port lock.
+ *
+ ****************************************************************************/
+
 void lm3s_gpioirqenable(uint32_t pinset)
 {
   unsigned int port;
   unsigned int pinno;
-  uint32_t     base;
-  uint32_t     regval;
 
   /* Decode the basics */
 
   port  = (pinset & GPIO_PORT_MASK) >> GPIO_PORT_SHIFT;
   pinno = (pinset & GPIO_NUMBER_MASK);
 
-  /* Get the base address associated with the GPIO port */
-
-  base = lm3s_gpiobaseaddress(port);
-
-  regval = lm3s_getreg32(base + LM3S_GPIO_IM_OFFSET);
-  regval |= (1 << pinno);
-  lm3s_putreg32(regval, base + LM3S_GPIO_IM_OFFSET);
+  lm3s_putreg32(1, lm3s_bitband(lm3s_gpiobaseaddress(port) + LM3S_GPIO_IM_OFFSET, pinno));
 }
 
 void lm3s_gpioirqdisable(uint32_t pinset)
 {
   unsigned int port;
   unsigned int pinno;
-  uint32_t     base;
-  uint32_t     regval;
 
   /* Decode the basics */
 
   port  = (pinset & GPIO_PORT_MASK) >> GPIO_PORT_SHIFT;
   pinno = (pinset & GPIO_NUMBER_MASK);
 
-  /* Get the base address associated with the GPIO port */
-
-  base = lm3s_gpiobaseaddress(port);
-
-  regval = lm3s_getreg32(base + LM3S_GPIO_IM_OFFSET);
-  regval &= ~(1 << pinno);
-  lm3s_putreg32(regval, base + LM3S_GPIO_IM_OFFSET);
+  lm3s_putreg32(0, lm3s_bitband(lm3s_gpiobaseaddress(port) + LM3S_GPIO_IM_OFFSET, pinno));
 }
 
+/****************************************************************************
+ * Name: lm3s_gpioclearint
+ *
+ * Description:
+ *   Clear the latched edge interrupt of one pin
+ *
+ ****************************************************************************/
+
 void lm3s_gpioclearint(uint32_t pinset)
 {
   unsigned int port;
   unsigned int pinno;
   uint32_t     base;
-  uint32_t     regval;
 
   /* Decode the basics */
 
@@ -905,8 +1048,301 @@ void lm3s_gpioclearint(uint32_t pinset)
 
   base = lm3s_gpiobaseaddress(port);
 
-  regval = lm3s_getreg32(base + LM3S_GPIO_ICR_OFFSET);
-  regval &= ~(1 << pinno);
-  lm3s_putreg32(regval, base + LM3S_GPIO_ICR_OFFSET);
+  /* ICR is write-one-to-clear; writing zeros has no effect */
+
+  lm3s_putreg32(1 << pinno, base + LM3S_GPIO_ICR_OFFSET);
+}
+
+/****************************************************************************
+ * gpiolib
+ ****************************************************************************/
+
+static inline struct lm3s_gpio_port *to_lm3s_port(struct gpio_chip *chip)
+{
+  return container_of(chip, struct lm3s_gpio_port, chip);
+}
+
+static int lm3s_gpio_request(struct gpio_chip *chip, unsigned offset)
+{
+  lm3s_gpioclock(to_lm3s_port(chip)->port);
+  return 0;
+}
+
+/* gpiolib users get a plain digital pin: AFSEL cleared and DEN set, the same
+ * as GPIO_FUNC_INPUT/OUTPUT in lm3s_configgpio().
+ */
+
+static void lm3s_gpio_digital(unsigned int port, unsigned offset)
+{
+  lm3s_gpiomodify(port, LM3S_GPIO_AFSEL_OFFSET, 1 << offset, 0);
+  lm3s_gpiomodify(port, LM3S_GPIO_DEN_OFFSET, 0, 1 << offset);
 }
 
+static int lm3s_gpio_direction_input(struct gpio_chip *chip, unsigned offset)
+{
+  unsigned int port = to_lm3s_port(chip)->port;
+
+  lm3s_gpio_digital(port, offset);
+  lm3s_gpiomodify(port, LM3S_GPIO_DIR_OFFSET, 1 << offset, 0);
+  return 0;
+}
+
+static int lm3s_gpio_get(struct gpio_chip *chip, unsigned offset)
+{
+  uint32_t base = g_gpiobase[to_lm3s_port(chip)->port];
+
+  /* Address bits [9:2] mask the DATA register, one load reads the pin */
+
+  return lm3s_getreg32(LM3S_GPIO_DATA_MASKED(base, 1 << offset)) != 0;
+}
+
+static void lm3s_gpio_set(struct gpio_chip *chip, unsigned offset, int value)
+{
+  uint32_t base = g_gpiobase[to_lm3s_port(chip)->port];
+
+  /* Masked store, no read-modify-write and so no locking required */
+
+  lm3s_putreg32(value ? 0xff : 0, LM3S_GPIO_DATA_MASKED(base, 1 << offset));
+}
+
+static int lm3s_gpio_direction_output(struct gpio_chip *chip, unsigned offset, int value)
+{
+  unsigned int port = to_lm3s_port(chip)->port;
+
+  lm3s_gpio_set(chip, offset, value);
+  lm3s_gpio_digital(port, offset);
+  lm3s_gpiomodify(port, LM3S_GPIO_DIR_OFFSET, 0, 1 << offset);
+  return 0;
+}
+
+static int lm3s_gpio_to_irq(struct gpio_chip *chip, unsigned offset)
+{
+  struct lm3s_gpio_port *gp = to_lm3s_port(chip);
+
+  if (gp->irq == NO_IRQ)
+    {
+      return -ENXIO;
+    }
+
+  return LM3S_GPIO_IRQ_BASE + chip->base + offset;
+}
+
+/****************************************************************************
+ * Per-pin interrupts
+ ****************************************************************************/
+
+static inline struct lm3s_gpio_port *irq_to_lm3s_port(unsigned int irq)
+{
+  return &g_gpioports[(irq - LM3S_GPIO_IRQ_BASE) >> 3];
+}
+
+static inline uint32_t irq_to_lm3s_pin(unsigned int irq)
+{
+  return 1 << ((irq - LM3S_GPIO_IRQ_BASE) & 7);
+}
+
+static void lm3s_gpio_irq_ack(unsigned int irq)
+{
+  uint32_t base = g_gpiobase[irq_to_lm3s_port(irq)->port];
+
+  /* ICR is write-one-to-clear, only the edge latch of this pin is touched */
+
+  lm3s_putreg32(irq_to_lm3s_pin(irq), base + LM3S_GPIO_ICR_OFFSET);
+}
+
+static inline uint32_t irq_to_lm3s_im(unsigned int irq)
+{
+  uint32_t base = g_gpiobase[irq_to_lm3s_port(irq)->port];
+
+  return lm3s_bitband(base + LM3S_GPIO_IM_OFFSET, (irq - LM3S_GPIO_IRQ_BASE) & 7);
+}
+
+static void lm3s_gpio_irq_mask(unsigned int irq)
+{
+  lm3s_putreg32(0, irq_to_lm3s_im(irq));
+}
+
+static void lm3s_gpio_irq_unmask(unsigned int irq)
+{
+  lm3s_putreg32(1, irq_to_lm3s_im(irq));
+}
+
+static int lm3s_gpio_irq_set_type(unsigned int irq, unsigned int type)
+{
+  unsigned int port = irq_to_lm3s_port(irq)->port;
+  uint32_t pin = irq_to_lm3s_pin(irq);
+  uint32_t is  = 0;
+  uint32_t ibe = 0;
+  uint32_t iev = 0;
+
+  switch (type & IRQ_TYPE_SENSE_MASK)
+    {
+      case IRQ_TYPE_EDGE_FALLING:
+        break;
+
+      case IRQ_TYPE_EDGE_RISING:
+        iev = pin;
+        break;
+
+      case IRQ_TYPE_EDGE_BOTH:
+        ibe = pin;
+        break;
+
+      case IRQ_TYPE_LEVEL_LOW:
+        is  = pin;
+        break;
+
+      case IRQ_TYPE_LEVEL_HIGH:
+        is  = pin;
+        iev = pin;
+        break;
+
+      default:
+        return -EINVAL;
+    }
+
+  /* A device may request the interrupt without having configured the pin */
+
+  lm3s_gpioclock(port);
+  lm3s_gpio_digital(port, (irq - LM3S_GPIO_IRQ_BASE) & 7);
+  lm3s_gpiomodify(port, LM3S_GPIO_DIR_OFFSET, pin, 0);
+
+  lm3s_gpiomodify(port, LM3S_GPIO_IS_OFFSET,  pin, is);
+  lm3s_gpiomodify(port, LM3S_GPIO_IBE_OFFSET, pin, ibe);
+  lm3s_gpiomodify(port, LM3S_GPIO_IEV_OFFSET, pin, iev);
+
+  if (is)
+    {
+      __set_irq_handler_unlocked(irq, handle_level_irq);
+    }
+  else
+    {
+      __set_irq_handler_unlocked(irq, handle_edge_irq);
+    }
+
+  return 0;
+}
+
+static struct irq_chip lm3s_gpio_irq_chip =
+{
+  .name     = "GPIO",
+  .ack      = lm3s_gpio_irq_ack,
+  .mask     = lm3s_gpio_irq_mask,
+  .unmask   = lm3s_gpio_irq_unmask,
+  .set_type = lm3s_gpio_irq_set_type,
+};
+
+/* Chained handler of a port interrupt.  Every pin pending in GPIOMIS is
+ * dispatched once; the NVIC line is level sensitive, so anything raised
+ * meanwhile brings us straight back once the line is unmasked.
+ */
+
+static void lm3s_gpio_irq_handler(unsigned int irq, struct irq_desc *desc)
+{
+  struct lm3s_gpio_port *gp = get_irq_data(irq);
+  unsigned int irqbase = LM3S_GPIO_IRQ_BASE + gp->chip.base;
+  unsigned long pending;
+  unsigned int pinno;
+
+  desc->chip->ack(irq);
+
+  pending = lm3s_getreg32(g_gpiobase[gp->port] + LM3S_GPIO_MIS_OFFSET);
+  while (pending)
+    {
+      pinno    = __ffs(pending);
+      pending &= ~(1UL << pinno);
+      generic_handle_irq(irqbase + pinno);
+    }
+
+  desc->chip->unmask(irq);
+}
+
+/****************************************************************************
+ * Name: lm3s_gpio_init
+ *
+ * Description:
+ *   Move the ports to the AHB aperture, register a gpio_chip per port and
+ *   install the per-pin interrupts.  Called from the board init_irq after
+ *   nvic_init().
+ *
+ ****************************************************************************/
+
+void __init lm3s_gpio_init(void)
+{
+  struct lm3s_gpio_port *gp;
+  unsigned int port;
+  unsigned int irq;
+  unsigned int pinno;
+
+#ifdef LM3S_GPIOAAHB_BASE
+  /* The AHB aperture is a single-cycle access instead of the legacy APB one.
+   * A port is reachable through only one aperture at a time, so switch all
+   * of them with interrupts off and before anybody else looks at g_gpiobase.
+   */
+
+  {
+    unsigned long flags;
+    uint32_t regval;
+
+    local_irq_save(flags);
+    regval = lm3s_getreg32(LM3S_SYSCON_GPIOHBCTL);
+    for (port = 0; port < LM3S_NPORTS; port++)
+      {
+        regval |= SYSCON_GPIOHBCTL_PORT(port);
+        g_gpiobase[port] = g_gpioahbbase[port];
+      }
+    lm3s_putreg32(regval, LM3S_SYSCON_GPIOHBCTL);
+    local_irq_restore(flags);
+  }
+#endif
+
+  for (port = 0; port < LM3S_NPORTS; port++)
+    {
+      gp = &g_gpioports[port];
+
+      gp->port                    = port;
+      gp->chip.label              = g_gpiolabel[port];
+      gp->chip.base               = port * 8;
+      gp->chip.ngpio              = 8;
+      gp->chip.request            = lm3s_gpio_request;
+      gp->chip.direction_input    = lm3s_gpio_direction_input;
+      gp->chip.direction_output   = lm3s_gpio_direction_output;
+      gp->chip.get                = lm3s_gpio_get;
+      gp->chip.set                = lm3s_gpio_set;
+      gp->chip.to_irq             = lm3s_gpio_to_irq;
+
+      if (gpiochip_add(&gp->chip) < 0)
+        {
+          printk(KERN_ERR "lm3s-gpio: port %u not registered\n", port);
+          continue;
+        }
+
+      if (g_gpioirq[port] == NO_IRQ)
+        {
+          continue;
+        }
+
+      /* Leave the pins as the boot loader configured them, but make sure no
+       * pin interrupt is enabled before it has a handler.  IM of a port
+       * which is not clocked is still at its reset value of zero.
+       */
+
+      if (lm3s_getreg32(LM3S_SYSCON_RCGC2) & SYSCON_RCGC2_GPIO(port))
+        {
+          lm3s_putreg32(0, g_gpiobase[port] + LM3S_GPIO_IM_OFFSET);
+          lm3s_putreg32(0xff, g_gpiobase[port] + LM3S_GPIO_ICR_OFFSET);
+        }
+
+      for (pinno = 0; pinno < 8; pinno++)
+        {
+          irq = LM3S_GPIO_IRQ_BASE + gp->chip.base + pinno;
+          set_irq_chip(irq, &lm3s_gpio_irq_chip);
+          set_irq_handler(irq, handle_level_irq);
+          set_irq_flags(irq, IRQF_VALID);
+        }
+
+      gp->irq = g_gpioirq[port];
+      set_irq_data(gp->irq, gp);
+      set_irq_chained_handler(gp->irq, lm3s_gpio_irq_handler);
+    }
+}
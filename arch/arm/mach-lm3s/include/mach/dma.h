@@ -26,6 +26,13 @@
 
 #define DMA_MAX_TRANSFER_SIZE     1024
 
+/*
+ * Every scatter-gather task is copied by the primary control structure
+ * into the alternate one as four 32-bit words, so the task list is
+ * limited by the 10-bit XFERSIZE field: 1024 words = 256 tasks.
+ */
+#define DMA_MAX_SG_TASKS          (DMA_MAX_TRANSFER_SIZE / 4)
+
 #define DMA_CHANNEL_ALT           0x80000000
 
 #define DMA_CHANNEL_UART0_RX      8
@@ -37,6 +44,8 @@
 
 #define DMA_CHANNEL_SSI0_RX       10
 #define DMA_CHANNEL_SSI0_TX       11
+#define DMA_CHANNEL_SSI1_RX       24
+#define DMA_CHANNEL_SSI1_TX       25
 
 #define DMA_HIGH_PRIORITY         0x00000001
 #define DMA_USE_BURST             0x00000002
@@ -49,15 +58,142 @@
 #define DMA_XFER_UNIT_DOUBLE_WORD 0x00000010
 #define DMA_XFER_ALT              0x00000020
 #define DMA_XFER_MODE_PINGPONG    0x00000040
+#define DMA_XFER_MEMORY_TO_MEMORY 0x00000080
+
+/*
+ * Channel control structure as it is laid out in the uDMA control table.
+ * The same layout is used for the entries of a scatter-gather task list.
+ */
+struct lm3s_dma_channel {
+  uint32_t DMASRCENDP;
+  uint32_t DMADSTENDP;
+  struct {
+		/*
+		 * DMA Transfer Mode
+		 *
+		 * 0x0 Stop
+		 * 0x1 Basic
+		 * 0x2 Auto-Request
+		 * 0x3 Ping-Pong
+		 * 0x4 Memory Scatter-Gather
+		 * 0x5 Alternate Memory Scatter-Gather
+		 * 0x6 Peripheral Scatter-Gather
+		 * 0x7 Alternate Peripheral Scatter-Gather
+		 */
+		uint32_t XFERMODE:3;
+
+		/*
+		 * Next Useburst
+		 */
+		uint32_t NXTUSEBURST:1;
+
+		/*
+		 * Transfer Size (minus 1)
+		 */
+		uint32_t XFERSIZE:10;
+
+		/*
+		 * Arbitration Size
+		 *
+		 * 0x0 1 Transfer
+		 * Arbitrates after each μDMA transfer
+		 * 0x1 2 Transfers
+		 * 0x2 4 Transfers
+		 * 0x3 8 Transfers
+		 * 0x4 16 Transfers
+		 * 0x5 32 Transfers
+		 * 0x6 64 Transfers
+		 * 0x7 128 Transfers
+		 * 0x8 256 Transfers
+		 * 0x9 512 Transfers
+		 * 0xA-0xF 1024 Transfers
+		 * In this configuration, no arbitration occurs during the μDMA
+		 * transfer because the maximum transfer size is 1024.
+		 */
+		uint32_t ARBSIZE:4;
+
+		/*
+		 * reserved
+		 */
+		uint32_t reserved:6;
+
+		/*
+		 * Source Data Size
+		 *
+		 * 0x0 Byte
+		 * 8-bit data size.
+		 * 0x1 Half-word
+		 * 16-bit data size.
+		 * 0x2 Word
+		 * 32-bit data size.
+		 * 0x3 Reserved
+		 */
+		uint32_t SRCSIZE:2;
+
+		/*
+		 * Source Address Increment
+		 *
+		 * 0x0 Byte
+		 * Increment by 8-bit locations
+		 * 0x1 Half-word
+		 * Increment by 16-bit locations
+		 * 0x2 Word
+		 * Increment by 32-bit locations
+		 * 0x3 No increment
+		 * Address remains set to the value of the Source Address End
+		 * Pointer (DMASRCENDP) for the chann
+		 */
+		uint32_t SRCINC:2;
+
+		/*
+		 * Destination Data Size
+		 *
+		 * See description of SRCSIZE
+		 */
+		uint32_t DSTSIZE:2;
+
+		/*
+		 * Destination Address Increment
+		 *
+		 * See description of SRCINC
+		 */
+		uint32_t DSTINC:2;
+	} DMACHCTL;
+  uint32_t unused;
+};
+
+/*
+ * uDMA reaches the on-chip SRAM and the SDRAM mapped through EPI0 only,
+ * anything else (internal flash, peripherals) must go through a bounce buffer.
+ */
+static inline int dma_buffer_reachable(const void *buf, size_t size)
+{
+	uint32_t start = (uint32_t)buf;
+	uint32_t end = start + size;
+
+	if( start >= LM3S_SRAM_BASE && end <= LM3S_SRAM_BASE + LM3S_SRAM_SIZE )
+		return 1;
+	if( start >= CONFIG_DRAM_BASE && end <= CONFIG_DRAM_BASE + CONFIG_DRAM_SIZE )
+		return 1;
+	return 0;
+}
 
 void dma_setup_channel(unsigned int channel, unsigned int config);
 void __sram dma_setup_xfer(unsigned int channel, void *dst, void *src, size_t size, unsigned int flags);
 void __sram dma_start_xfer(unsigned int channel);
 void __sram dma_stop_xfer(unsigned int channel);
+void __sram dma_pause_xfer(unsigned int channel);
+void __sram dma_resume_xfer(unsigned int channel);
+int __sram dma_xfer_running(unsigned int channel);
 void dma_wait_xfer_complete(unsigned int channel);
 int __sram dma_ack_interrupt(unsigned int channel);
 int __sram get_units_left(unsigned int channel, int alt);
 
+void __sram dma_setup_sg_task(struct lm3s_dma_channel *task, void *dst, void *src, size_t size, unsigned int flags);
+int __sram dma_build_sg_list(struct lm3s_dma_channel *tasks, int max_tasks, void *dst, void *src, size_t size, unsigned int flags);
+void __sram dma_setup_sg_xfer(unsigned int channel, struct lm3s_dma_channel *tasks, int ntasks, unsigned int flags);
+void __sram dma_request_xfer(unsigned int channel);
+
 extern void * dma_memcpy(void *, const void *, __kernel_size_t);
 
-#endif /* __ARCH_ARM_MACH_LM3S_DMA_H */
\ No newline at end of file
+#endif /* __ARCH_ARM_MACH_LM3S_DMA_H */
@@ -0,0 +1,56 @@
+/*
+ * arch/arm/mach-lm3s/include/mach/gpio.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __ASM_ARCH_GPIO_H
+#define __ASM_ARCH_GPIO_H
+
+#include <linux/errno.h>
+#include <mach/hardware.h>
+#include <mach/irqs.h>
+#include <asm-generic/gpio.h>
+
+/*
+ * Every port is registered as an 8 line gpio_chip, so the gpiolib number
+ * of a pin is port * 8 + pin and its interrupt follows from that.  The
+ * macros take the bit-encoded pin description used by lm3s_configgpio()
+ * and are constant expressions, so they can be used in board tables.
+ */
+
+#define LM3S_GPIO_NR(pinset) \
+	((((pinset) & GPIO_PORT_MASK) >> GPIO_PORT_SHIFT) * 8 + ((pinset) & GPIO_NUMBER_MASK))
+
+#define LM3S_GPIO_IRQ(pinset)	(LM3S_GPIO_IRQ_BASE + LM3S_GPIO_NR(pinset))
+
+/* Ports A-H, as far as the chip has them, come with per-pin interrupts */
+#define LM3S_GPIO_IRQ_PORTS	(LM3S_NPORTS < 8 ? LM3S_NPORTS : 8)
+#define LM3S_GPIO_IRQ_END	(LM3S_GPIO_IRQ_BASE + LM3S_GPIO_IRQ_PORTS * 8)
+
+#define gpio_get_value		__gpio_get_value
+#define gpio_set_value		__gpio_set_value
+#define gpio_cansleep		__gpio_cansleep
+
+/* The chip's to_irq() knows which ports have interrupts */
+#define gpio_to_irq		__gpio_to_irq
+
+static inline int irq_to_gpio(unsigned irq)
+{
+	if (irq < LM3S_GPIO_IRQ_BASE || irq >= LM3S_GPIO_IRQ_END)
+		return -EINVAL;
+
+	return irq - LM3S_GPIO_IRQ_BASE;
+}
+
+extern void __init lm3s_gpio_init(void);
+
+#endif /* __ASM_ARCH_GPIO_H */
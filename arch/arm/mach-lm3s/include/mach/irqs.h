@@ -26,7 +26,15 @@
  * Interrupt sources
  */
 
-#define NR_IRQS			37
+/* NVIC lines 0..36, followed by one virtual interrupt per GPIO pin which
+ * is demultiplexed from the port interrupt by mach-lm3s/gpio.c.
+ */
+
+#define LM3S_NVIC_IRQS		37
+#define LM3S_GPIO_IRQ_BASE	LM3S_NVIC_IRQS
+#define LM3S_GPIO_NR_IRQS	(9 * 8)
+
+#define NR_IRQS			(LM3S_GPIO_IRQ_BASE + LM3S_GPIO_NR_IRQS)
 
 #define LM3S1D21_UART0_IRQ    5
 #define LM3S1D21_UART1_IRQ    6
@@ -40,6 +48,11 @@
 
 #define LM3S1D21_GPIOA_IRQ    0
 #define LM3S1D21_GPIOB_IRQ    1
+#define LM3S1D21_GPIOC_IRQ    2
+#define LM3S1D21_GPIOD_IRQ    3
+#define LM3S1D21_GPIOE_IRQ    4
+#define LM3S1D21_GPIOF_IRQ    30
 #define LM3S1D21_GPIOG_IRQ    31
+#define LM3S1D21_GPIOH_IRQ    32
 
 #endif
@@ -157,6 +157,12 @@
 # define lm3s_getreg32(a)          (*(volatile uint32_t *)(a))
 # define lm3s_putreg32(v,a)        (*(volatile uint32_t *)(a) = (v))
 
+/* Bit-band alias of bit b of the peripheral register at a.  A store to the
+ * alias is turned into an atomic single-bit read-modify-write by the core.
+ */
+
+# define lm3s_bitband(a,b)         (LM3S_APERIPH_BASE + (((a) - LM3S_PERIPH_BASE) << 5) + ((b) << 2))
+
 /* Some compiler options will convert short loads and stores into byte loads
  * and stores.  We don't want this to happen for IO reads and writes!
  */
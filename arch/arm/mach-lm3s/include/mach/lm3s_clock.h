@@ -21,7 +21,13 @@
 
 #include <linux/types.h>
 #include <linux/init.h>
+#include <linux/ktime.h>
 
 void __init lm3s1d21_timer_init(void);
 
+int lm3s_timer_deep_sleep_enter(void);
+void lm3s_timer_deep_sleep_exit(void);
+int lm3s_timer_expired(void);
+ktime_t lm3s_timer_next_event(void);
+
 #endif
\ No newline at end of file
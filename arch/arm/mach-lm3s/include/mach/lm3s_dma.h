@@ -104,6 +104,10 @@
 #  define DMA_CHCTL_XFERMODE_BASIC      (0x1  << DMA_CHCTL_XFERMODE_SHIFT)
 #  define DMA_CHCTL_XFERMODE_AUTO       (0x2  << DMA_CHCTL_XFERMODE_SHIFT)
 #  define DMA_CHCTL_XFERMODE_PING_PONG  (0x3  << DMA_CHCTL_XFERMODE_SHIFT)
+#  define DMA_CHCTL_XFERMODE_MEM_SG     (0x4  << DMA_CHCTL_XFERMODE_SHIFT)
+#  define DMA_CHCTL_XFERMODE_ALT_MEM_SG (0x5  << DMA_CHCTL_XFERMODE_SHIFT)
+#  define DMA_CHCTL_XFERMODE_PER_SG     (0x6  << DMA_CHCTL_XFERMODE_SHIFT)
+#  define DMA_CHCTL_XFERMODE_ALT_PER_SG (0x7  << DMA_CHCTL_XFERMODE_SHIFT)
 #define DMA_CHCTL_XFERSIZE_SHIFT        4    /* Bits 13-4: Transfer Size (minus 1) */
 #define DMA_CHCTL_XFERSIZE_MASK         (0x3FF << DMA_CHCTL_XFERSIZE_SHIFT)
 #define DMA_CHCTL_SRCSIZE_SHIFT         24   /* Bits 25-24: Source Data Size */
@@ -80,6 +80,14 @@
 #define LM3S_GPIO_PCELLID2_OFFSET     0xff8 /* GPIO PrimeCell Identification 2 */
 #define LM3S_GPIO_PCELLID3_OFFSET     0xffc /* GPIO PrimeCell Identification 3*/
 
+/* Address bits [9:2] of a DATA access mask the pins it reads or writes, so
+ * a store to LM3S_GPIO_DATA_MASKED(base, mask) changes exactly the pins in
+ * mask and leaves the rest of the port alone.
+ */
+
+#define LM3S_GPIO_DATA_MASKED(base, mask) \
+  ((base) + LM3S_GPIO_DATA_OFFSET + ((uint32_t)(mask) << 2))
+
 /* GPIO Register Addresses **********************************************************/
 
 #define LM3S_GPIOA_DATA               (LM3S_GPIOA_BASE + LM3S_GPIO_DATA_OFFSET)
@@ -425,7 +433,39 @@ void lm3s_gpiowrite(uint32_t pinset, int value);
 
 int lm3s_gpioread(uint32_t pinset, int value);
 
+/****************************************************************************
+ * Name: lm3s_gpiodata / lm3s_gpioportdata
+ *
+ * Description:
+ *   Return the address of the masked DATA alias of one pin, or of a set of
+ *   pins of the port selected by the GPIO_PORTx bits of pinset.  Drivers
+ *   that toggle a pin on a hot path look the alias up once and then set or
+ *   clear the pins with a single lm3s_gpioputdata() store; no decoding and
+ *   no read-modify-write, so it needs no locking against other users of
+ *   the port.  Only valid after lm3s_gpio_init() has selected the aperture.
+ *
+ ****************************************************************************/
+
+uint32_t lm3s_gpiodata(uint32_t pinset);
+uint32_t lm3s_gpioportdata(uint32_t pinset, uint8_t pinmask);
+
+#define lm3s_gpioputdata(data, value)  lm3s_putreg32((uint32_t)(value), (data))
+#define lm3s_gpiogetdata(data)         lm3s_getreg32(data)
+
+/****************************************************************************
+ * Name: lm3s_gpiowriteport
+ *
+ * Description:
+ *   Drive the pins in pinmask of the port selected by pinset to the
+ *   corresponding bits of value, all in one store.
+ *
+ ****************************************************************************/
+
+void lm3s_gpiowriteport(uint32_t pinset, uint8_t pinmask, uint8_t value);
+
 void lm3s_gpioirqenable(uint32_t pinset);
+void lm3s_gpioirqdisable(uint32_t pinset);
+void lm3s_gpioclearint(uint32_t pinset);
 
 #endif
 
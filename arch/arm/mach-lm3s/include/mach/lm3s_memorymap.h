@@ -66,6 +66,7 @@
 #  define LM3S_FLASH_BASE     0x00000000 /* -0x0003ffff: On-chip FLASH */
                                          /* -0x1fffffff: Reserved */
 #  define LM3S_SRAM_BASE      0x20000000 /* -0x2000ffff: Bit-banded on-chip SRAM */
+#  define LM3S_SRAM_SIZE      0x00010000 /*            : 64KiB of on-chip SRAM */
                                          /* -0x21ffffff: Reserved */
 #  define LM3S_ASRAM_BASE     0x22000000 /* -0x221fffff: Bit-band alias of 20000000- */
                                          /* -0x3fffffff: Reserved */
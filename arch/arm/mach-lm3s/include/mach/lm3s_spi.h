@@ -6,6 +6,9 @@
 struct spi_lm3s_master {
   uint32_t *chipselect;
   int       num_chipselect;
+  uint32_t  rcgc1_mask;     /* Mask to enable/disable clock gate */
+  uint32_t *pins;           /* SSIClk/Rx/Tx, NULL if left to the boot loader */
+  int       num_pins;
 #ifdef CONFIG_LM3S_DMA
 	uint32_t  dma_rx_channel;
 	uint32_t  dma_tx_channel;
@@ -64,6 +64,7 @@
 #define LM3S_SYSCON_RESC_OFFSET       0x05c /* Reset Cause */
 #define LM3S_SYSCON_RCC_OFFSET        0x060 /* Run-Mode Clock Configuration */
 #define LM3S_SYSCON_PLLCFG_OFFSET     0x064 /* XTAL to PLL Translation */
+#define LM3S_SYSCON_GPIOHBCTL_OFFSET  0x06c /* GPIO High-Performance Bus Control */
 #define LM3S_SYSCON_RCC2_OFFSET       0x070 /* Run-Mode Clock Configuration 2 */
 #define LM3S_SYSCON_RCGC0_OFFSET      0x100 /* Run Mode Clock Gating Control Register 0 */
 #define LM3S_SYSCON_RCGC1_OFFSET      0x104 /* Run Mode Clock Gating Control Register 1 */
@@ -96,6 +97,7 @@
 #define LM3S_SYSCON_RESC              (LM3S_SYSCON_BASE + LM3S_SYSCON_RESC_OFFSET)
 #define LM3S_SYSCON_RCC               (LM3S_SYSCON_BASE + LM3S_SYSCON_RCC_OFFSET)
 #define LM3S_SYSCON_PLLCFG            (LM3S_SYSCON_BASE + LM3S_SYSCON_PLLCFG_OFFSET)
+#define LM3S_SYSCON_GPIOHBCTL         (LM3S_SYSCON_BASE + LM3S_SYSCON_GPIOHBCTL_OFFSET)
 #define LM3S_SYSCON_RCC2              (LM3S_SYSCON_BASE + LM3S_SYSCON_RCC2_OFFSET)
 #define LM3S_SYSCON_RCGC0             (LM3S_SYSCON_BASE + LM3S_SYSCON_RCGC0_OFFSET)
 #define LM3S_SYSCON_RCGC1             (LM3S_SYSCON_BASE + LM3S_SYSCON_RCGC1_OFFSET)
@@ -335,6 +337,10 @@
 #define SYSCON_PLLCFG_R_SHIFT         0         /* Bits 4-0: PLL R Value  */
 #define SYSCON_PLLCFG_R_MASK          (0x1f << SYSCON_PLLCFG_R_SHIFT)
 
+/* GPIO High-Performance Bus Control (GPIOHBCTL), offset 0x06c */
+
+#define SYSCON_GPIOHBCTL_PORT(n)      (1 << (n)) /* Bit n: Port n accessed through the AHB aperture */
+
 /* Run-Mode Clock Configuration 2 (RCC2), offset 0x070 */
 
 #define SYSCON_RCC2_OSCSRC2_SHIFT     4         /* Bits 6-4: Oscillator Source */
@@ -39,8 +39,10 @@
 #define TIMER_GPTMCTL_OFFSET      0x00C
 #define TIMER_GPTMIMR_OFFSET      0x018
 #define TIMER_GPTMRIS_OFFSET      0x01C
+#define TIMER_GPTMMIS_OFFSET      0x020
 #define TIMER_GPTMICR_OFFSET      0x024
 #define TIMER_GPTMTAILR_OFFSET    0x028
+#define TIMER_GPTMTAMATCHR_OFFSET 0x030
 #define TIMER_GPTMTAR_OFFSET      0x048
 
 
@@ -53,8 +55,10 @@
 #define LM3S_TIMER_GPTMCTL(n)     (LM3S_TIMER_BASE(n) + TIMER_GPTMCTL_OFFSET)
 #define LM3S_TIMER_GPTMIMR(n)     (LM3S_TIMER_BASE(n) + TIMER_GPTMIMR_OFFSET)
 #define LM3S_TIMER_GPTMRIS(n)     (LM3S_TIMER_BASE(n) + TIMER_GPTMRIS_OFFSET)
+#define LM3S_TIMER_GPTMMIS(n)     (LM3S_TIMER_BASE(n) + TIMER_GPTMMIS_OFFSET)
 #define LM3S_TIMER_GPTMICR(n)     (LM3S_TIMER_BASE(n) + TIMER_GPTMICR_OFFSET)
 #define LM3S_TIMER_GPTMTAILR(n)   (LM3S_TIMER_BASE(n) + TIMER_GPTMTAILR_OFFSET)
+#define LM3S_TIMER_GPTMTAMATCHR(n) (LM3S_TIMER_BASE(n) + TIMER_GPTMTAMATCHR_OFFSET)
 #define LM3S_TIMER_GPTMTAR(n)     (LM3S_TIMER_BASE(n) + TIMER_GPTMTAR_OFFSET)
 
 /* Timer register bit defitiions ****************************************************/
@@ -100,13 +104,26 @@
 
 #define TIMER_GPTMIMR_TATOIM_SHIFT       0    /* Bits 0:   GPTM Timer A Time-Out Interrupt Mask */
 #define TIMER_GPTMIMR_TATOIM_MASK        (0x01 << TIMER_GPTMIMR_TATOIM_SHIFT)
+#define TIMER_GPTMIMR_TAMIM_SHIFT        4    /* Bits 4:   GPTM Timer A Match Interrupt Mask */
+#define TIMER_GPTMIMR_TAMIM_MASK         (0x01 << TIMER_GPTMIMR_TAMIM_SHIFT)
 
 /* GPTM Raw Interrupt Status (GPTMRIS), offset 0x01C */
 
 #define TIMER_GPTMRIS_TATORIS_SHIFT     0     /* Bits 0:   GPTM Timer A Time-Out Raw Interrupt */
 #define TIMER_GPTMRIS_TATORIS_MASK      (0x01 << TIMER_GPTMRIS_TATORIS_SHIFT)
+#define TIMER_GPTMRIS_TAMRIS_SHIFT      4     /* Bits 4:   GPTM Timer A Match Raw Interrupt */
+#define TIMER_GPTMRIS_TAMRIS_MASK       (0x01 << TIMER_GPTMRIS_TAMRIS_SHIFT)
+
+/* GPTM Masked Interrupt Status (GPTMMIS), offset 0x020 */
+
+#define TIMER_GPTMMIS_TATOMIS_SHIFT     0     /* Bits 0:   GPTM Timer A Time-Out Masked Interrupt */
+#define TIMER_GPTMMIS_TATOMIS_MASK      (0x01 << TIMER_GPTMMIS_TATOMIS_SHIFT)
+#define TIMER_GPTMMIS_TAMMIS_SHIFT      4     /* Bits 4:   GPTM Timer A Match Masked Interrupt */
+#define TIMER_GPTMMIS_TAMMIS_MASK       (0x01 << TIMER_GPTMMIS_TAMMIS_SHIFT)
 
 /* GPTM Interrupt Clear (GPTMICR), offset 0x024 */
 
 #define TIMER_GPTMICR_TATOCINT_SHIFT    0     /* Bits 0:   GPTM Timer A Time-Out Raw Interrupt Clear*/
-#define TIMER_GPTMICR_TATOCINT_MASK     (0x01 << TIMER_GPTMICR_TATOCINT_SHIFT)
\ No newline at end of file
+#define TIMER_GPTMICR_TATOCINT_MASK     (0x01 << TIMER_GPTMICR_TATOCINT_SHIFT)
+#define TIMER_GPTMICR_TAMCINT_SHIFT     4     /* Bits 4:   GPTM Timer A Match Interrupt Clear */
+#define TIMER_GPTMICR_TAMCINT_MASK      (0x01 << TIMER_GPTMICR_TAMCINT_SHIFT)
\ No newline at end of file
@@ -12,7 +12,10 @@ struct mpu_state
 	uint32_t mpu_attr_regs[MPU_REGIONS_COUNT];
 };
 
+#define __HAVE_ARCH_PROTECT_RANGE
+
 void update_protections(struct mm_struct *mm);
-void protect_page(struct mm_struct *mm, unsigned long addr, unsigned long flags);
+void protect_range(struct mm_struct *mm, unsigned long start, unsigned long end,
+                   unsigned long flags);
 
 #endif // _MPU_H
\ No newline at end of file
@@ -18,3 +18,6 @@
  */
 
 #define CLOCK_TICK_RATE		50000000
+
+/* Deep-Sleep clock, the internal 30 kHz oscillator */
+#define DEEP_SLEEP_CLOCK_RATE	30000
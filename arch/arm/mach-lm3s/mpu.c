@@ -70,56 +70,100 @@ static inline struct vm_area_struct * mmap_find_vma_intersection(struct mm_struc
 	return vma;
 }
 
-void protect_page(struct mm_struct *mm, unsigned long addr, unsigned long flags)
+/*
+ * SRD fields currently loaded in the MPU, so that only the regions which
+ * actually differ from the incoming mm are rewritten.
+ */
+static uint32_t mpu_hw_srd[MPU_REGIONS_COUNT];
+
+/* Is any part of subregion 'subregion' still covered by a VMA of mm? */
+static int subregion_in_use(struct mm_struct *mm, unsigned long subregion)
+{
+	unsigned long subregion_start = (subregion << MPU_SUBREGION_SIZE_POW2) + CONFIG_DRAM_BASE;
+	unsigned long subregion_end = subregion_start + MPU_SUBREGION_SIZE;
+
+	return mmap_find_vma_intersection(mm, subregion_start, subregion_end) != NULL;
+}
+
+/*
+ * Enable (flags != 0) or disable the subregions covering start..end-1.
+ *
+ * Subregions are switched a whole region mask at a time. On nommu VMAs may
+ * be identical or overlap (shared mappings), so when disabling, every
+ * subregion of the range is checked and those another VMA still covers are
+ * left enabled. The VMA being removed must already be out of the mm's tree.
+ */
+void protect_range(struct mm_struct *mm, unsigned long start, unsigned long end,
+                   unsigned long flags)
 {
-	unsigned long offset;
-	unsigned long page;
-	unsigned long bit;
-	unsigned long subregion;
-	unsigned long page_subregion;
+	unsigned long first, last;
+	unsigned long region;
 	uint32_t *mpu_attr_regs;
 
-	if (addr >= (CONFIG_DRAM_BASE + CONFIG_DRAM_SIZE) || addr < CONFIG_DRAM_BASE)
+	if (start < CONFIG_DRAM_BASE)
+		start = CONFIG_DRAM_BASE;
+	if (end > CONFIG_DRAM_BASE + CONFIG_DRAM_SIZE)
+		end = CONFIG_DRAM_BASE + CONFIG_DRAM_SIZE;
+	if (start >= end)
 		return;
 
-	offset = addr - CONFIG_DRAM_BASE;
-	page = offset >> MPU_REGION_SIZE_POW2;
-	subregion = offset >> MPU_SUBREGION_SIZE_POW2;
-	page_subregion = (offset & (MPU_REGION_SIZE - 1)) >> MPU_SUBREGION_SIZE_POW2;
-	bit = 1 << (page_subregion + MPU_ATTR_SRD_SHIFT);
+	first = (start - CONFIG_DRAM_BASE) >> MPU_SUBREGION_SIZE_POW2;
+	last = (end - 1 - CONFIG_DRAM_BASE) >> MPU_SUBREGION_SIZE_POW2;
 
 	mpu_attr_regs = mm->context.mpu_state.mpu_attr_regs;
 
-	if (flags != 0)
+	for (region = first / MPU_SUBREGIONS_COUNT; region <= last / MPU_SUBREGIONS_COUNT; region++)
 	{
-		mpu_attr_regs[page] |= bit; // Enable Sub Region
-	}
-	else
-	{
-		unsigned long subregion_start = (subregion << MPU_SUBREGION_SIZE_POW2) + CONFIG_DRAM_BASE;
-		unsigned long subregion_end = subregion_start + MPU_SUBREGION_SIZE;
-		if (!mmap_find_vma_intersection(mm, subregion_start, subregion_end))
+		unsigned long lo = 0;
+		unsigned long hi = MPU_SUBREGIONS_COUNT - 1;
+		unsigned long i;
+		uint32_t mask;
+
+		if (region == first / MPU_SUBREGIONS_COUNT)
+			lo = first % MPU_SUBREGIONS_COUNT;
+		if (region == last / MPU_SUBREGIONS_COUNT)
+			hi = last % MPU_SUBREGIONS_COUNT;
+
+		if (flags != 0)
 		{
-			mpu_attr_regs[page] &= ~bit; // Disable Sub Region
+			mask = ((1 << (hi - lo + 1)) - 1) << (lo + MPU_ATTR_SRD_SHIFT);
+			mpu_attr_regs[region] |= mask; // Enable Sub Regions
+			continue;
 		}
+
+		mask = 0;
+		for (i = lo; i <= hi; i++)
+			if (!subregion_in_use(mm, region * MPU_SUBREGIONS_COUNT + i))
+				mask |= 1 << (i + MPU_ATTR_SRD_SHIFT);
+		mpu_attr_regs[region] &= ~mask; // Disable Sub Regions
 	}
 }
 
 void update_protections(struct mm_struct *mm)
 {
 	int i;
+	int changed = 0;
 	uint32_t *mpu_attr_regs = mm->context.mpu_state.mpu_attr_regs;
 	asm("isb":::);
 	for (i = 0; i < MPU_REGIONS_COUNT; i++)
 	{
 		uint32_t regval;
+		uint32_t srd = (~(mpu_attr_regs[i])) & MPU_ATTR_SRD_MASK;
+
+		if (srd == mpu_hw_srd[i])
+			continue;
+
 		lm3s_putreg32(i, LM3S_MPU_NUMBER);
 		regval = lm3s_getreg32(LM3S_MPU_ATTR);
 		regval &= ~MPU_ATTR_SRD_MASK;
-		regval |= (~(mpu_attr_regs[i])) & MPU_ATTR_SRD_MASK;
+		regval |= srd;
 		lm3s_putreg32(regval, LM3S_MPU_ATTR);
+
+		mpu_hw_srd[i] = srd;
+		changed = 1;
 	}
-	asm("dsb":::);
+	if (changed)
+		asm("dsb":::);
 }
 
 /* Initialize Memory Protection Unit */
@@ -143,6 +187,7 @@ static int __init lm3s_init_mpu(void)
 									LM3S_MPU_ATTR);
 
 		asm("dsb":::);
+		mpu_hw_srd[i] = MPU_ATTR_SRD_MASK;
 		base += MPU_REGION_SIZE;
 	}
 
@@ -21,8 +21,6 @@ static struct work_struct pwr_switch_irq_work;
 static int pwr_switch_irq;
 static int power_off_delay;
 
-extern void lm3s_gpioclearint(uint32_t pinset);
-
 static void set_power_hold_pin(int value)
 {
 #ifdef DEBUG
@@ -48,7 +46,6 @@ static irqreturn_t power_switch_irq(int irq, void *pw)
 	printk("Handle Power Switch interrupt\n");
 #endif
 
-	lm3s_gpioclearint(pwr_switch_pin);
 	disable_irq_nosync(irq);
 	schedule_work(&pwr_switch_irq_work);
 
@@ -110,6 +107,4 @@ void __init lm3s_power_switch_init(int switch_pin, int switch_irq, int switch_of
 	if (ret < 0) {
 		printk("failed to get irq %i\n", pwr_switch_irq);
 	}
-
-	lm3s_gpioirqenable(pwr_switch_pin);
 }
\ No newline at end of file
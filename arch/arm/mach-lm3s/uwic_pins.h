@@ -11,6 +11,11 @@
 #define GPIO_SSI0_CS_EE  (GPIO_FUNC_OUTPUT    | GPIO_PORTA | 6 | GPIO_VALUE_ONE)   /* PA6: SSI0 EEPROM chip select */
 #define GPIO_SSI0_CS_ETH (GPIO_FUNC_OUTPUT    | GPIO_PORTA | 3 | GPIO_VALUE_ONE)   /* PA3: SSI0 ETH chip select */
 
+#define GPIO_SSI1_CLK    (GPIO_FUNC_PFIO      | GPIO_PORTF | GPIO_DF(9) | 2)       /* PF2: SSI1 clock (SSI1Clk) */
+#define GPIO_SSI1_RX     (GPIO_FUNC_PFINPUT   | GPIO_PORTF | GPIO_DF(9) | 4)       /* PF4: SSI1 receive (SSI1Rx) */
+#define GPIO_SSI1_TX     (GPIO_FUNC_PFOUTPUT  | GPIO_PORTF | GPIO_DF(9) | 5)       /* PF5: SSI1 transmit (SSI1Tx) */
+#define GPIO_SSI1_CS_ETH (GPIO_FUNC_OUTPUT    | GPIO_PORTF | 3 | GPIO_VALUE_ONE)   /* PF3: SSI1 ETH chip select */
+
 #define GPIO_ETH_INTRN   (GPIO_FUNC_INTERRUPT | GPIO_PORTG | 5 | GPIO_INT_LOWLEVEL)/* PG5: ETH chip interrupt */
 
 #define GPIO_POWER_HOLD  (GPIO_FUNC_OUTPUT    | GPIO_PORTF | 6)                    /* PF6: Power Hold (output) */
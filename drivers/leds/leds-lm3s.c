@@ -30,6 +30,7 @@
 struct lm3s_gpio_led {
 	struct led_classdev		 cdev;
 	struct lm3s_led_platdata	*pdata;
+	uint32_t			 data;	/* masked DATA alias of the pin */
 };
 
 static inline struct lm3s_gpio_led *pdev_to_gpio(struct platform_device *dev)
@@ -51,7 +52,7 @@ static void lm3s_led_set(struct led_classdev *led_cdev,
 	/* there will be a short delay between setting the output and
 	 * going from output to input when using tristate. */
 
-	lm3s_gpiowrite(pd->gpio, (value ? 1 : 0) ^ (pd->flags & LM3S_LEDF_ACTLOW));
+	lm3s_gpioputdata(led->data, ((value ? 1 : 0) ^ (pd->flags & LM3S_LEDF_ACTLOW)) ? 0xff : 0);
 }
 
 static int lm3s_led_remove(struct platform_device *dev)
@@ -88,6 +89,7 @@ static int lm3s_led_probe(struct platform_device *dev)
 	/* no point in having a pull-up if we are always driving */
 
 	lm3s_configgpio(pdata->gpio);
+	led->data = lm3s_gpiodata(pdata->gpio);
 	lm3s_gpiowrite(pdata->gpio, pdata->flags & LM3S_LEDF_ACTLOW ? 1 : 0);
 
 	/* register our new led device */
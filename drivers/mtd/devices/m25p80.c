@@ -22,6 +22,7 @@
 #include <linux/mutex.h>
 #include <linux/math64.h>
 #include <linux/sched.h>
+#include <linux/hrtimer.h>
 #include <linux/mod_devicetable.h>
 
 #include <linux/mtd/mtd.h>
@@ -61,6 +62,19 @@
 #define	MAX_READY_WAIT_JIFFIES	(40 * HZ)	/* M25P16 specs 40s max chip erase */
 #define	MAX_CMD_SIZE		4
 
+/* Reads are split so other devices on the bus get a turn in between. */
+#define	READ_CHUNK_SIZE		4096
+
+/* Waits shorter than this poll right away instead of sleeping. */
+#define	MIN_SLEEP_US		50
+
+/* Commands that leave the chip busy, each with its own completion time. */
+#define	M25P_OP_PROGRAM		0	/* page (or SST word) program */
+#define	M25P_OP_ERASE		1	/* sector erase */
+#define	M25P_OP_WRSR		2	/* status register write */
+#define	M25P_OP_CHIP_ERASE	3
+#define	M25P_NR_OPS		4
+
 #ifdef CONFIG_M25PXX_USE_FAST_READ
 #define OPCODE_READ 	OPCODE_FAST_READ
 #define FAST_READ_DUMMY_BYTE 1
@@ -80,6 +94,19 @@ struct m25p {
 	u16			addr_width;
 	u8			erase_opcode;
 	u8			*command;
+
+	/* Prebuilt messages: status read, write enable + page program */
+	u8			*sr_buf;
+	struct spi_message	sr_msg;
+	struct spi_transfer	sr_xfer;
+	struct spi_message	pp_msg;
+	struct spi_transfer	pp_xfer[3];
+
+	/* Command in flight (M25P_OP_* + 1, 0 if idle) and when it started */
+	unsigned		busy;
+	ktime_t			issued;
+	unsigned		op_us[M25P_NR_OPS];
+	unsigned		op_learned;
 };
 
 static inline struct m25p *mtd_to_m25p(struct mtd_info *mtd)
@@ -93,6 +120,51 @@ static inline struct m25p *mtd_to_m25p(struct mtd_info *mtd)
  * Internal helper functions
  */
 
+/*
+ * Note that a command which sets WIP was just sent.  Operations only wait
+ * for the chip when one is in flight, so an idle chip costs no status poll.
+ */
+static void m25p_issued(struct m25p *flash, unsigned op)
+{
+	flash->busy = op + 1;
+	flash->issued = ktime_get();
+}
+
+static unsigned m25p_elapsed_us(struct m25p *flash)
+{
+	return ktime_us_delta(ktime_get(), flash->issued);
+}
+
+static void m25p_sleep_us(unsigned us)
+{
+	ktime_t expires;
+
+	if (us < MIN_SLEEP_US) {
+		cond_resched();
+		return;
+	}
+
+	expires = ktime_set(us / USEC_PER_SEC, (us % USEC_PER_SEC) * NSEC_PER_USEC);
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	schedule_hrtimeout(&expires, HRTIMER_MODE_REL);
+}
+
+/*
+ * Running average of the program and erase times.  The first measurement
+ * replaces the initial guess, the datasheet typical time.
+ */
+static void m25p_learn(struct m25p *flash, unsigned op, unsigned us)
+{
+	if (!(flash->op_learned & (1 << op))) {
+		flash->op_learned |= 1 << op;
+		flash->op_us[op] = us;
+	} else
+		flash->op_us[op] += ((int)us - (int)flash->op_us[op]) / 8;
+
+	if (!flash->op_us[op])
+		flash->op_us[op] = 1;
+}
+
 /*
  * Read the status register, returning its value in the location
  * Return the status register value.
@@ -100,19 +172,17 @@ static inline struct m25p *mtd_to_m25p(struct mtd_info *mtd)
  */
 static int read_sr(struct m25p *flash)
 {
-	ssize_t retval;
-	u8 code = OPCODE_RDSR;
-	u8 val;
+	int retval;
 
-	retval = spi_write_then_read(flash->spi, &code, 1, &val, 1);
+	retval = spi_sync(flash->spi, &flash->sr_msg);
 
 	if (retval < 0) {
-		dev_err(&flash->spi->dev, "error %d reading SR\n",
-				(int) retval);
+		dev_err(&flash->spi->dev, "error %d reading SR\n", retval);
 		return retval;
 	}
 
-	return val;
+	/* the status is clocked in with the byte after the opcode */
+	return flash->sr_buf[3];
 }
 
 /*
@@ -121,10 +191,16 @@ static int read_sr(struct m25p *flash)
  */
 static int write_sr(struct m25p *flash, u8 val)
 {
+	int retval;
+
 	flash->command[0] = OPCODE_WRSR;
 	flash->command[1] = val;
 
-	return spi_write(flash->spi, flash->command, 2);
+	retval = spi_write(flash->spi, flash->command, 2);
+	if (!retval)
+		m25p_issued(flash, M25P_OP_WRSR);
+
+	return retval;
 }
 
 /*
@@ -150,28 +226,81 @@ static inline int write_disable(struct m25p *flash)
 
 /*
  * Service routine to read status register until ready, or timeout occurs.
+ * The first poll is due shortly before the command in flight is expected
+ * to complete, the following ones at an eighth of that time; the task
+ * sleeps in between rather than keeping the bus busy with status reads.
  * Returns non-zero if error.
  */
 static int wait_till_ready(struct m25p *flash)
 {
 	unsigned long deadline;
+	unsigned op, expected, elapsed;
+	int polls = 0;
 	int sr;
 
+	if (!flash->busy)
+		return 0;
+
+	op = flash->busy - 1;
+	expected = flash->op_us[op];
 	deadline = jiffies + MAX_READY_WAIT_JIFFIES;
 
+	elapsed = m25p_elapsed_us(flash);
+	if (elapsed < expected - expected / 8)
+		m25p_sleep_us(expected - expected / 8 - elapsed);
+
 	do {
 		if ((sr = read_sr(flash)) < 0)
 			break;
-		else if (!(sr & SR_WIP))
+		else if (!(sr & SR_WIP)) {
+			if (op <= M25P_OP_ERASE) {
+				elapsed = m25p_elapsed_us(flash);
+				/*
+				 * Only a poll that saw it busy dates the
+				 * completion; done by the first poll only
+				 * bounds it, so let the estimate drift down.
+				 */
+				if (polls)
+					m25p_learn(flash, op, elapsed);
+				else if (elapsed < flash->op_us[op])
+					flash->op_us[op] -=
+						(flash->op_us[op] - elapsed) / 8;
+			}
+			flash->busy = 0;
 			return 0;
+		}
 
-		cond_resched();
+		polls++;
+		m25p_sleep_us(expected / 8);
 
 	} while (!time_after_eq(jiffies, deadline));
 
 	return 1;
 }
 
+/*
+ * Give up the chip until shortly before the command in flight is expected
+ * to complete, the same point wait_till_ready() polls first, so a read
+ * waiting for it gets in before the caller's next command.
+ * Called with flash->lock held.
+ */
+static void m25p_yield(struct m25p *flash)
+{
+	unsigned expected, elapsed;
+
+	if (!flash->busy)
+		return;
+
+	expected = flash->op_us[flash->busy - 1];
+	expected -= expected / 8;
+	elapsed = m25p_elapsed_us(flash);
+
+	mutex_unlock(&flash->lock);
+	if (elapsed < expected)
+		m25p_sleep_us(expected - elapsed);
+	mutex_lock(&flash->lock);
+}
+
 /*
  * Erase the whole flash memory
  *
@@ -194,6 +323,7 @@ static int erase_chip(struct m25p *flash)
 	flash->command[0] = OPCODE_CHIP_ERASE;
 
 	spi_write(flash->spi, flash->command, 1);
+	m25p_issued(flash, M25P_OP_CHIP_ERASE);
 
 	return 0;
 }
@@ -235,10 +365,37 @@ static int erase_sector(struct m25p *flash, u32 offset)
 	m25p_addr2cmd(flash, offset, flash->command);
 
 	spi_write(flash->spi, flash->command, m25p_cmdsz(flash));
+	m25p_issued(flash, M25P_OP_ERASE);
 
 	return 0;
 }
 
+/*
+ * Program up to one page.  Write enable and page program go out as one
+ * prebuilt message, only the address and the data change.
+ *
+ * Returns the number of bytes written, negative if error occurred.
+ */
+static int program_page(struct m25p *flash, u32 to, const u_char *buf,
+	u32 len)
+{
+	int ret;
+
+	flash->command[0] = OPCODE_PP;
+	m25p_addr2cmd(flash, to, flash->command);
+
+	flash->pp_xfer[2].tx_buf = buf;
+	flash->pp_xfer[2].len = len;
+
+	ret = spi_sync(flash->spi, &flash->pp_msg);
+	if (ret < 0)
+		return ret;
+
+	m25p_issued(flash, M25P_OP_PROGRAM);
+
+	return flash->pp_msg.actual_length - 1 - m25p_cmdsz(flash);
+}
+
 /****************************************************************************/
 
 /*
@@ -295,6 +452,10 @@ static int m25p80_erase(struct mtd_info *mtd, struct erase_info *instr)
 
 			addr += mtd->erasesize;
 			len -= mtd->erasesize;
+
+			/* reads of other sectors go between two erases */
+			if (len)
+				m25p_yield(flash);
 		}
 	}
 
@@ -316,6 +477,7 @@ static int m25p80_read(struct mtd_info *mtd, loff_t from, size_t len,
 	struct m25p *flash = mtd_to_m25p(mtd);
 	struct spi_transfer t[2];
 	struct spi_message m;
+	size_t chunk;
 
 	DEBUG(MTD_DEBUG_LEVEL2, "%s: %s %s 0x%08x, len %zd\n",
 			dev_name(&flash->spi->dev), __func__, "from",
@@ -339,8 +501,6 @@ static int m25p80_read(struct mtd_info *mtd, loff_t from, size_t len,
 	t[0].len = m25p_cmdsz(flash) + FAST_READ_DUMMY_BYTE;
 	spi_message_add_tail(&t[0], &m);
 
-	t[1].rx_buf = buf;
-	t[1].len = len;
 	spi_message_add_tail(&t[1], &m);
 
 	/* Byte count starts at zero. */
@@ -363,11 +523,23 @@ static int m25p80_read(struct mtd_info *mtd, loff_t from, size_t len,
 
 	/* Set up the write data buffer. */
 	flash->command[0] = OPCODE_READ;
-	m25p_addr2cmd(flash, from, flash->command);
 
-	spi_sync(flash->spi, &m);
+	/* One message per chunk, so a long read doesn't hold the bus. */
+	while (len) {
+		chunk = min_t(size_t, len, READ_CHUNK_SIZE);
 
-	*retlen = m.actual_length - m25p_cmdsz(flash) - FAST_READ_DUMMY_BYTE;
+		m25p_addr2cmd(flash, from, flash->command);
+		t[1].rx_buf = buf;
+		t[1].len = chunk;
+
+		spi_sync(flash->spi, &m);
+
+		*retlen += m.actual_length - m25p_cmdsz(flash) - FAST_READ_DUMMY_BYTE;
+
+		from += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
 
 	mutex_unlock(&flash->lock);
 
@@ -384,8 +556,8 @@ static int m25p80_write(struct mtd_info *mtd, loff_t to, size_t len,
 {
 	struct m25p *flash = mtd_to_m25p(mtd);
 	u32 page_offset, page_size;
-	struct spi_transfer t[2];
-	struct spi_message m;
+	size_t done = 0;
+	int ret = 0;
 
 	DEBUG(MTD_DEBUG_LEVEL2, "%s: %s %s 0x%08x, len %zd\n",
 			dev_name(&flash->spi->dev), __func__, "to",
@@ -401,76 +573,42 @@ static int m25p80_write(struct mtd_info *mtd, loff_t to, size_t len,
 	if (to + len > flash->mtd.size)
 		return -EINVAL;
 
-	spi_message_init(&m);
-	memset(t, 0, (sizeof t));
-
-	t[0].tx_buf = flash->command;
-	t[0].len = m25p_cmdsz(flash);
-	spi_message_add_tail(&t[0], &m);
-
-	t[1].tx_buf = buf;
-	spi_message_add_tail(&t[1], &m);
-
-	mutex_lock(&flash->lock);
-
-	/* Wait until finished previous write command. */
-	if (wait_till_ready(flash)) {
-		mutex_unlock(&flash->lock);
-		return 1;
-	}
-
-	write_enable(flash);
-
-	/* Set up the opcode in the write buffer. */
-	flash->command[0] = OPCODE_PP;
-	m25p_addr2cmd(flash, to, flash->command);
-
+	/* the size of data remaining on the first page */
 	page_offset = to & (flash->page_size - 1);
+	page_size = flash->page_size - page_offset;
 
-	/* do all the bytes fit onto one page? */
-	if (page_offset + len <= flash->page_size) {
-		t[1].len = len;
-
-		spi_sync(flash->spi, &m);
-
-		*retlen = m.actual_length - m25p_cmdsz(flash);
-	} else {
-		u32 i;
-
-		/* the size of data remaining on the first page */
-		page_size = flash->page_size - page_offset;
-
-		t[1].len = page_size;
-		spi_sync(flash->spi, &m);
-
-		*retlen = m.actual_length - m25p_cmdsz(flash);
-
-		/* write everything in flash->page_size chunks */
-		for (i = page_size; i < len; i += page_size) {
-			page_size = len - i;
-			if (page_size > flash->page_size)
-				page_size = flash->page_size;
+	mutex_lock(&flash->lock);
 
-			/* write the next page to flash */
-			m25p_addr2cmd(flash, to + i, flash->command);
+	/* write everything in flash->page_size chunks */
+	while (done < len) {
+		if (page_size > len - done)
+			page_size = len - done;
 
-			t[1].tx_buf = buf + i;
-			t[1].len = page_size;
+		/* Wait until finished previous write command. */
+		if (wait_till_ready(flash)) {
+			ret = 1;
+			break;
+		}
 
-			wait_till_ready(flash);
+		ret = program_page(flash, to + done, buf + done, page_size);
+		if (ret < 0)
+			break;
 
-			write_enable(flash);
+		if (retlen)
+			*retlen += ret;
+		ret = 0;
 
-			spi_sync(flash->spi, &m);
+		done += page_size;
+		page_size = flash->page_size;
 
-			if (retlen)
-				*retlen += m.actual_length - m25p_cmdsz(flash);
-		}
+		/* a waiting read gets the chip while the page programs */
+		if (done < len)
+			m25p_yield(flash);
 	}
 
 	mutex_unlock(&flash->lock);
 
-	return 0;
+	return ret;
 }
 
 static int sst_write(struct mtd_info *mtd, loff_t to, size_t len,
@@ -520,6 +658,7 @@ static int sst_write(struct mtd_info *mtd, loff_t to, size_t len,
 		/* write one byte. */
 		t[1].len = 1;
 		spi_sync(flash->spi, &m);
+		m25p_issued(flash, M25P_OP_PROGRAM);
 		ret = wait_till_ready(flash);
 		if (ret)
 			goto time_out;
@@ -539,6 +678,7 @@ static int sst_write(struct mtd_info *mtd, loff_t to, size_t len,
 		t[1].tx_buf = buf + actual;
 
 		spi_sync(flash->spi, &m);
+		m25p_issued(flash, M25P_OP_PROGRAM);
 		ret = wait_till_ready(flash);
 		if (ret)
 			goto time_out;
@@ -561,6 +701,7 @@ static int sst_write(struct mtd_info *mtd, loff_t to, size_t len,
 		t[1].tx_buf = buf + actual;
 
 		spi_sync(flash->spi, &m);
+		m25p_issued(flash, M25P_OP_PROGRAM);
 		ret = wait_till_ready(flash);
 		if (ret)
 			goto time_out;
@@ -814,7 +955,7 @@ static int __devinit m25p_probe(struct spi_device *spi)
 	flash = kzalloc(sizeof *flash, GFP_KERNEL);
 	if (!flash)
 		return -ENOMEM;
-	flash->command = kmalloc(MAX_CMD_SIZE + FAST_READ_DUMMY_BYTE, GFP_KERNEL);
+	flash->command = kmalloc(MAX_CMD_SIZE + FAST_READ_DUMMY_BYTE + 5, GFP_KERNEL);
 	if (!flash->command) {
 		kfree(flash);
 		return -ENOMEM;
@@ -824,6 +965,27 @@ static int __devinit m25p_probe(struct spi_device *spi)
 	mutex_init(&flash->lock);
 	dev_set_drvdata(&spi->dev, flash);
 
+	/* RDSR out, status in (sr_buf[0..3]), then the WREN opcode */
+	flash->sr_buf = flash->command + MAX_CMD_SIZE + FAST_READ_DUMMY_BYTE;
+	flash->sr_buf[0] = OPCODE_RDSR;
+	flash->sr_buf[1] = 0;
+	flash->sr_buf[4] = OPCODE_WREN;
+
+	flash->sr_xfer.tx_buf = flash->sr_buf;
+	flash->sr_xfer.rx_buf = flash->sr_buf + 2;
+	flash->sr_xfer.len = 2;
+	spi_message_init(&flash->sr_msg);
+	spi_message_add_tail(&flash->sr_xfer, &flash->sr_msg);
+
+	/* Datasheet typical times, replaced by the first measurement */
+	flash->op_us[M25P_OP_PROGRAM] = info->jedec_id >> 16 == 0xbf ? 10 : 640;
+	flash->op_us[M25P_OP_ERASE] = info->flags & SECT_4K ? 50000 : 500000;
+	flash->op_us[M25P_OP_WRSR] = 15000;
+	flash->op_us[M25P_OP_CHIP_ERASE] = 1000000;
+
+	/* The boot loader may have left a command running */
+	m25p_issued(flash, M25P_OP_WRSR);
+
 	/*
 	 * Atmel and SST serial flash tend to power
 	 * up with the software protection bits set
@@ -869,6 +1031,17 @@ static int __devinit m25p_probe(struct spi_device *spi)
 	flash->page_size = info->page_size;
 	flash->addr_width = info->addr_width;
 
+	/* WREN, deselect, PP and address, data */
+	flash->pp_xfer[0].tx_buf = flash->sr_buf + 4;
+	flash->pp_xfer[0].len = 1;
+	flash->pp_xfer[0].cs_change = 1;
+	flash->pp_xfer[1].tx_buf = flash->command;
+	flash->pp_xfer[1].len = m25p_cmdsz(flash);
+	spi_message_init(&flash->pp_msg);
+	spi_message_add_tail(&flash->pp_xfer[0], &flash->pp_msg);
+	spi_message_add_tail(&flash->pp_xfer[1], &flash->pp_msg);
+	spi_message_add_tail(&flash->pp_xfer[2], &flash->pp_msg);
+
 	dev_info(&spi->dev, "%s (%lld Kbytes)\n", id->name,
 			(long long)flash->mtd.size >> 10);
 
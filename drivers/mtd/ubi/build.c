@@ -43,6 +43,7 @@
 #include <linux/kthread.h>
 #include <linux/reboot.h>
 #include <linux/kernel.h>
+#include <linux/math64.h>
 #include "ubi.h"
 
 /* Maximum length of the 'mtd=' parameter */
@@ -98,6 +99,9 @@ static struct class_attribute ubi_version =
 
 static ssize_t dev_attribute_show(struct device *dev,
 				  struct device_attribute *attr, char *buf);
+static ssize_t dev_attribute_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count);
 
 /* UBI device attributes (correspond to files in '/<sysfs>/class/ubi/ubiX') */
 static struct device_attribute dev_eraseblock_size =
@@ -122,6 +126,19 @@ static struct device_attribute dev_bgt_enabled =
 	__ATTR(bgt_enabled, S_IRUGO, dev_attribute_show, NULL);
 static struct device_attribute dev_mtd_num =
 	__ATTR(mtd_num, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_free_eraseblocks =
+	__ATTR(free_eraseblocks, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_free_low_watermark =
+	__ATTR(free_low_watermark, S_IRUGO | S_IWUSR, dev_attribute_show,
+	       dev_attribute_store);
+static struct device_attribute dev_erase_waits =
+	__ATTR(erase_waits, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_erase_wait_ms =
+	__ATTR(erase_wait_ms, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_combined_writes =
+	__ATTR(combined_writes, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_raw_writes =
+	__ATTR(raw_writes, S_IRUGO, dev_attribute_show, NULL);
 
 /**
  * ubi_volume_notify - send a volume change notification.
@@ -346,6 +363,23 @@ static ssize_t dev_attribute_show(struct device *dev,
 		ret = sprintf(buf, "%d\n", ubi->thread_enabled);
 	else if (attr == &dev_mtd_num)
 		ret = sprintf(buf, "%d\n", ubi->mtd->index);
+	else if (attr == &dev_free_eraseblocks)
+		ret = sprintf(buf, "%d\n", ubi->free_count);
+	else if (attr == &dev_free_low_watermark)
+		ret = sprintf(buf, "%d\n", ubi->free_low);
+	else if (attr == &dev_erase_waits)
+		ret = sprintf(buf, "%u\n", ubi->erase_waits);
+	else if (attr == &dev_erase_wait_ms) {
+		u64 ms;
+
+		spin_lock(&ubi->wl_lock);
+		ms = div_u64(ubi->erase_wait_us, 1000);
+		spin_unlock(&ubi->wl_lock);
+		ret = sprintf(buf, "%llu\n", (unsigned long long)ms);
+	} else if (attr == &dev_combined_writes)
+		ret = sprintf(buf, "%u\n", ubi->comb_writes);
+	else if (attr == &dev_raw_writes)
+		ret = sprintf(buf, "%u\n", ubi->comb_raw_writes);
 	else
 		ret = -EINVAL;
 
@@ -353,6 +387,35 @@ static ssize_t dev_attribute_show(struct device *dev,
 	return ret;
 }
 
+/* "Store" method for files in '/<sysfs>/class/ubi/ubiX/' */
+static ssize_t dev_attribute_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	ssize_t ret;
+	unsigned long val;
+	struct ubi_device *ubi;
+
+	/* See the comment in 'dev_attribute_show()' */
+	ubi = container_of(dev, struct ubi_device, dev);
+	ubi = ubi_get_device(ubi->ubi_num);
+	if (!ubi)
+		return -ENODEV;
+
+	ret = -EINVAL;
+	if (attr == &dev_free_low_watermark) {
+		if (!strict_strtoul(buf, 0, &val) && val <= ubi->peb_count) {
+			spin_lock(&ubi->wl_lock);
+			ubi->free_low = val;
+			spin_unlock(&ubi->wl_lock);
+			ret = count;
+		}
+	}
+
+	ubi_put_device(ubi);
+	return ret;
+}
+
 static void dev_release(struct device *dev)
 {
 	struct ubi_device *ubi = container_of(dev, struct ubi_device, dev);
@@ -410,6 +473,24 @@ static int ubi_sysfs_init(struct ubi_device *ubi)
 	if (err)
 		return err;
 	err = device_create_file(&ubi->dev, &dev_mtd_num);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_free_eraseblocks);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_free_low_watermark);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_erase_waits);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_erase_wait_ms);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_combined_writes);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_raw_writes);
 	return err;
 }
 
@@ -419,6 +500,12 @@ static int ubi_sysfs_init(struct ubi_device *ubi)
  */
 static void ubi_sysfs_close(struct ubi_device *ubi)
 {
+	device_remove_file(&ubi->dev, &dev_raw_writes);
+	device_remove_file(&ubi->dev, &dev_combined_writes);
+	device_remove_file(&ubi->dev, &dev_erase_wait_ms);
+	device_remove_file(&ubi->dev, &dev_erase_waits);
+	device_remove_file(&ubi->dev, &dev_free_low_watermark);
+	device_remove_file(&ubi->dev, &dev_free_eraseblocks);
 	device_remove_file(&ubi->dev, &dev_mtd_num);
 	device_remove_file(&ubi->dev, &dev_bgt_enabled);
 	device_remove_file(&ubi->dev, &dev_min_io_size);
@@ -568,17 +655,18 @@ static void free_internal_volumes(struct ubi_device *ubi)
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  *
- * Note, currently this is the only method to attach UBI devices. Hopefully in
- * the future we'll have more scalable attaching methods and avoid full media
- * scanning. But even in this case scanning will be needed as a fall-back
- * attaching method if there are some on-flash table corruptions.
+ * Note, the scanning information is taken from the attach snapshot written on
+ * the last clean detach if there is a valid one (see snapshot.c), and full
+ * media scanning is the fall-back attaching method.
  */
 static int attach_by_scanning(struct ubi_device *ubi)
 {
 	int err;
 	struct ubi_scan_info *si;
 
-	si = ubi_scan(ubi);
+	si = ubi_snapshot_scan(ubi);
+	if (!si)
+		si = ubi_scan(ubi);
 	if (IS_ERR(si))
 		return PTR_ERR(si);
 
@@ -838,7 +926,8 @@ static int autoresize(struct ubi_device *ubi, int vol_id)
  * This function stops the UBI background thread so that the flash device
  * remains quiescent when Linux restarts the system. Any queued work will be
  * discarded, but this function will block until do_work() finishes if an
- * operation is already in progress.
+ * operation is already in progress. If no volume is open for writing any
+ * more, the attach snapshot is written as well.
  *
  * This function solves a real-life problem observed on NOR flashes when an
  * PEB erase operation starts, then the system is rebooted before the erase is
@@ -853,6 +942,7 @@ static int ubi_reboot_notifier(struct notifier_block *n, unsigned long state,
 	ubi = container_of(n, struct ubi_device, reboot_notifier);
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
+	ubi_snapshot_write(ubi);
 	ubi_sync(ubi->ubi_num);
 	return NOTIFY_DONE;
 }
@@ -956,6 +1046,10 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	if (!ubi->peb_buf2)
 		goto out_free;
 
+	err = ubi_io_comb_init(ubi);
+	if (err)
+		goto out_free;
+
 #ifdef CONFIG_MTD_UBI_DEBUG_PARANOID
 	mutex_init(&ubi->dbg_buf_mutex);
 	ubi->dbg_peb_buf = vmalloc(ubi->peb_size);
@@ -994,6 +1088,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	ubi_msg("number of bad PEBs:         %d", ubi->bad_peb_count);
 	ubi_msg("max. allowed volumes:       %d", ubi->vtbl_slots);
 	ubi_msg("wear-leveling threshold:    %d", CONFIG_MTD_UBI_WL_THRESHOLD);
+	if (ubi->comb_size)
+		ubi_msg("write-combining buffer:     %d bytes", ubi->comb_size);
 	ubi_msg("number of internal volumes: %d", UBI_INT_VOL_COUNT);
 	ubi_msg("number of user volumes:     %d",
 		ubi->vol_count - UBI_INT_VOL_COUNT);
@@ -1034,6 +1130,7 @@ out_detach:
 	free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
 out_free:
+	ubi_io_comb_close(ubi);
 	vfree(ubi->peb_buf1);
 	vfree(ubi->peb_buf2);
 #ifdef CONFIG_MTD_UBI_DEBUG_PARANOID
@@ -1058,6 +1155,7 @@ out_free:
  */
 int ubi_detach_mtd_dev(int ubi_num, int anyway)
 {
+	int err;
 	struct ubi_device *ubi;
 
 	if (ubi_num < 0 || ubi_num >= UBI_MAX_DEVICES)
@@ -1093,6 +1191,15 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	unregister_reboot_notifier(&ubi->reboot_notifier);
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
+	ubi_io_comb_close(ubi);
+
+	/*
+	 * Nothing is going to change on the flash any longer, so let the next
+	 * attach use a snapshot rather than scanning.
+	 */
+	err = ubi_snapshot_write(ubi);
+	if (err)
+		ubi_warn("cannot write attach snapshot, error %d", err);
 
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
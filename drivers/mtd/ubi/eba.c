@@ -590,6 +590,9 @@ write_error:
  * @vol. Returns zero in case of success and a negative error code in case
  * of failure. In case of error, it is possible that something was still
  * written to the flash media, but may be some garbage.
+ *
+ * The data go through the write-combining buffer and may reach the flash
+ * only later, see 'ubi_io_comb_write()'.
  */
 int ubi_eba_write_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
 		      const void *buf, int offset, int len, int dtype)
@@ -609,7 +612,8 @@ int ubi_eba_write_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
 		dbg_eba("write %d bytes at offset %d of LEB %d:%d, PEB %d",
 			len, offset, vol_id, lnum, pnum);
 
-		err = ubi_io_write_data(ubi, buf, pnum, offset, len);
+		err = ubi_io_comb_write(ubi, buf, pnum, offset + ubi->leb_start,
+					len);
 		if (err) {
 			ubi_warn("failed to write data to PEB %d", pnum);
 			if (err == -EIO && ubi->bad_allowed)
@@ -658,7 +662,8 @@ retry:
 	}
 
 	if (len) {
-		err = ubi_io_write_data(ubi, buf, pnum, offset, len);
+		err = ubi_io_comb_write(ubi, buf, pnum,
+					offset + ubi->leb_start, len);
 		if (err) {
 			ubi_warn("failed to write %d bytes at offset %d of "
 				 "LEB %d:%d, PEB %d", len, offset, vol_id,
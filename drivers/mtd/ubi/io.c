@@ -88,6 +88,7 @@
 
 #include <linux/crc32.h>
 #include <linux/err.h>
+#include <linux/log2.h>
 #include "ubi.h"
 
 #ifdef CONFIG_MTD_UBI_DEBUG_PARANOID
@@ -197,24 +198,17 @@ retry:
 }
 
 /**
- * ubi_io_write - write data to a physical eraseblock.
+ * io_write - write data to a physical eraseblock.
  * @ubi: UBI device description object
  * @buf: buffer with the data to write
  * @pnum: physical eraseblock number to write to
  * @offset: offset within the physical eraseblock where to write
  * @len: how many bytes to write
  *
- * This function writes @len bytes of data from buffer @buf to offset @offset
- * of physical eraseblock @pnum. If all the data were successfully written,
- * zero is returned. If an error occurred, this function returns a negative
- * error code. If %-EIO is returned, the physical eraseblock most probably went
- * bad.
- *
- * Note, in case of an error, it is possible that something was still written
- * to the flash media, but may be some garbage.
+ * This is 'ubi_io_write()' without flushing the write-combining buffer first.
  */
-int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
-		 int len)
+static int io_write(struct ubi_device *ubi, const void *buf, int pnum,
+		    int offset, int len)
 {
 	int err;
 	size_t written;
@@ -276,6 +270,275 @@ int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
 	return err;
 }
 
+/**
+ * ubi_io_write - write data to a physical eraseblock.
+ * @ubi: UBI device description object
+ * @buf: buffer with the data to write
+ * @pnum: physical eraseblock number to write to
+ * @offset: offset within the physical eraseblock where to write
+ * @len: how many bytes to write
+ *
+ * This function writes @len bytes of data from buffer @buf to offset @offset
+ * of physical eraseblock @pnum. If all the data were successfully written,
+ * zero is returned. If an error occurred, this function returns a negative
+ * error code. If %-EIO is returned, the physical eraseblock most probably went
+ * bad.
+ *
+ * Data still sitting in the write-combining buffer is written out first, so
+ * the flash always sees the writes in the order they were issued.
+ *
+ * Note, in case of an error, it is possible that something was still written
+ * to the flash media, but may be some garbage.
+ */
+int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
+		 int len)
+{
+	int err;
+
+	err = ubi_io_comb_flush(ubi, -1);
+	if (err)
+		return err;
+
+	return io_write(ubi, buf, pnum, offset, len);
+}
+
+/*
+ * Write-combining.
+ *
+ * NOR flashes have a 1 byte minimal I/O unit, so UBIFS hands them very small
+ * write-buffers, but the MTD driver still programs page by page and waits for
+ * each page program to finish. When write-combining is enabled, contiguous
+ * writes to a logical eraseblock are collected in a buffer of one flash page
+ * (@ubi->comb_size) and programmed once the page is full.
+ *
+ * Only one page of one physical eraseblock is ever buffered, and it is written
+ * out before any other write or erasure, so the flash contents always
+ * correspond to a prefix of the issued operations. Reads of the data area of
+ * the buffered physical eraseblock flush it as well. Otherwise the buffer is
+ * flushed by 'ubi_sync()' and after %COMB_DELAY at the latest.
+ */
+
+/* How long data may sit in the write-combining buffer */
+#define COMB_DELAY msecs_to_jiffies(50)
+
+/**
+ * comb_flush - write out the write-combining buffer.
+ * @ubi: UBI device description object
+ *
+ * This function writes the buffered data, if any, and returns zero in case of
+ * success and a negative error code in case of failure. The caller has to hold
+ * @ubi->comb_mutex.
+ */
+static int comb_flush(struct ubi_device *ubi)
+{
+	int err, len = ubi->comb_len;
+	int start = ubi->comb_offs & (ubi->comb_size - 1);
+
+	if (!len)
+		return 0;
+
+	ubi->comb_len = 0;
+	ubi->comb_raw_writes += 1;
+	err = io_write(ubi, ubi->comb_buf + start, ubi->comb_pnum,
+		       ubi->comb_offs, len);
+	if (err) {
+		ubi_err("cannot write %d buffered bytes to PEB %d:%d, error %d",
+			len, ubi->comb_pnum, ubi->comb_offs, err);
+	}
+	return err;
+}
+
+/**
+ * comb_flush_acked - write out buffered data of earlier writes.
+ * @ubi: UBI device description object
+ *
+ * Same as 'comb_flush()', but for data whose writers have already been told
+ * the write succeeded. Such data cannot be recovered any more, so a failure
+ * switches UBI to read-only mode, and %-EROFS is returned rather than the
+ * error itself, so that the caller does not take it for a failure of its own
+ * physical eraseblock.
+ */
+static int comb_flush_acked(struct ubi_device *ubi)
+{
+	int err;
+
+	err = comb_flush(ubi);
+	if (err) {
+		ubi_ro_mode(ubi);
+		err = -EROFS;
+	}
+	return err;
+}
+
+/**
+ * comb_timeout - flush the write-combining buffer after a delay.
+ * @work: the @ubi->comb_work object
+ */
+static void comb_timeout(struct work_struct *work)
+{
+	struct ubi_device *ubi = container_of(work, struct ubi_device,
+					      comb_work.work);
+
+	ubi_io_comb_flush(ubi, -1);
+}
+
+/**
+ * ubi_io_comb_write - write data through the write-combining buffer.
+ * @ubi: UBI device description object
+ * @buf: buffer with the data to write
+ * @pnum: physical eraseblock number to write to
+ * @offset: offset within the physical eraseblock where to write
+ * @len: how many bytes to write
+ *
+ * This function is equivalent to 'ubi_io_write()', except that the data may
+ * stay in the write-combining buffer for a while. Whole pages are written
+ * directly, partial pages are buffered until the page is complete, or until a
+ * write to another place, an erasure or a read of this physical eraseblock.
+ * If write-combining is disabled, this is just 'ubi_io_write()'.
+ *
+ * Failures to write data of earlier writes are returned as %-EROFS, only
+ * errors of the data passed in blame @pnum.
+ */
+int ubi_io_comb_write(struct ubi_device *ubi, const void *buf, int pnum,
+		      int offset, int len)
+{
+	int err = 0, acked, page = ubi->comb_size;
+
+	if (!ubi->comb_buf)
+		return ubi_io_write(ubi, buf, pnum, offset, len);
+
+	dbg_io("combine %d bytes to PEB %d:%d", len, pnum, offset);
+	ubi_assert(pnum >= 0 && pnum < ubi->peb_count);
+	ubi_assert(offset >= ubi->leb_start && offset + len <= ubi->peb_size);
+
+	if (ubi->ro_mode)
+		return -EROFS;
+
+	mutex_lock(&ubi->comb_mutex);
+	ubi->comb_writes += 1;
+	if (ubi->comb_len && (pnum != ubi->comb_pnum ||
+			      offset != ubi->comb_offs + ubi->comb_len)) {
+		err = comb_flush_acked(ubi);
+		if (err)
+			goto out_unlock;
+	}
+
+	/* Whether the buffer holds data of earlier writes */
+	acked = !!ubi->comb_len;
+	while (len) {
+		int start, n;
+
+		if (!ubi->comb_len) {
+			if (!(offset & (page - 1)) && len >= page) {
+				/* Whole pages need no buffering */
+				n = len & ~(page - 1);
+				ubi->comb_raw_writes += 1;
+				err = io_write(ubi, buf, pnum, offset, n);
+				if (err)
+					goto out_unlock;
+				goto next;
+			}
+			ubi->comb_pnum = pnum;
+			ubi->comb_offs = offset;
+		}
+
+		start = (ubi->comb_offs & (page - 1)) + ubi->comb_len;
+		n = min_t(int, len, page - start);
+		memcpy(ubi->comb_buf + start, buf, n);
+		ubi->comb_len += n;
+		if (start + n == page) {
+			if (acked)
+				err = comb_flush_acked(ubi);
+			else
+				err = comb_flush(ubi);
+			if (err)
+				goto out_unlock;
+			acked = 0;
+		}
+next:
+		buf += n;
+		offset += n;
+		len -= n;
+	}
+
+	if (ubi->comb_len)
+		schedule_delayed_work(&ubi->comb_work, COMB_DELAY);
+
+out_unlock:
+	mutex_unlock(&ubi->comb_mutex);
+	return err;
+}
+
+/**
+ * ubi_io_comb_flush - flush the write-combining buffer.
+ * @ubi: UBI device description object
+ * @pnum: flush only if data for this physical eraseblock is buffered, %-1
+ *        to flush in any case
+ *
+ * This function returns zero in case of success and %-EROFS if the buffered
+ * data could not be written, in which case UBI is switched to read-only mode.
+ */
+int ubi_io_comb_flush(struct ubi_device *ubi, int pnum)
+{
+	int err = 0;
+
+	if (!ubi->comb_buf)
+		return 0;
+
+	mutex_lock(&ubi->comb_mutex);
+	if (pnum == -1 || pnum == ubi->comb_pnum)
+		err = comb_flush_acked(ubi);
+	mutex_unlock(&ubi->comb_mutex);
+	return err;
+}
+
+/**
+ * ubi_io_comb_init - initialize write-combining.
+ * @ubi: UBI device description object
+ *
+ * Write-combining is enabled if %CONFIG_MTD_UBI_WRITE_COMBINE is a power of 2
+ * larger than the minimal I/O unit size. Returns zero in case of success and
+ * %-ENOMEM if the buffer could not be allocated.
+ */
+int ubi_io_comb_init(struct ubi_device *ubi)
+{
+	int size = CONFIG_MTD_UBI_WRITE_COMBINE;
+
+	mutex_init(&ubi->comb_mutex);
+	INIT_DELAYED_WORK(&ubi->comb_work, comb_timeout);
+
+	if (size <= ubi->min_io_size)
+		return 0;
+
+	if (!is_power_of_2(size) || ubi->peb_size % size) {
+		ubi_warn("bad write-combining buffer size %d, disabled", size);
+		return 0;
+	}
+
+	ubi->comb_buf = kmalloc(size, GFP_KERNEL);
+	if (!ubi->comb_buf)
+		return -ENOMEM;
+
+	ubi->comb_size = size;
+	return 0;
+}
+
+/**
+ * ubi_io_comb_close - flush and free the write-combining buffer.
+ * @ubi: UBI device description object
+ */
+void ubi_io_comb_close(struct ubi_device *ubi)
+{
+	if (!ubi->comb_buf)
+		return;
+
+	cancel_delayed_work_sync(&ubi->comb_work);
+	ubi_io_comb_flush(ubi, -1);
+	kfree(ubi->comb_buf);
+	ubi->comb_buf = NULL;
+	ubi->comb_size = 0;
+}
+
 /**
  * erase_callback - MTD erasure call-back.
  * @ei: MTD erase information object.
@@ -549,6 +812,11 @@ int ubi_io_sync_erase(struct ubi_device *ubi, int pnum, int torture)
 		return -EROFS;
 	}
 
+	/* Buffered data of earlier writes has to hit the flash first */
+	err = ubi_io_comb_flush(ubi, -1);
+	if (err)
+		return err;
+
 	if (ubi->nor_flash) {
 		err = nor_erase_prepare(ubi, pnum);
 		if (err)
@@ -678,51 +946,28 @@ bad:
 }
 
 /**
- * ubi_io_read_ec_hdr - read and check an erase counter header.
+ * check_ec_hdr - check an erase counter header which has been read.
  * @ubi: UBI device description object
- * @pnum: physical eraseblock to read from
- * @ec_hdr: a &struct ubi_ec_hdr object where to store the read erase counter
- * header
+ * @pnum: physical eraseblock the header was read from
+ * @ec_hdr: the erase counter header
  * @verbose: be verbose if the header is corrupted or was not found
+ * @read_err: the result of reading the header
  *
- * This function reads erase counter header from physical eraseblock @pnum and
- * stores it in @ec_hdr. This function also checks CRC checksum of the read
- * erase counter header. The following codes may be returned:
+ * If @read_err is not zero, all the data were read, but either a correctable
+ * bit-flip occurred, or MTD reported about some data integrity error, like an
+ * ECC error in case of NAND. The former is harmless, the later may mean that
+ * the read data is corrupted. But we have a CRC check-sum and we will detect
+ * this. If the EC header is still OK, we just report this as there was a
+ * bit-flip.
  *
- * o %0 if the CRC checksum is correct and the header was successfully read;
- * o %UBI_IO_BITFLIPS if the CRC is correct, but bit-flips were detected
- *   and corrected by the flash driver; this is harmless but may indicate that
- *   this eraseblock may become bad soon (but may be not);
- * o %UBI_IO_BAD_EC_HDR if the erase counter header is corrupted (a CRC error);
- * o %UBI_IO_PEB_EMPTY if the physical eraseblock is empty;
- * o a negative error code in case of failure.
+ * Returns the same codes as 'ubi_io_read_ec_hdr()'.
  */
-int ubi_io_read_ec_hdr(struct ubi_device *ubi, int pnum,
-		       struct ubi_ec_hdr *ec_hdr, int verbose)
+static int check_ec_hdr(const struct ubi_device *ubi, int pnum,
+			struct ubi_ec_hdr *ec_hdr, int verbose, int read_err)
 {
-	int err, read_err = 0;
+	int err;
 	uint32_t crc, magic, hdr_crc;
 
-	dbg_io("read EC header from PEB %d", pnum);
-	ubi_assert(pnum >= 0 && pnum < ubi->peb_count);
-
-	err = ubi_io_read(ubi, ec_hdr, pnum, 0, UBI_EC_HDR_SIZE);
-	if (err) {
-		if (err != UBI_IO_BITFLIPS && err != -EBADMSG)
-			return err;
-
-		/*
-		 * We read all the data, but either a correctable bit-flip
-		 * occurred, or MTD reported about some data integrity error,
-		 * like an ECC error in case of NAND. The former is harmless,
-		 * the later may mean that the read data is corrupted. But we
-		 * have a CRC check-sum and we will detect this. If the EC
-		 * header is still OK, we just report this as there was a
-		 * bit-flip.
-		 */
-		read_err = err;
-	}
-
 	magic = be32_to_cpu(ec_hdr->magic);
 	if (magic != UBI_EC_HDR_MAGIC) {
 		/*
@@ -785,6 +1030,41 @@ int ubi_io_read_ec_hdr(struct ubi_device *ubi, int pnum,
 	return read_err ? UBI_IO_BITFLIPS : 0;
 }
 
+/**
+ * ubi_io_read_ec_hdr - read and check an erase counter header.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock to read from
+ * @ec_hdr: a &struct ubi_ec_hdr object where to store the read erase counter
+ * header
+ * @verbose: be verbose if the header is corrupted or was not found
+ *
+ * This function reads erase counter header from physical eraseblock @pnum and
+ * stores it in @ec_hdr. This function also checks CRC checksum of the read
+ * erase counter header. The following codes may be returned:
+ *
+ * o %0 if the CRC checksum is correct and the header was successfully read;
+ * o %UBI_IO_BITFLIPS if the CRC is correct, but bit-flips were detected
+ *   and corrected by the flash driver; this is harmless but may indicate that
+ *   this eraseblock may become bad soon (but may be not);
+ * o %UBI_IO_BAD_EC_HDR if the erase counter header is corrupted (a CRC error);
+ * o %UBI_IO_PEB_EMPTY if the physical eraseblock is empty;
+ * o a negative error code in case of failure.
+ */
+int ubi_io_read_ec_hdr(struct ubi_device *ubi, int pnum,
+		       struct ubi_ec_hdr *ec_hdr, int verbose)
+{
+	int err;
+
+	dbg_io("read EC header from PEB %d", pnum);
+	ubi_assert(pnum >= 0 && pnum < ubi->peb_count);
+
+	err = ubi_io_read(ubi, ec_hdr, pnum, 0, UBI_EC_HDR_SIZE);
+	if (err && err != UBI_IO_BITFLIPS && err != -EBADMSG)
+		return err;
+
+	return check_ec_hdr(ubi, pnum, ec_hdr, verbose, err);
+}
+
 /**
  * ubi_io_write_ec_hdr - write an erase counter header.
  * @ubi: UBI device description object
@@ -946,54 +1226,27 @@ bad:
 }
 
 /**
- * ubi_io_read_vid_hdr - read and check a volume identifier header.
+ * check_vid_hdr - check a volume identifier header which has been read.
  * @ubi: UBI device description object
- * @pnum: physical eraseblock number to read from
- * @vid_hdr: &struct ubi_vid_hdr object where to store the read volume
- * identifier header
+ * @pnum: physical eraseblock the header was read from
+ * @vid_hdr: the volume identifier header
  * @verbose: be verbose if the header is corrupted or wasn't found
+ * @read_err: the result of reading the header
  *
- * This function reads the volume identifier header from physical eraseblock
- * @pnum and stores it in @vid_hdr. It also checks CRC checksum of the read
- * volume identifier header. The following codes may be returned:
+ * If @read_err is not zero, all the data were read, but either a correctable
+ * bit-flip occurred, or MTD reported about some data integrity error, like an
+ * ECC error in case of NAND. The former is harmless, the later may mean the
+ * read data is corrupted. But we have a CRC check-sum and we will identify
+ * this. If the VID header is still OK, we just report this as there was a
+ * bit-flip.
  *
- * o %0 if the CRC checksum is correct and the header was successfully read;
- * o %UBI_IO_BITFLIPS if the CRC is correct, but bit-flips were detected
- *   and corrected by the flash driver; this is harmless but may indicate that
- *   this eraseblock may become bad soon;
- * o %UBI_IO_BAD_VID_HDR if the volume identifier header is corrupted (a CRC
- *   error detected);
- * o %UBI_IO_PEB_FREE if the physical eraseblock is free (i.e., there is no VID
- *   header there);
- * o a negative error code in case of failure.
+ * Returns the same codes as 'ubi_io_read_vid_hdr()'.
  */
-int ubi_io_read_vid_hdr(struct ubi_device *ubi, int pnum,
-			struct ubi_vid_hdr *vid_hdr, int verbose)
+static int check_vid_hdr(const struct ubi_device *ubi, int pnum,
+			 struct ubi_vid_hdr *vid_hdr, int verbose, int read_err)
 {
-	int err, read_err = 0;
+	int err;
 	uint32_t crc, magic, hdr_crc;
-	void *p;
-
-	dbg_io("read VID header from PEB %d", pnum);
-	ubi_assert(pnum >= 0 &&  pnum < ubi->peb_count);
-
-	p = (char *)vid_hdr - ubi->vid_hdr_shift;
-	err = ubi_io_read(ubi, p, pnum, ubi->vid_hdr_aloffset,
-			  ubi->vid_hdr_alsize);
-	if (err) {
-		if (err != UBI_IO_BITFLIPS && err != -EBADMSG)
-			return err;
-
-		/*
-		 * We read all the data, but either a correctable bit-flip
-		 * occurred, or MTD reported about some data integrity error,
-		 * like an ECC error in case of NAND. The former is harmless,
-		 * the later may mean the read data is corrupted. But we have a
-		 * CRC check-sum and we will identify this. If the VID header is
-		 * still OK, we just report this as there was a bit-flip.
-		 */
-		read_err = err;
-	}
 
 	magic = be32_to_cpu(vid_hdr->magic);
 	if (magic != UBI_VID_HDR_MAGIC) {
@@ -1056,6 +1309,100 @@ int ubi_io_read_vid_hdr(struct ubi_device *ubi, int pnum,
 	return read_err ? UBI_IO_BITFLIPS : 0;
 }
 
+/**
+ * ubi_io_read_vid_hdr - read and check a volume identifier header.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock number to read from
+ * @vid_hdr: &struct ubi_vid_hdr object where to store the read volume
+ * identifier header
+ * @verbose: be verbose if the header is corrupted or wasn't found
+ *
+ * This function reads the volume identifier header from physical eraseblock
+ * @pnum and stores it in @vid_hdr. It also checks CRC checksum of the read
+ * volume identifier header. The following codes may be returned:
+ *
+ * o %0 if the CRC checksum is correct and the header was successfully read;
+ * o %UBI_IO_BITFLIPS if the CRC is correct, but bit-flips were detected
+ *   and corrected by the flash driver; this is harmless but may indicate that
+ *   this eraseblock may become bad soon;
+ * o %UBI_IO_BAD_VID_HDR if the volume identifier header is corrupted (a CRC
+ *   error detected);
+ * o %UBI_IO_PEB_FREE if the physical eraseblock is free (i.e., there is no VID
+ *   header there);
+ * o a negative error code in case of failure.
+ */
+int ubi_io_read_vid_hdr(struct ubi_device *ubi, int pnum,
+			struct ubi_vid_hdr *vid_hdr, int verbose)
+{
+	int err;
+	void *p;
+
+	dbg_io("read VID header from PEB %d", pnum);
+	ubi_assert(pnum >= 0 &&  pnum < ubi->peb_count);
+
+	p = (char *)vid_hdr - ubi->vid_hdr_shift;
+	err = ubi_io_read(ubi, p, pnum, ubi->vid_hdr_aloffset,
+			  ubi->vid_hdr_alsize);
+	if (err && err != UBI_IO_BITFLIPS && err != -EBADMSG)
+		return err;
+
+	return check_vid_hdr(ubi, pnum, vid_hdr, verbose, err);
+}
+
+/**
+ * ubi_io_read_hdrs - read and check both headers of a physical eraseblock.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock number to read from
+ * @ec_hdr: &struct ubi_ec_hdr object where to store the erase counter header
+ * @vid_hdr: &struct ubi_vid_hdr object where to store the volume identifier
+ * header
+ * @vid_err: the result of checking the volume identifier header is returned
+ * here
+ *
+ * This is what scanning does for every physical eraseblock. If the VID header
+ * directly follows the EC header, which is the default, both are read by one
+ * flash read rather than two. That halves the number of transactions on SPI
+ * flashes, where the command and address overhead of a read is comparable to
+ * reading the headers. For that, @ec_hdr has to be at the beginning of a
+ * buffer of @ubi->vid_hdr_aloffset + @ubi->vid_hdr_alsize bytes, and @vid_hdr
+ * at @ubi->vid_hdr_aloffset + @ubi->vid_hdr_shift bytes into it.
+ *
+ * Returns the same codes as 'ubi_io_read_ec_hdr()'. @vid_err is set as
+ * 'ubi_io_read_vid_hdr()' would return, unless the physical eraseblock is
+ * empty or a negative error code is returned.
+ */
+int ubi_io_read_hdrs(struct ubi_device *ubi, int pnum,
+		     struct ubi_ec_hdr *ec_hdr, struct ubi_vid_hdr *vid_hdr,
+		     int *vid_err)
+{
+	int err, read_err;
+
+	if (ubi->vid_hdr_aloffset != ubi->ec_hdr_alsize) {
+		err = ubi_io_read_ec_hdr(ubi, pnum, ec_hdr, 0);
+		if (err < 0 || err == UBI_IO_PEB_EMPTY)
+			return err;
+		*vid_err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		return err;
+	}
+
+	dbg_io("read EC and VID headers from PEB %d", pnum);
+	ubi_assert(pnum >= 0 && pnum < ubi->peb_count);
+	ubi_assert((char *)vid_hdr - ubi->vid_hdr_shift ==
+		   (char *)ec_hdr + ubi->vid_hdr_aloffset);
+
+	read_err = ubi_io_read(ubi, ec_hdr, pnum, 0,
+			       ubi->vid_hdr_aloffset + ubi->vid_hdr_alsize);
+	if (read_err && read_err != UBI_IO_BITFLIPS && read_err != -EBADMSG)
+		return read_err;
+
+	err = check_ec_hdr(ubi, pnum, ec_hdr, 0, read_err);
+	if (err < 0 || err == UBI_IO_PEB_EMPTY)
+		return err;
+
+	*vid_err = check_vid_hdr(ubi, pnum, vid_hdr, 0, read_err);
+	return err;
+}
+
 /**
  * ubi_io_write_vid_hdr - write a volume identifier header.
  * @ubi: UBI device description object
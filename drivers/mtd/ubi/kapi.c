@@ -699,23 +699,26 @@ EXPORT_SYMBOL_GPL(ubi_is_mapped);
  * ubi_sync - synchronize UBI device buffers.
  * @ubi_num: UBI device to synchronize
  *
- * The underlying MTD device may cache data in hardware or in software. This
- * function ensures the caches are flushed. Returns zero in case of success and
- * a negative error code in case of failure.
+ * The underlying MTD device may cache data in hardware or in software, and UBI
+ * itself may hold data in the write-combining buffer. This function ensures
+ * the caches are flushed. Returns zero in case of success and a negative error
+ * code in case of failure.
  */
 int ubi_sync(int ubi_num)
 {
+	int err;
 	struct ubi_device *ubi;
 
 	ubi = ubi_get_device(ubi_num);
 	if (!ubi)
 		return -ENODEV;
 
-	if (ubi->mtd->sync)
+	err = ubi_io_comb_flush(ubi, -1);
+	if (!err && ubi->mtd->sync)
 		ubi->mtd->sync(ubi->mtd);
 
 	ubi_put_device(ubi);
-	return 0;
+	return err;
 }
 EXPORT_SYMBOL_GPL(ubi_sync);
 
@@ -56,7 +56,7 @@ static struct ubi_ec_hdr *ech;
 static struct ubi_vid_hdr *vidh;
 
 /**
- * add_to_list - add physical eraseblock to a list.
+ * ubi_scan_add_to_list - add physical eraseblock to a list.
  * @si: scanning information
  * @pnum: physical eraseblock number to add
  * @ec: erase counter of the physical eraseblock
@@ -66,8 +66,8 @@ static struct ubi_vid_hdr *vidh;
  * alien lists. Returns zero in case of success and a negative error code in
  * case of failure.
  */
-static int add_to_list(struct ubi_scan_info *si, int pnum, int ec,
-		       struct list_head *list)
+int ubi_scan_add_to_list(struct ubi_scan_info *si, int pnum, int ec,
+			 struct list_head *list)
 {
 	struct ubi_scan_leb *seb;
 
@@ -459,11 +459,11 @@ int ubi_scan_add_used(struct ubi_device *ubi, struct ubi_scan_info *si,
 				return err;
 
 			if (cmp_res & 4)
-				err = add_to_list(si, seb->pnum, seb->ec,
-						  &si->corr);
+				err = ubi_scan_add_to_list(si, seb->pnum,
+							   seb->ec, &si->corr);
 			else
-				err = add_to_list(si, seb->pnum, seb->ec,
-						  &si->erase);
+				err = ubi_scan_add_to_list(si, seb->pnum,
+							   seb->ec, &si->erase);
 			if (err)
 				return err;
 
@@ -483,9 +483,11 @@ int ubi_scan_add_used(struct ubi_device *ubi, struct ubi_scan_info *si,
 			 * previously.
 			 */
 			if (cmp_res & 4)
-				return add_to_list(si, pnum, ec, &si->corr);
+				return ubi_scan_add_to_list(si, pnum, ec,
+							    &si->corr);
 			else
-				return add_to_list(si, pnum, ec, &si->erase);
+				return ubi_scan_add_to_list(si, pnum, ec,
+							    &si->erase);
 		}
 	}
 
@@ -719,7 +721,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		      int pnum)
 {
 	long long uninitialized_var(ec);
-	int err, bitflips = 0, vol_id, ec_corr = 0;
+	int err, uninitialized_var(vid_err), bitflips = 0, vol_id, ec_corr = 0;
 
 	dbg_bld("scan PEB %d", pnum);
 
@@ -737,13 +739,14 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		return 0;
 	}
 
-	err = ubi_io_read_ec_hdr(ubi, pnum, ech, 0);
+	err = ubi_io_read_hdrs(ubi, pnum, ech, vidh, &vid_err);
 	if (err < 0)
 		return err;
 	else if (err == UBI_IO_BITFLIPS)
 		bitflips = 1;
 	else if (err == UBI_IO_PEB_EMPTY)
-		return add_to_list(si, pnum, UBI_SCAN_UNKNOWN_EC, &si->erase);
+		return ubi_scan_add_to_list(si, pnum, UBI_SCAN_UNKNOWN_EC,
+					    &si->erase);
 	else if (err == UBI_IO_BAD_EC_HDR) {
 		/*
 		 * We have to also look at the VID header, possibly it is not
@@ -807,7 +810,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 
 	/* OK, we've done with the EC header, let's look at the VID header */
 
-	err = ubi_io_read_vid_hdr(ubi, pnum, vidh, 0);
+	err = vid_err;
 	if (err < 0)
 		return err;
 	else if (err == UBI_IO_BITFLIPS)
@@ -815,19 +818,31 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 	else if (err == UBI_IO_BAD_VID_HDR ||
 		 (err == UBI_IO_PEB_FREE && ec_corr)) {
 		/* VID header is corrupted */
-		err = add_to_list(si, pnum, ec, &si->corr);
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->corr);
 		if (err)
 			return err;
 		goto adjust_mean_ec;
 	} else if (err == UBI_IO_PEB_FREE) {
 		/* No VID header - the physical eraseblock is free */
-		err = add_to_list(si, pnum, ec, &si->free);
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->free);
 		if (err)
 			return err;
 		goto adjust_mean_ec;
 	}
 
 	vol_id = be32_to_cpu(vidh->vol_id);
+	if (vol_id == UBI_SNAPSHOT_VOLUME_ID) {
+		/*
+		 * An attach snapshot which was not used (otherwise we would
+		 * not be scanning). It is stale by now, so just erase it.
+		 */
+		dbg_bld("stale snapshot in PEB %d", pnum);
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->erase);
+		if (err)
+			return err;
+		goto adjust_mean_ec;
+	}
+
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
 		int lnum = be32_to_cpu(vidh->lnum);
 
@@ -836,7 +851,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		case UBI_COMPAT_DELETE:
 			ubi_msg("\"delete\" compatible internal volume %d:%d"
 				" found, remove it", vol_id, lnum);
-			err = add_to_list(si, pnum, ec, &si->corr);
+			err = ubi_scan_add_to_list(si, pnum, ec, &si->corr);
 			if (err)
 				return err;
 			break;
@@ -851,7 +866,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		case UBI_COMPAT_PRESERVE:
 			ubi_msg("\"preserve\" compatible internal volume %d:%d"
 				" found", vol_id, lnum);
-			err = add_to_list(si, pnum, ec, &si->alien);
+			err = ubi_scan_add_to_list(si, pnum, ec, &si->alien);
 			if (err)
 				return err;
 			si->alien_peb_count += 1;
@@ -884,6 +899,29 @@ adjust_mean_ec:
 	return 0;
 }
 
+/**
+ * ubi_scan_alloc_si - allocate empty scanning information.
+ *
+ * This function returns the new scanning information object in case of
+ * success and %NULL if there is no memory.
+ */
+struct ubi_scan_info *ubi_scan_alloc_si(void)
+{
+	struct ubi_scan_info *si;
+
+	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
+	if (!si)
+		return NULL;
+
+	INIT_LIST_HEAD(&si->corr);
+	INIT_LIST_HEAD(&si->free);
+	INIT_LIST_HEAD(&si->erase);
+	INIT_LIST_HEAD(&si->alien);
+	si->volumes = RB_ROOT;
+	si->is_empty = 1;
+	return si;
+}
+
 /**
  * ubi_scan - scan an MTD device.
  * @ubi: UBI device description object
@@ -899,25 +937,19 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	struct ubi_scan_leb *seb;
 	struct ubi_scan_info *si;
 
-	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
+	si = ubi_scan_alloc_si();
 	if (!si)
 		return ERR_PTR(-ENOMEM);
 
-	INIT_LIST_HEAD(&si->corr);
-	INIT_LIST_HEAD(&si->free);
-	INIT_LIST_HEAD(&si->erase);
-	INIT_LIST_HEAD(&si->alien);
-	si->volumes = RB_ROOT;
-	si->is_empty = 1;
-
+	/*
+	 * Both headers go to one buffer laid out like the beginning of a
+	 * PEB, so that 'ubi_io_read_hdrs()' may read them at once.
+	 */
 	err = -ENOMEM;
-	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	ech = kzalloc(ubi->vid_hdr_aloffset + ubi->vid_hdr_alsize, GFP_KERNEL);
 	if (!ech)
 		goto out_si;
-
-	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
-	if (!vidh)
-		goto out_ech;
+	vidh = (void *)ech + ubi->vid_hdr_aloffset + ubi->vid_hdr_shift;
 
 	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
 		cond_resched();
@@ -925,7 +957,7 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 		dbg_gen("process PEB %d", pnum);
 		err = process_eb(ubi, si, pnum);
 		if (err < 0)
-			goto out_vidh;
+			goto out_ech;
 	}
 
 	dbg_msg("scanning is finished");
@@ -977,16 +1009,13 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	if (err) {
 		if (err > 0)
 			err = -EINVAL;
-		goto out_vidh;
+		goto out_ech;
 	}
 
-	ubi_free_vid_hdr(ubi, vidh);
 	kfree(ech);
 
 	return si;
 
-out_vidh:
-	ubi_free_vid_hdr(ubi, vidh);
 out_ech:
 	kfree(ech);
 out_si:
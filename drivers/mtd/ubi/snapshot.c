@@ -0,0 +1,608 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI attach snapshot.
+ *
+ * Scanning reads the EC and VID headers of every physical eraseblock, which
+ * dominates the attach time on slow SPI NOR flashes. To avoid it, the
+ * scanning information (the EBA tables, the erase counters and the free
+ * physical eraseblocks) is written to a free physical eraseblock on clean
+ * detach, and the next attach builds the scanning information from it.
+ *
+ * The snapshot is the only logical eraseblock of the internal snapshot volume
+ * (%UBI_SNAPSHOT_VOLUME_ID). It is written to the lowest numbered free
+ * physical eraseblock, so attach only has to look at a few VID headers to
+ * find it. The format is described in ubi-media.h.
+ *
+ * The snapshot only describes the flash while nothing is written to it, so
+ * it is written only when no volume is open for writing, and the device is
+ * switched to read-only mode afterwards. It is used once: attach marks it
+ * invalid before trusting it, and the physical eraseblock is then erased like
+ * any other. If the snapshot is missing, corrupted, or does not match the
+ * device, attach falls back to scanning, which erases stale snapshots.
+ */
+
+#include <linux/crc32.h>
+#include <linux/err.h>
+#include <linux/math64.h>
+#include <linux/vmalloc.h>
+#include "ubi.h"
+
+/**
+ * snap_size - calculate snapshot size.
+ * @ubi: UBI device description object
+ * @vol_count: number of volume records
+ *
+ * This function returns the snapshot data size without alignment.
+ */
+static int snap_size(const struct ubi_device *ubi, int vol_count)
+{
+	return sizeof(struct ubi_snap_hdr) +
+	       vol_count * sizeof(struct ubi_snap_vol) +
+	       ubi->peb_count * sizeof(struct ubi_snap_peb);
+}
+
+/**
+ * find_snapshot - find the snapshot physical eraseblock.
+ * @ubi: UBI device description object
+ * @vid_hdr: the VID header of the snapshot is returned here
+ *
+ * This function returns the physical eraseblock number of the snapshot, or
+ * %-ENOENT if there is none.
+ */
+static int find_snapshot(struct ubi_device *ubi, struct ubi_vid_hdr *vid_hdr)
+{
+	int err, pnum;
+
+	for (pnum = 0; pnum < ubi->peb_count && pnum < UBI_SNAP_MAX_PNUM;
+	     pnum++) {
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		if (err)
+			continue;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		if (err < 0)
+			return err;
+		if (err)
+			continue;
+
+		if (be32_to_cpu(vid_hdr->vol_id) == UBI_SNAPSHOT_VOLUME_ID)
+			return pnum;
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * check_snapshot - check snapshot data.
+ * @ubi: UBI device description object
+ * @buf: snapshot data
+ * @len: snapshot data length
+ * @vid_hdr: VID header of the snapshot
+ * @image_seq: image sequence number of the snapshot physical eraseblock
+ *
+ * This function returns zero if the snapshot describes this device and %1 if
+ * not.
+ */
+static int check_snapshot(const struct ubi_device *ubi, const void *buf,
+			  int len, const struct ubi_vid_hdr *vid_hdr,
+			  int image_seq)
+{
+	const struct ubi_snap_hdr *hdr = buf;
+	int vol_count;
+
+	if (len < sizeof(struct ubi_snap_hdr) ||
+	    be32_to_cpu(hdr->magic) != UBI_SNAP_HDR_MAGIC ||
+	    hdr->version != UBI_SNAP_VERSION) {
+		dbg_bld("bad snapshot header");
+		return 1;
+	}
+
+	if (be32_to_cpu(hdr->peb_count) != ubi->peb_count ||
+	    be32_to_cpu(hdr->vid_hdr_offset) != ubi->vid_hdr_offset ||
+	    be32_to_cpu(hdr->data_offset) != ubi->leb_start ||
+	    be32_to_cpu(hdr->image_seq) != image_seq) {
+		dbg_bld("snapshot is for another device");
+		return 1;
+	}
+
+	vol_count = be32_to_cpu(hdr->vol_count);
+	if (vol_count < 0 || vol_count > UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT ||
+	    snap_size(ubi, vol_count) != len) {
+		dbg_bld("bad snapshot size");
+		return 1;
+	}
+
+	if (be64_to_cpu(hdr->sqnum) != be64_to_cpu(vid_hdr->sqnum)) {
+		dbg_bld("bad snapshot sequence number");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * build_si - build scanning information from a snapshot.
+ * @ubi: UBI device description object
+ * @buf: snapshot data
+ * @pnum: physical eraseblock containing the snapshot
+ * @vid_hdr: a VID header buffer to use
+ *
+ * This function returns the scanning information in case of success, %NULL
+ * if the snapshot is inconsistent, and an error pointer in case of failure.
+ */
+static struct ubi_scan_info *build_si(struct ubi_device *ubi, const void *buf,
+				      int pnum, struct ubi_vid_hdr *vid_hdr)
+{
+	const struct ubi_snap_hdr *hdr = buf;
+	const struct ubi_snap_vol *vols = (const void *)(hdr + 1);
+	const struct ubi_snap_peb *pebs;
+	struct ubi_scan_info *si;
+	int err, i, vol_count = be32_to_cpu(hdr->vol_count);
+
+	pebs = (const void *)(vols + vol_count);
+
+	si = ubi_scan_alloc_si();
+	if (!si)
+		return ERR_PTR(-ENOMEM);
+
+	si->is_empty = 0;
+	si->min_ec = UBI_MAX_ERASECOUNTER;
+
+	for (i = 0; i < ubi->peb_count; i++) {
+		const struct ubi_snap_vol *sv = NULL;
+		int ec = be32_to_cpu(pebs[i].ec);
+		int vol_id = be32_to_cpu(pebs[i].vol_id);
+		int lnum = be32_to_cpu(pebs[i].lnum);
+		int j, used_ebs, data_size;
+
+		err = ubi_io_is_bad(ubi, i);
+		if (err < 0)
+			goto out_si;
+		if (!!err != (vol_id == UBI_SNAP_PEB_BAD)) {
+			dbg_bld("PEB %d bad state differs from snapshot", i);
+			goto out_stale;
+		}
+		if (err) {
+			si->bad_peb_count += 1;
+			continue;
+		}
+
+		if (ec < 0 || ec > UBI_MAX_ERASECOUNTER)
+			goto out_stale;
+
+		switch (vol_id) {
+		case UBI_SNAP_PEB_FREE:
+			err = ubi_scan_add_to_list(si, i, ec, &si->free);
+			break;
+
+		case UBI_SNAP_PEB_SELF:
+			if (i != pnum)
+				goto out_stale;
+			err = ubi_scan_add_to_list(si, i, ec, &si->erase);
+			break;
+
+		default:
+			for (j = 0; j < vol_count; j++) {
+				if (be32_to_cpu(vols[j].vol_id) == vol_id) {
+					sv = &vols[j];
+					break;
+				}
+			}
+			if (!sv || lnum < 0)
+				goto out_stale;
+
+			/*
+			 * Make up the VID header the physical eraseblock has.
+			 * Sequence numbers only matter if there are several
+			 * copies of a logical eraseblock, which a snapshot
+			 * never has.
+			 */
+			used_ebs = be32_to_cpu(sv->used_ebs);
+			data_size = 0;
+			if (sv->vol_type == UBI_VID_STATIC) {
+				if (lnum >= used_ebs)
+					goto out_stale;
+				data_size = be32_to_cpu(sv->last_data_size);
+				if (lnum < used_ebs - 1)
+					data_size = ubi->leb_size -
+						    be32_to_cpu(sv->data_pad);
+			}
+
+			memset(vid_hdr, 0, UBI_VID_HDR_SIZE);
+			vid_hdr->vol_type = sv->vol_type;
+			if (vol_id == UBI_LAYOUT_VOLUME_ID)
+				vid_hdr->compat = UBI_LAYOUT_VOLUME_COMPAT;
+			vid_hdr->vol_id = sv->vol_id;
+			vid_hdr->lnum = cpu_to_be32(lnum);
+			vid_hdr->data_size = cpu_to_be32(data_size);
+			vid_hdr->used_ebs = sv->used_ebs;
+			vid_hdr->data_pad = sv->data_pad;
+
+			err = ubi_scan_add_used(ubi, si, i, ec, vid_hdr, 0);
+			break;
+		}
+		if (err)
+			goto out_si;
+
+		si->ec_sum += ec;
+		si->ec_count += 1;
+		if (ec > si->max_ec)
+			si->max_ec = ec;
+		if (ec < si->min_ec)
+			si->min_ec = ec;
+	}
+
+	if (si->ec_count)
+		si->mean_ec = div_u64(si->ec_sum, si->ec_count);
+	si->max_sqnum = be64_to_cpu(hdr->sqnum);
+
+	return si;
+
+out_stale:
+	ubi_scan_destroy_si(si);
+	return NULL;
+
+out_si:
+	ubi_scan_destroy_si(si);
+	return ERR_PTR(err);
+}
+
+/**
+ * ubi_snapshot_scan - build scanning information from the attach snapshot.
+ * @ubi: UBI device description object
+ *
+ * This function looks for a valid attach snapshot, invalidates it and builds
+ * scanning information from it. Returns the scanning information in case of
+ * success and %NULL if there is no usable snapshot, in which case the device
+ * has to be scanned.
+ */
+struct ubi_scan_info *ubi_snapshot_scan(struct ubi_device *ubi)
+{
+	int err, pnum, len, size, i;
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_ec_hdr *ec_hdr;
+	struct ubi_scan_info *si = NULL;
+	uint32_t crc;
+	void *buf;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		return NULL;
+
+	ec_hdr = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ec_hdr)
+		goto out_vid_hdr;
+
+	pnum = find_snapshot(ubi, vid_hdr);
+	if (pnum < 0)
+		goto out_ec_hdr;
+
+	err = ubi_io_read_ec_hdr(ubi, pnum, ec_hdr, 0);
+	if (err)
+		goto out_ec_hdr;
+
+	if (vid_hdr->vol_type != UBI_SNAPSHOT_VOLUME_TYPE)
+		goto out_ec_hdr;
+
+	/*
+	 * The length comes from the flash, check it before it is used for
+	 * anything: the snapshot and the min. I/O unit which invalidates it
+	 * have to fit in the LEB.
+	 */
+	len = be32_to_cpu(vid_hdr->data_size);
+	if (len < (int)sizeof(struct ubi_snap_hdr) ||
+	    len > ubi->leb_size - ubi->min_io_size) {
+		dbg_bld("bad snapshot length %d", len);
+		goto out_ec_hdr;
+	}
+
+	size = ALIGN(len, ubi->min_io_size);
+	if (size + ubi->min_io_size > ubi->leb_size)
+		goto out_ec_hdr;
+
+	buf = vmalloc(size + ubi->min_io_size);
+	if (!buf)
+		goto out_ec_hdr;
+
+	err = ubi_io_read_data(ubi, buf, pnum, 0, size + ubi->min_io_size);
+	if (err)
+		goto out_buf;
+
+	crc = crc32(UBI_CRC32_INIT, buf, len);
+	if (crc != be32_to_cpu(vid_hdr->data_crc)) {
+		dbg_bld("bad snapshot CRC %#08x", crc);
+		goto out_buf;
+	}
+
+	for (i = 0; i < ubi->min_io_size; i++) {
+		if (((uint8_t *)buf)[size + i] != 0xFF) {
+			dbg_bld("snapshot in PEB %d was already used", pnum);
+			goto out_buf;
+		}
+	}
+
+	if (check_snapshot(ubi, buf, len, vid_hdr,
+			   be32_to_cpu(ec_hdr->image_seq)))
+		goto out_buf;
+
+	/*
+	 * Invalidate the snapshot before anything is written to the flash.
+	 * If the device is read-only nothing is written, so the snapshot stays
+	 * valid.
+	 */
+	if (!ubi->ro_mode) {
+		memset(buf + size, 0, ubi->min_io_size);
+		err = ubi_io_write_data(ubi, buf + size, pnum, size,
+					ubi->min_io_size);
+		if (err)
+			goto out_buf;
+	}
+
+	si = build_si(ubi, buf, pnum, vid_hdr);
+	if (IS_ERR(si))
+		si = NULL;
+	if (!si) {
+		ubi_warn("inconsistent snapshot in PEB %d", pnum);
+		goto out_buf;
+	}
+
+	ubi->image_seq = be32_to_cpu(ec_hdr->image_seq);
+	ubi_msg("attach snapshot found in PEB %d", pnum);
+
+out_buf:
+	vfree(buf);
+out_ec_hdr:
+	kfree(ec_hdr);
+out_vid_hdr:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return si;
+}
+
+/**
+ * volumes_busy - check if any volume is open for writing.
+ * @ubi: UBI device description object
+ *
+ * This function has to be called with @ubi->volumes_lock held.
+ */
+static int volumes_busy(const struct ubi_device *ubi)
+{
+	int i;
+
+	for (i = 0; i < ubi->vtbl_slots; i++) {
+		struct ubi_volume *vol = ubi->volumes[i];
+
+		if (vol && (vol->writers || vol->exclusive))
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * fill_snapshot - fill in the snapshot records.
+ * @ubi: UBI device description object
+ * @vols: volume records
+ * @pebs: physical eraseblock records
+ *
+ * This function returns zero in case of success, %1 if the state of some
+ * physical eraseblock cannot be described, and a negative error code in
+ * case of failure.
+ */
+static int fill_snapshot(struct ubi_device *ubi, struct ubi_snap_vol *vols,
+			 struct ubi_snap_peb *pebs)
+{
+	int i, lnum, pnum, ec, err;
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		pebs[pnum].vol_id = cpu_to_be32(UBI_SNAP_PEB_FREE);
+		pebs[pnum].lnum = 0;
+	}
+
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		struct ubi_volume *vol = ubi->volumes[i];
+
+		if (!vol)
+			continue;
+
+		memset(vols, 0, sizeof(struct ubi_snap_vol));
+		vols->vol_id = cpu_to_be32(vol->vol_id);
+		vols->data_pad = cpu_to_be32(vol->data_pad);
+		if (vol->vol_type == UBI_STATIC_VOLUME) {
+			vols->vol_type = UBI_VID_STATIC;
+			vols->used_ebs = cpu_to_be32(vol->used_ebs);
+			vols->last_data_size = cpu_to_be32(vol->last_eb_bytes);
+		} else
+			vols->vol_type = UBI_VID_DYNAMIC;
+		vols += 1;
+
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			pnum = vol->eba_tbl[lnum];
+			if (pnum < 0)
+				continue;
+			pebs[pnum].vol_id = cpu_to_be32(vol->vol_id);
+			pebs[pnum].lnum = cpu_to_be32(lnum);
+		}
+	}
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		int used = be32_to_cpu(pebs[pnum].vol_id) != UBI_SNAP_PEB_FREE;
+
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		if (err) {
+			if (used)
+				return 1;
+			pebs[pnum].ec = 0;
+			pebs[pnum].vol_id = cpu_to_be32(UBI_SNAP_PEB_BAD);
+			continue;
+		}
+
+		/*
+		 * Everything else has to be either mapped or free. Erroneous
+		 * physical eraseblocks and those still waiting for something
+		 * cannot be described.
+		 */
+		err = ubi_wl_peb_info(ubi, pnum, &ec);
+		if (err < 0 || err == used) {
+			dbg_msg("cannot describe PEB %d", pnum);
+			return 1;
+		}
+		pebs[pnum].ec = cpu_to_be32(ec);
+	}
+
+	return 0;
+}
+
+/**
+ * ubi_snapshot_write - write the attach snapshot.
+ * @ubi: UBI device description object
+ *
+ * This function writes the attach snapshot and switches the device to
+ * read-only mode, so that it stays valid. It has to be called on detach,
+ * after the background thread has been stopped. Nothing is written if a
+ * volume is open for writing. Returns zero in case of success or if no
+ * snapshot was written, and a negative error code in case of failure.
+ */
+int ubi_snapshot_write(struct ubi_device *ubi)
+{
+	int err, i, pnum, len, size, busy, vol_count = 0;
+	struct ubi_snap_hdr *hdr;
+	struct ubi_snap_vol *vols;
+	struct ubi_snap_peb *pebs;
+	struct ubi_vid_hdr *vid_hdr;
+	unsigned long long sqnum;
+	void *buf;
+
+	if (ubi->ro_mode)
+		return 0;
+
+	mutex_lock(&ubi->device_mutex);
+	spin_lock(&ubi->volumes_lock);
+	busy = volumes_busy(ubi);
+	spin_unlock(&ubi->volumes_lock);
+	if (busy) {
+		dbg_msg("volumes are open for writing, no snapshot");
+		err = 0;
+		goto out_unlock;
+	}
+
+	err = ubi_wl_flush(ubi);
+	if (err)
+		goto out_unlock;
+
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++)
+		if (ubi->volumes[i])
+			vol_count += 1;
+
+	len = snap_size(ubi, vol_count);
+	size = ALIGN(len, ubi->min_io_size);
+	if (size + ubi->min_io_size > ubi->leb_size) {
+		dbg_msg("snapshot of %d bytes does not fit", len);
+		goto out_unlock;
+	}
+
+	err = -ENOMEM;
+	buf = vmalloc(size);
+	if (!buf)
+		goto out_unlock;
+	memset(buf, 0xFF, size);
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		goto out_buf;
+
+	hdr = buf;
+	vols = (void *)(hdr + 1);
+	pebs = (void *)(vols + vol_count);
+
+	err = fill_snapshot(ubi, vols, pebs);
+	if (err) {
+		if (err > 0)
+			err = 0;
+		goto out_vid_hdr;
+	}
+
+	pnum = ubi_wl_get_low_peb(ubi, min(ubi->peb_count, UBI_SNAP_MAX_PNUM));
+	if (pnum < 0) {
+		dbg_msg("no free PEB for the snapshot");
+		err = 0;
+		goto out_vid_hdr;
+	}
+	pebs[pnum].vol_id = cpu_to_be32(UBI_SNAP_PEB_SELF);
+
+	spin_lock(&ubi->ltree_lock);
+	sqnum = ubi->global_sqnum++;
+	spin_unlock(&ubi->ltree_lock);
+
+	memset(hdr, 0, sizeof(struct ubi_snap_hdr));
+	hdr->magic = cpu_to_be32(UBI_SNAP_HDR_MAGIC);
+	hdr->version = UBI_SNAP_VERSION;
+	hdr->peb_count = cpu_to_be32(ubi->peb_count);
+	hdr->vid_hdr_offset = cpu_to_be32(ubi->vid_hdr_offset);
+	hdr->data_offset = cpu_to_be32(ubi->leb_start);
+	hdr->image_seq = cpu_to_be32(ubi->image_seq);
+	hdr->vol_count = cpu_to_be32(vol_count);
+	hdr->sqnum = cpu_to_be64(sqnum);
+
+	vid_hdr->vol_type = UBI_SNAPSHOT_VOLUME_TYPE;
+	vid_hdr->compat = UBI_SNAPSHOT_VOLUME_COMPAT;
+	vid_hdr->vol_id = cpu_to_be32(UBI_SNAPSHOT_VOLUME_ID);
+	vid_hdr->lnum = 0;
+	vid_hdr->data_size = cpu_to_be32(len);
+	vid_hdr->used_ebs = cpu_to_be32(1);
+	vid_hdr->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, buf, len));
+	vid_hdr->sqnum = cpu_to_be64(sqnum);
+
+	err = ubi_io_write_vid_hdr(ubi, pnum, vid_hdr);
+	if (!err)
+		err = ubi_io_write_data(ubi, buf, pnum, 0, size);
+	if (err) {
+		ubi_warn("failed to write snapshot to PEB %d", pnum);
+		ubi_wl_put_peb(ubi, pnum, 1);
+		goto out_vid_hdr;
+	}
+
+	/*
+	 * Freeze the device. If somebody opened a volume for writing in the
+	 * meantime, the snapshot may already be stale, so invalidate it and
+	 * let them write.
+	 */
+	spin_lock(&ubi->volumes_lock);
+	busy = volumes_busy(ubi);
+	if (!busy)
+		ubi->ro_mode = 1;
+	spin_unlock(&ubi->volumes_lock);
+
+	if (busy) {
+		memset(buf, 0, ubi->min_io_size);
+		err = ubi_io_write_data(ubi, buf, pnum, size, ubi->min_io_size);
+		ubi_wl_put_peb(ubi, pnum, 0);
+	} else
+		ubi_msg("attach snapshot written to PEB %d", pnum);
+
+out_vid_hdr:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+out_buf:
+	vfree(buf);
+out_unlock:
+	mutex_unlock(&ubi->device_mutex);
+	return err;
+}
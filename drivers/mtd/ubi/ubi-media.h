@@ -45,6 +45,8 @@
 #define UBI_EC_HDR_MAGIC  0x55424923
 /* Volume identifier header magic number (ASCII "UBI!") */
 #define UBI_VID_HDR_MAGIC 0x55424921
+/* Snapshot header magic number (ASCII "UBIS") */
+#define UBI_SNAP_HDR_MAGIC 0x55424953
 
 /*
  * Volume type constants used in the volume identifier header.
@@ -312,6 +314,16 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
+/*
+ * The snapshot volume contains a copy of the scanning information written on
+ * clean detach. It is not counted in %UBI_INT_VOL_COUNT as it never exists
+ * after attach, and it is "delete" compatible, so UBI implementations which
+ * do not know it just erase it.
+ */
+#define UBI_SNAPSHOT_VOLUME_ID     (UBI_INTERNAL_VOL_START + 1)
+#define UBI_SNAPSHOT_VOLUME_TYPE   UBI_VID_STATIC
+#define UBI_SNAPSHOT_VOLUME_COMPAT UBI_COMPAT_DELETE
+
 /* The maximum number of volumes per one UBI device */
 #define UBI_MAX_VOLUMES 128
 
@@ -375,4 +387,94 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __attribute__ ((packed));
 
+/* The snapshot format version */
+#define UBI_SNAP_VERSION 1
+
+/* The snapshot is only looked for in the first physical eraseblocks */
+#define UBI_SNAP_MAX_PNUM 64
+
+/*
+ * Special @vol_id values of &struct ubi_snap_peb.
+ *
+ * @UBI_SNAP_PEB_FREE: the physical eraseblock is free
+ * @UBI_SNAP_PEB_BAD: the physical eraseblock is bad
+ * @UBI_SNAP_PEB_SELF: the physical eraseblock contains the snapshot
+ */
+enum {
+	UBI_SNAP_PEB_FREE = -1,
+	UBI_SNAP_PEB_BAD  = -2,
+	UBI_SNAP_PEB_SELF = -3
+};
+
+/**
+ * struct ubi_snap_hdr - on-flash UBI attach snapshot header.
+ * @magic: snapshot header magic number (%UBI_SNAP_HDR_MAGIC)
+ * @version: snapshot format version (%UBI_SNAP_VERSION)
+ * @padding1: reserved for future, zeroes
+ * @peb_count: number of physical eraseblocks described by the snapshot
+ * @vid_hdr_offset: where the VID header starts
+ * @data_offset: where the user data start
+ * @image_seq: image sequence number
+ * @vol_count: number of &struct ubi_snap_vol records
+ * @padding2: reserved for future, zeroes
+ * @sqnum: the highest sequence number on the flash when the snapshot was made
+ *
+ * The snapshot is the data of the only logical eraseblock of the snapshot
+ * volume. The header is followed by @vol_count &struct ubi_snap_vol records
+ * and @peb_count &struct ubi_snap_peb records, one per physical eraseblock.
+ * The data CRC of the VID header protects all of it.
+ *
+ * A snapshot is valid for one attach only. The @min_io_size bytes following
+ * the snapshot data (aligned to @min_io_size) are left erased when it is
+ * written and are overwritten with zeroes when the snapshot is used, so that
+ * a later attach falls back to scanning.
+ */
+struct ubi_snap_hdr {
+	__be32  magic;
+	__u8    version;
+	__u8    padding1[3];
+	__be32  peb_count;
+	__be32  vid_hdr_offset;
+	__be32  data_offset;
+	__be32  image_seq;
+	__be32  vol_count;
+	__u8    padding2[4];
+	__be64  sqnum;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_snap_vol - on-flash snapshot record of a volume.
+ * @vol_id: volume ID
+ * @used_ebs: number of used logical eraseblocks (static volumes only)
+ * @data_pad: how many bytes at the end of logical eraseblocks are not used
+ * @last_data_size: bytes of data in the last logical eraseblock (static
+ *                  volumes only)
+ * @vol_type: volume type (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @padding: reserved for future, zeroes
+ *
+ * These are the fields of the VID headers which are the same for all logical
+ * eraseblocks of a volume.
+ */
+struct ubi_snap_vol {
+	__be32  vol_id;
+	__be32  used_ebs;
+	__be32  data_pad;
+	__be32  last_data_size;
+	__u8    vol_type;
+	__u8    padding[3];
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_snap_peb - on-flash snapshot record of a physical eraseblock.
+ * @ec: erase counter
+ * @vol_id: ID of the volume this physical eraseblock belongs to, or one of
+ *          %UBI_SNAP_PEB_FREE, %UBI_SNAP_PEB_BAD, %UBI_SNAP_PEB_SELF
+ * @lnum: logical eraseblock number
+ */
+struct ubi_snap_peb {
+	__be32  ec;
+	__be32  vol_id;
+	__be32  lnum;
+} __attribute__ ((packed));
+
 #endif /* !__UBI_MEDIA_H__ */
@@ -37,6 +37,7 @@
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 #include <linux/notifier.h>
+#include <linux/workqueue.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/ubi.h>
 
@@ -335,7 +336,8 @@ struct ubi_wl_entry;
  * @pq_head: protection queue head
  * @wl_lock: protects the @used, @free, @pq, @pq_head, @lookuptbl, @move_from,
  * 	     @move_to, @move_to_put @erase_pending, @wl_scheduled, @works,
- * 	     @erroneous, and @erroneous_peb_count fields
+ * 	     @erroneous, @erroneous_peb_count, @free_count, @free_low,
+ * 	     @erase_waits and @erase_wait_us fields
  * @move_mutex: serializes eraseblock moves
  * @work_sem: synchronizes the WL worker with use tasks
  * @wl_scheduled: non-zero if the wear-leveling was scheduled
@@ -346,6 +348,12 @@ struct ubi_wl_entry;
  * @move_to_put: if the "to" PEB was put
  * @works: list of pending works
  * @works_count: count of pending works
+ * @free_count: count of physical eraseblocks in the @free tree
+ * @free_low: erasures are done before other works while @free_count is below
+ *            this
+ * @erase_waits: how many times a user had to wait for an erasure to get a
+ *               free physical eraseblock
+ * @erase_wait_us: total time users waited for erasures, in microseconds
  * @bgt_thread: background thread description object
  * @thread_enabled: if the background thread is enabled
  * @bgt_name: background thread name
@@ -376,6 +384,17 @@ struct ubi_wl_entry;
  * @nor_flash: non-zero if working on top of NOR flash
  * @mtd: MTD device descriptor
  *
+ * @comb_size: write-combining buffer size (flash page size), zero if
+ *             write-combining is disabled
+ * @comb_buf: write-combining buffer, holds one page
+ * @comb_pnum: physical eraseblock the buffered data belongs to
+ * @comb_offs: offset of the buffered data within @comb_pnum
+ * @comb_len: how many bytes are buffered
+ * @comb_writes: count of writes passed to the write-combining layer
+ * @comb_raw_writes: count of flash writes the write-combining layer issued
+ * @comb_mutex: protects the write-combining buffer and counters
+ * @comb_work: flushes the write-combining buffer after a delay
+ *
  * @peb_buf1: a buffer of PEB size used for different purposes
  * @peb_buf2: another buffer of PEB size used for different purposes
  * @buf_mutex: protects @peb_buf1 and @peb_buf2
@@ -432,6 +451,10 @@ struct ubi_device {
 	int move_to_put;
 	struct list_head works;
 	int works_count;
+	int free_count;
+	int free_low;
+	unsigned int erase_waits;
+	u64 erase_wait_us;
 	struct task_struct *bgt_thread;
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
@@ -459,6 +482,16 @@ struct ubi_device {
 	unsigned int nor_flash:1;
 	struct mtd_info *mtd;
 
+	int comb_size;
+	void *comb_buf;
+	int comb_pnum;
+	int comb_offs;
+	int comb_len;
+	unsigned int comb_writes;
+	unsigned int comb_raw_writes;
+	struct mutex comb_mutex;
+	struct delayed_work comb_work;
+
 	void *peb_buf1;
 	void *peb_buf2;
 	struct mutex buf_mutex;
@@ -532,12 +565,21 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+#ifdef CONFIG_MTD_UBI_SNAPSHOT
+int ubi_wl_peb_info(struct ubi_device *ubi, int pnum, int *ec);
+int ubi_wl_get_low_peb(struct ubi_device *ubi, int max_pnum);
+#endif
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
 		int len);
 int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
 		 int len);
+int ubi_io_comb_write(struct ubi_device *ubi, const void *buf, int pnum,
+		      int offset, int len);
+int ubi_io_comb_flush(struct ubi_device *ubi, int pnum);
+int ubi_io_comb_init(struct ubi_device *ubi);
+void ubi_io_comb_close(struct ubi_device *ubi);
 int ubi_io_sync_erase(struct ubi_device *ubi, int pnum, int torture);
 int ubi_io_is_bad(const struct ubi_device *ubi, int pnum);
 int ubi_io_mark_bad(const struct ubi_device *ubi, int pnum);
@@ -547,6 +589,9 @@ int ubi_io_write_ec_hdr(struct ubi_device *ubi, int pnum,
 			struct ubi_ec_hdr *ec_hdr);
 int ubi_io_read_vid_hdr(struct ubi_device *ubi, int pnum,
 			struct ubi_vid_hdr *vid_hdr, int verbose);
+int ubi_io_read_hdrs(struct ubi_device *ubi, int pnum,
+		     struct ubi_ec_hdr *ec_hdr, struct ubi_vid_hdr *vid_hdr,
+		     int *vid_err);
 int ubi_io_write_vid_hdr(struct ubi_device *ubi, int pnum,
 			 struct ubi_vid_hdr *vid_hdr);
 
@@ -568,6 +613,21 @@ void ubi_do_get_device_info(struct ubi_device *ubi, struct ubi_device_info *di);
 void ubi_do_get_volume_info(struct ubi_device *ubi, struct ubi_volume *vol,
 			    struct ubi_volume_info *vi);
 
+/* snapshot.c */
+#ifdef CONFIG_MTD_UBI_SNAPSHOT
+struct ubi_scan_info *ubi_snapshot_scan(struct ubi_device *ubi);
+int ubi_snapshot_write(struct ubi_device *ubi);
+#else
+static inline struct ubi_scan_info *ubi_snapshot_scan(struct ubi_device *ubi)
+{
+	return NULL;
+}
+static inline int ubi_snapshot_write(struct ubi_device *ubi)
+{
+	return 0;
+}
+#endif
+
 /*
  * ubi_rb_for_each_entry - walk an RB-tree.
  * @rb: a pointer to type 'struct rb_node' to use as a loop counter
@@ -626,12 +686,18 @@ static inline void ubi_free_vid_hdr(const struct ubi_device *ubi,
 /*
  * This function is equivalent to 'ubi_io_read()', but @offset is relative to
  * the beginning of the logical eraseblock, not to the beginning of the
- * physical eraseblock.
+ * physical eraseblock. Data still in the write-combining buffer for @pnum is
+ * written out first.
  */
-static inline int ubi_io_read_data(const struct ubi_device *ubi, void *buf,
+static inline int ubi_io_read_data(struct ubi_device *ubi, void *buf,
 				   int pnum, int offset, int len)
 {
+	int err;
+
 	ubi_assert(offset >= 0);
+	err = ubi_io_comb_flush(ubi, pnum);
+	if (err)
+		return err;
 	return ubi_io_read(ubi, buf, pnum, offset + ubi->leb_start, len);
 }
 
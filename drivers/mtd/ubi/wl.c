@@ -109,6 +109,7 @@
 #include <linux/crc32.h>
 #include <linux/freezer.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>
 #include "ubi.h"
 
 /* Number of physical eraseblocks reserved for wear-leveling purposes */
@@ -141,6 +142,9 @@
  */
 #define WL_MAX_FAILURES 32
 
+/* Default low watermark of free physical eraseblocks */
+#define WL_FREE_LOW CONFIG_MTD_UBI_WL_FREE_LOW
+
 /**
  * struct ubi_work - UBI work description data structure.
  * @list: a link in the list of pending works
@@ -208,6 +212,32 @@ static void wl_tree_add(struct ubi_wl_entry *e, struct rb_root *root)
 	rb_insert_color(&e->u.rb, root);
 }
 
+static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
+			int cancel);
+
+/**
+ * pick_work - pick the pending work to do next.
+ * @ubi: UBI device description object
+ *
+ * Works are done in the order they were scheduled, except when there are less
+ * than @ubi->free_low free physical eraseblocks. Then erasures go first, so
+ * that users do not have to wait for a free physical eraseblock behind
+ * wear-leveling. This function has to be called with @ubi->wl_lock held and
+ * with works pending.
+ */
+static struct ubi_work *pick_work(struct ubi_device *ubi)
+{
+	struct ubi_work *wrk;
+
+	if (ubi->free_count < ubi->free_low) {
+		list_for_each_entry(wrk, &ubi->works, list)
+			if (wrk->func == &erase_worker)
+				return wrk;
+	}
+
+	return list_entry(ubi->works.next, struct ubi_work, list);
+}
+
 /**
  * do_work - do one pending work.
  * @ubi: UBI device description object
@@ -236,7 +266,7 @@ static int do_work(struct ubi_device *ubi)
 		return 0;
 	}
 
-	wrk = list_entry(ubi->works.next, struct ubi_work, list);
+	wrk = pick_work(ubi);
 	list_del(&wrk->list);
 	ubi->works_count -= 1;
 	ubi_assert(ubi->works_count >= 0);
@@ -386,8 +416,9 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int max)
  */
 int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
 {
-	int err, medium_ec;
+	int err, medium_ec, waited = 0;
 	struct ubi_wl_entry *e, *first, *last;
+	ktime_t uninitialized_var(start);
 
 	ubi_assert(dtype == UBI_LONGTERM || dtype == UBI_SHORTTERM ||
 		   dtype == UBI_UNKNOWN);
@@ -401,6 +432,11 @@ retry:
 			spin_unlock(&ubi->wl_lock);
 			return -ENOSPC;
 		}
+		if (!waited) {
+			ubi->erase_waits += 1;
+			start = ktime_get();
+			waited = 1;
+		}
 		spin_unlock(&ubi->wl_lock);
 
 		err = produce_free_peb(ubi);
@@ -456,8 +492,11 @@ retry:
 	 * be protected from being moved for some time.
 	 */
 	rb_erase(&e->u.rb, &ubi->free);
+	ubi->free_count -= 1;
 	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
 	prot_queue_add(ubi, e);
+	if (waited)
+		ubi->erase_wait_us += ktime_us_delta(ktime_get(), start);
 	spin_unlock(&ubi->wl_lock);
 
 	err = ubi_dbg_check_all_ff(ubi, e->pnum, ubi->vid_hdr_aloffset,
@@ -618,9 +657,6 @@ static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 	spin_unlock(&ubi->wl_lock);
 }
 
-static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
-			int cancel);
-
 /**
  * schedule_erase - schedule an erase work.
  * @ubi: UBI device description object
@@ -728,6 +764,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 
 	paranoid_check_in_wl_tree(e2, &ubi->free);
 	rb_erase(&e2->u.rb, &ubi->free);
+	ubi->free_count -= 1;
 	ubi->move_from = e1;
 	ubi->move_to = e2;
 	spin_unlock(&ubi->wl_lock);
@@ -1021,6 +1058,7 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 
 		spin_lock(&ubi->wl_lock);
 		wl_tree_add(e, &ubi->free);
+		ubi->free_count += 1;
 		spin_unlock(&ubi->wl_lock);
 
 		/*
@@ -1298,6 +1336,69 @@ int ubi_wl_flush(struct ubi_device *ubi)
 	return 0;
 }
 
+#ifdef CONFIG_MTD_UBI_SNAPSHOT
+
+/**
+ * ubi_wl_peb_info - get erase counter and state of a physical eraseblock.
+ * @ubi: UBI device description object
+ * @pnum: the physical eraseblock to look at
+ * @ec: the erase counter is returned here
+ *
+ * This function returns %1 if physical eraseblock @pnum is free, %0 if it is
+ * used, and %-ENOENT if the WL sub-system does not track it.
+ */
+int ubi_wl_peb_info(struct ubi_device *ubi, int pnum, int *ec)
+{
+	int ret;
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	e = ubi->lookuptbl[pnum];
+	if (!e)
+		ret = -ENOENT;
+	else {
+		*ec = e->ec;
+		ret = in_wl_tree(e, &ubi->free);
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	return ret;
+}
+
+/**
+ * ubi_wl_get_low_peb - get the lowest numbered free physical eraseblock.
+ * @ubi: UBI device description object
+ * @max_pnum: the physical eraseblock has to be below this
+ *
+ * Same as 'ubi_wl_get_peb()', but the physical eraseblock is picked by its
+ * number rather than its erase counter, so that it can be found quickly when
+ * attaching. Returns the physical eraseblock number in case of success and
+ * %-ENOSPC if there is no free physical eraseblock below @max_pnum.
+ */
+int ubi_wl_get_low_peb(struct ubi_device *ubi, int max_pnum)
+{
+	int pnum;
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	for (pnum = 0; pnum < max_pnum; pnum++) {
+		e = ubi->lookuptbl[pnum];
+		if (e && in_wl_tree(e, &ubi->free)) {
+			rb_erase(&e->u.rb, &ubi->free);
+			ubi->free_count -= 1;
+			dbg_wl("PEB %d EC %d", e->pnum, e->ec);
+			prot_queue_add(ubi, e);
+			spin_unlock(&ubi->wl_lock);
+			return pnum;
+		}
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	return -ENOSPC;
+}
+
+#endif /* CONFIG_MTD_UBI_SNAPSHOT */
+
 /**
  * tree_destroy - destroy an RB-tree.
  * @root: the root of the tree to destroy
@@ -1425,6 +1526,7 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 	init_rwsem(&ubi->work_sem);
 	ubi->max_ec = si->max_ec;
 	INIT_LIST_HEAD(&ubi->works);
+	ubi->free_low = WL_FREE_LOW;
 
 	sprintf(ubi->bgt_name, UBI_BGT_NAME_PATTERN, ubi->ubi_num);
 
@@ -1464,6 +1566,7 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 		e->ec = seb->ec;
 		ubi_assert(e->ec >= 0);
 		wl_tree_add(e, &ubi->free);
+		ubi->free_count += 1;
 		ubi->lookuptbl[e->pnum] = e;
 	}
 
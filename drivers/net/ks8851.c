@@ -25,11 +25,9 @@
 
 #include <linux/spi/spi.h>
 
-#include "ks8851.h"
+#include <asm/unaligned.h>
 
-#ifdef CONFIG_ARCH_LM3S1D21
-#  include <mach/hardware.h>
-#endif
+#include "ks8851.h"
 
 /**
  * struct ks8851_rxctrl - KS8851 driver rx control
@@ -63,6 +61,46 @@ union ks8851_tx_hdr {
 	__le16	txw[3];
 };
 
+/* maximum number of frames written to the TX FIFO in one spi_message */
+#define KS_TX_BATCH	4
+
+/* maximum number of register accesses issued in one spi_message, enough
+ * for a TX batch: SDA on, header and data per frame, SDA off, enqueue and
+ * the TXMIR read */
+#define KS_BATCH_MAX	(2 * KS_TX_BATCH + 4)
+
+/* TX queue is stopped when the free TXQ memory can no longer take a full
+ * sized frame, and woken once it can take two again */
+#define KS_TX_STOP	calc_txlen(ETH_FRAME_LEN)
+#define KS_TX_WAKE	(2 * KS_TX_STOP)
+
+/* maximum number of frames read out of the RXQ per irq_work run */
+#define KS_RX_DRAIN_MAX	32
+
+/* NAPI weight, frames handed to the stack per poll */
+#define KS_NAPI_WEIGHT	16
+
+/**
+ * struct ks8851_batch - chain of register accesses issued as one message
+ * @msg: The message the transfers are queued on.
+ * @xfer: One transfer per access, with chip select toggled in between.
+ * @txd: Command and write data for each access.
+ * @rxd: Read data for each access, following the two command bytes.
+ * @nr: Number of transfers queued on @msg.
+ *
+ * Every register access is a separate chip select cycle for the KS8851,
+ * but there is no need to wait for each of them in turn. Queueing them on
+ * one message lets the SPI controller run them back to back and costs a
+ * single spi_sync() round-trip.
+ */
+struct ks8851_batch {
+	struct spi_message	msg;
+	struct spi_transfer	xfer[KS_BATCH_MAX];
+	__le16			txd[KS_BATCH_MAX][4];
+	u8			rxd[KS_BATCH_MAX][8];
+	unsigned		nr;
+};
+
 /**
  * struct ks8851_net - KS8851 driver private data
  * @netdev: The network device we're bound to
@@ -75,12 +113,19 @@ union ks8851_tx_hdr {
  * @irq_work: Work queue for servicing interrupts
  * @rxctrl_work: Work queue for updating RX mode and multicast lists
  * @txq: Queue of packets for transmission.
+ * @rxq: Frames read from the chip, waiting to be passed up by ks8851_poll().
+ * @napi: NAPI context delivering @rxq to the network stack.
+ * @rx_more: The RXQ still held frames when irq_work stopped reading.
  * @spi_msg1: pre-setup SPI transfer with one message, @spi_xfer1.
  * @spi_msg2: pre-setup SPI transfer with two messages, @spi_xfer2.
- * @txh: Space for generating packet TX header in DMA-able data
+ * @batch: Register accesses being gathered into one message.
+ * @txh: Space for generating the TX header of each frame of a batch in
+ *	DMA-able data
  * @rxd: Space for receiving SPI data, in DMA-able space.
  * @txd: Space for transmitting SPI data, in DMA-able space.
  * @msg_enable: The message flags controlling driver output (see ethtool).
+ * @tx_space: Free TXQ memory not yet claimed by a frame on @txq.
+ * @tx_queued: TXQ memory claimed by the frames waiting on @txq.
  * @fid: Incrementing frame id tag.
  * @rc_ier: Cached copy of KS_IER.
  * @rc_ccr: Cached copy of KS_CCR.
@@ -105,12 +150,13 @@ struct ks8851_net {
 	struct mutex		lock;
 	spinlock_t		statelock;
 
-	union ks8851_tx_hdr	txh ____cacheline_aligned;
+	union ks8851_tx_hdr	txh[KS_TX_BATCH] ____cacheline_aligned;
 	u8			rxd[8];
 	u8			txd[8];
 
 	u32			msg_enable ____cacheline_aligned;
 	u16			tx_space;
+	u16			tx_queued;
 	u8			fid;
 
 	u16			rc_ier;
@@ -126,11 +172,17 @@ struct ks8851_net {
 	struct work_struct	rxctrl_work;
 
 	struct sk_buff_head	txq;
+	struct sk_buff_head	rxq;
+
+	struct napi_struct	napi;
+	bool			rx_more;
 
 	struct spi_message	spi_msg1;
 	struct spi_message	spi_msg2;
 	struct spi_transfer	spi_xfer1;
 	struct spi_transfer	spi_xfer2[2];
+
+	struct ks8851_batch	batch ____cacheline_aligned;
 };
 
 static int msg_enable;
@@ -310,23 +362,140 @@ static unsigned ks8851_rdreg16(struct ks8851_net *ks, unsigned reg)
 	return le16_to_cpu(rx);
 }
 
+/* Batched register access calls.
+ *
+ * These gather register accesses into @ks->batch and issue them all with
+ * one call to ks8851_batch_sync(). Read results are fetched after the sync
+ * with the slot number returned when the read was queued.
+ */
+
 /**
- * ks8851_rdreg32 - read 32 bit register from device
- * @ks: The chip information
- * @reg: The register address
+ * ks8851_batch_init - start a new batch of register accesses
+ * @ks: The device state
+ */
+static void ks8851_batch_init(struct ks8851_net *ks)
+{
+	spi_message_init(&ks->batch.msg);
+	ks->batch.nr = 0;
+}
+
+/**
+ * ks8851_batch_add - queue a transfer on the batch
+ * @ks: The device state
+ * @txb: The data to send, or NULL
+ * @rxb: The buffer to receive into, or NULL
+ * @len: The length of the transfer
  *
- * Read a 32bit register from the chip.
+ * The transfer ends with the chip deselected, so that the next one starts
+ * a new command. Clear cs_change on the returned transfer to continue a
+ * command in the next transfer instead.
+ */
+static struct spi_transfer *ks8851_batch_add(struct ks8851_net *ks,
+					     const void *txb, void *rxb,
+					     unsigned len)
+{
+	struct ks8851_batch *batch = &ks->batch;
+	struct spi_transfer *xfer;
+
+	BUG_ON(batch->nr >= KS_BATCH_MAX);
+
+	xfer = &batch->xfer[batch->nr++];
+	memset(xfer, 0, sizeof(*xfer));
+
+	xfer->tx_buf = txb;
+	xfer->rx_buf = rxb;
+	xfer->len = len;
+	xfer->cs_change = 1;
+
+	spi_message_add_tail(xfer, &batch->msg);
+	return xfer;
+}
+
+/**
+ * ks8851_batch_wrreg16 - queue a 16bit register write
+ * @ks: The device state
+ * @reg: The register address
+ * @val: The value to write
+ */
+static void ks8851_batch_wrreg16(struct ks8851_net *ks, unsigned reg,
+				 unsigned val)
+{
+	__le16 *txb = ks->batch.txd[ks->batch.nr];
+
+	txb[0] = cpu_to_le16(MK_OP(reg & 2 ? 0xC : 0x03, reg) | KS_SPIOP_WR);
+	txb[1] = cpu_to_le16(val);
+
+	ks8851_batch_add(ks, txb, NULL, 4);
+}
+
+/**
+ * ks8851_batch_rdreg - queue a register read
+ * @ks: The device state
+ * @op: The register address and byte enables in message format.
+ * @rxl: The length of data expected.
  *
- * Note, this read requires the address be aligned to 4 bytes.
-*/
-static unsigned ks8851_rdreg32(struct ks8851_net *ks, unsigned reg)
+ * Returns the slot to pass to ks8851_batch_get16() or ks8851_batch_get32()
+ * once the batch has been issued.
+ */
+static unsigned ks8851_batch_rdreg(struct ks8851_net *ks, unsigned op,
+				   unsigned rxl)
+{
+	unsigned slot = ks->batch.nr;
+
+	ks->batch.txd[slot][0] = cpu_to_le16(op | KS_SPIOP_RD);
+	ks8851_batch_add(ks, ks->batch.txd[slot], ks->batch.rxd[slot], rxl + 2);
+
+	return slot;
+}
+
+static inline unsigned ks8851_batch_rdreg16(struct ks8851_net *ks,
+					    unsigned reg)
 {
-	__le32 rx = 0;
+	return ks8851_batch_rdreg(ks, MK_OP(reg & 2 ? 0xC : 0x3, reg), 2);
+}
 
+static inline unsigned ks8851_batch_rdreg32(struct ks8851_net *ks,
+					    unsigned reg)
+{
 	WARN_ON(reg & 3);
 
-	ks8851_rdreg(ks, MK_OP(0xf, reg), (u8 *)&rx, 4);
-	return le32_to_cpu(rx);
+	return ks8851_batch_rdreg(ks, MK_OP(0xf, reg), 4);
+}
+
+static inline unsigned ks8851_batch_get16(struct ks8851_net *ks,
+					  unsigned slot)
+{
+	return get_unaligned_le16(&ks->batch.rxd[slot][2]);
+}
+
+static inline u32 ks8851_batch_get32(struct ks8851_net *ks, unsigned slot)
+{
+	return get_unaligned_le32(&ks->batch.rxd[slot][2]);
+}
+
+/**
+ * ks8851_batch_sync - issue the queued register accesses
+ * @ks: The device state
+ *
+ * Send all the accesses queued since ks8851_batch_init() as one message
+ * and wait for it to complete. The chip is left deselected afterwards.
+ */
+static int ks8851_batch_sync(struct ks8851_net *ks)
+{
+	struct ks8851_batch *batch = &ks->batch;
+	int ret;
+
+	if (batch->nr == 0)
+		return 0;
+
+	/* cs_change on the last transfer would keep the chip selected */
+	batch->xfer[batch->nr - 1].cs_change = 0;
+
+	ret = spi_sync(ks->spidev, &batch->msg);
+	if (ret < 0)
+		ks_err(ks, "%s: spi_sync() failed\n", __func__);
+
+	return ret;
 }
 
 /**
@@ -441,10 +610,6 @@ static void ks8851_init_mac(struct ks8851_net *ks)
 	ks8851_write_mac_addr(dev);
 }
 
-#ifdef CONFIG_ARCH_LM3S1D21
-extern void lm3s_gpioclearint(uint32_t pinset);
-#endif
-
 /**
  * ks8851_irq - device interrupt handler
  * @irq: Interrupt number passed from the IRQ handler.
@@ -457,10 +622,6 @@ static irqreturn_t ks8851_irq(int irq, void *pw)
 {
 	struct ks8851_net *ks = pw;
 
-#ifdef CONFIG_ARCH_LM3S1D21
-  lm3s_gpioclearint(GPIO_ETH_INTRN);
-#endif
-
 	disable_irq_nosync(irq);
 	schedule_work(&ks->irq_work);
 	return IRQ_HANDLED;
@@ -521,83 +682,172 @@ static void ks8851_dbg_dumpkkt(struct ks8851_net *ks, u8 *rxpkt)
 /**
  * ks8851_rx_pkts - receive packets from the host
  * @ks: The device information.
+ * @rxfc: The number of frames the RXQ held when the interrupt was read.
  *
  * This is called from the IRQ work queue when the system detects that there
- * are packets in the receive queue. Find out how many packets there are and
- * read them from the FIFO.
+ * are packets in the receive queue. Read the frames out of the FIFO onto
+ * @ks->rxq for ks8851_poll(), then check the frame count again and keep
+ * going while more have arrived, up to KS_RX_DRAIN_MAX frames per call.
+ *
+ * Returns true if frames were left in the chip.
+ *
+ * Each frame still needs its own header read and DMA window, since the
+ * chip only presents one frame at a time through RXFHSR and the FIFO, but
+ * the register accesses around it are batched: the release of a frame goes
+ * out in the same message as the header read and DMA setup of the next, so
+ * a frame costs two SPI messages instead of six.
  */
-static void ks8851_rx_pkts(struct ks8851_net *ks)
+static bool ks8851_rx_pkts(struct ks8851_net *ks, unsigned rxfc)
 {
 	struct sk_buff *skb;
-	unsigned rxfc;
 	unsigned rxlen;
 	unsigned rxstat;
+	unsigned drained = 0;
+	unsigned slot;
 	u32 rxh;
 	u8 *rxpkt;
 
-	rxfc = ks8851_rdreg8(ks, KS_RXFC);
-
 	netif_dbg(ks, rx_status, ks->netdev,
 		  "%s: %d packets\n", __func__, rxfc);
 
-	/* Currently we're issuing a read per packet, but we could possibly
-	 * improve the code by issuing a single read, getting the receive
-	 * header, allocating the packet and then reading the packet data
-	 * out in one go.
-	 *
-	 * This form of operation would require us to hold the SPI bus'
-	 * chipselect low during the entie transaction to avoid any
-	 * reset to the data stream coming from the chip.
-	 */
+	ks8851_batch_init(ks);
+
+	for (;;) {
+		for (; rxfc != 0 && drained < KS_RX_DRAIN_MAX; rxfc--, drained++) {
+			slot = ks8851_batch_rdreg32(ks, KS_RXFHSR);
 
-	for (; rxfc != 0; rxfc--) {
-		rxh = ks8851_rdreg32(ks, KS_RXFHSR);
-		rxstat = rxh & 0xffff;
-		rxlen = (rxh >> 16) & 0xFFF;
+			/* set dma read address */
+			ks8851_batch_wrreg16(ks, KS_RXFDPR, RXFDPR_RXFPAI | 0x00);
 
-		netif_dbg(ks, rx_status, ks->netdev,
-			  "rx: stat 0x%04x, len 0x%04x\n", rxstat, rxlen);
+			/* start the packet dma process, and set auto-dequeue rx */
+			ks8851_batch_wrreg16(ks, KS_RXQCR,
+					     ks->rc_rxqcr | RXQCR_SDA | RXQCR_ADRFE);
 
-		/* the length of the packet includes the 32bit CRC */
+			ks8851_batch_sync(ks);
 
-		/* set dma read address */
-		ks8851_wrreg16(ks, KS_RXFDPR, RXFDPR_RXFPAI | 0x00);
+			rxh = ks8851_batch_get32(ks, slot);
+			rxstat = rxh & 0xffff;
+			rxlen = (rxh >> 16) & 0xFFF;
 
-		/* start the packet dma process, and set auto-dequeue rx */
-		ks8851_wrreg16(ks, KS_RXQCR,
-			       ks->rc_rxqcr | RXQCR_SDA | RXQCR_ADRFE);
+			netif_dbg(ks, rx_status, ks->netdev,
+				  "rx: stat 0x%04x, len 0x%04x\n", rxstat, rxlen);
 
-		if (rxlen > 4) {
-			unsigned int rxalign;
+			/* the length of the packet includes the 32bit CRC */
 
-			rxlen -= 4;
-			rxalign = ALIGN(rxlen, 4);
-			skb = netdev_alloc_skb_ip_align(ks->netdev, rxalign);
-			if (skb) {
+			if (rxlen > 4) {
+				unsigned int rxalign;
 
-				/* 4 bytes of status header + 4 bytes of
-				 * garbage: we put them before ethernet
-				 * header, so that they are copied,
-				 * but ignored.
-				 */
+				rxlen -= 4;
+				rxalign = ALIGN(rxlen, 4);
+				skb = netdev_alloc_skb_ip_align(ks->netdev, rxalign);
+				if (skb) {
 
-				rxpkt = skb_put(skb, rxlen) - 8;
+					/* 4 bytes of status header + 4 bytes of
+					 * garbage: we put them before ethernet
+					 * header, so that they are copied,
+					 * but ignored.
+					 */
 
-				ks8851_rdfifo(ks, rxpkt, rxalign + 8);
+					rxpkt = skb_put(skb, rxlen) - 8;
 
-			if (netif_msg_pktdata(ks))
-				ks8851_dbg_dumpkkt(ks, rxpkt);
+					ks8851_rdfifo(ks, rxpkt, rxalign + 8);
 
-			skb->protocol = eth_type_trans(skb, ks->netdev);
-				netif_rx_ni(skb);
+					if (netif_msg_pktdata(ks))
+						ks8851_dbg_dumpkkt(ks, rxpkt);
 
-			ks->netdev->stats.rx_packets++;
-				ks->netdev->stats.rx_bytes += rxlen;
+					skb->protocol = eth_type_trans(skb, ks->netdev);
+					skb_queue_tail(&ks->rxq, skb);
+
+					ks->netdev->stats.rx_packets++;
+					ks->netdev->stats.rx_bytes += rxlen;
+				}
 			}
+
+			/* end the dma window along with the next access */
+			ks8851_batch_init(ks);
+			ks8851_batch_wrreg16(ks, KS_RXQCR, ks->rc_rxqcr);
 		}
 
-		ks8851_wrreg16(ks, KS_RXQCR, ks->rc_rxqcr);
+		if (drained >= KS_RX_DRAIN_MAX)
+			break;
+
+		/* pick up frames that arrived during the read-out, or after
+		 * the count was read but before the interrupt was acked */
+		slot = ks8851_batch_rdreg16(ks, KS_RXFCTR);
+		ks8851_batch_sync(ks);
+		rxfc = RXFCTR_RXFC_GET(ks8851_batch_get16(ks, slot));
+
+		ks8851_batch_init(ks);
+
+		if (rxfc == 0)
+			break;
 	}
+
+	ks8851_batch_sync(ks);
+
+	return rxfc != 0;
+}
+
+/**
+ * ks8851_poll - NAPI poll handler
+ * @napi: The NAPI context, embedded in struct ks8851_net.
+ * @budget: The maximum number of frames to pass up.
+ *
+ * Hand the frames read out by ks8851_rx_pkts() to the network stack. The
+ * chip interrupt stays disabled while the RXQ still holds frames, so once
+ * @ks->rxq is empty go back to irq_work to fetch the next lot instead of
+ * waiting for another interrupt.
+ */
+static int ks8851_poll(struct napi_struct *napi, int budget)
+{
+	struct ks8851_net *ks = container_of(napi, struct ks8851_net, napi);
+	struct sk_buff *skb;
+	int work_done = 0;
+
+	while (work_done < budget) {
+		skb = skb_dequeue(&ks->rxq);
+		if (!skb)
+			break;
+
+		netif_receive_skb(skb);
+		work_done++;
+	}
+
+	if (work_done < budget) {
+		napi_complete(napi);
+
+		if (ks->rx_more)
+			schedule_work(&ks->irq_work);
+	}
+
+	return work_done;
+}
+
+/**
+ * ks8851_update_tx_space - recompute the free TX space from TXMIR
+ * @ks: The device state
+ * @txmir: The value read from KS_TXMIR.
+ *
+ * Work out how much of the free TXQ memory reported by the chip is not
+ * already promised to frames waiting on @ks->txq, and wake the queue if
+ * that is above the wake watermark.
+ */
+static void ks8851_update_tx_space(struct ks8851_net *ks, unsigned txmir)
+{
+	bool wake;
+
+	txmir &= TXMIR_TXMA_MASK;
+
+	spin_lock_bh(&ks->statelock);
+	ks->tx_space = txmir > ks->tx_queued ? txmir - ks->tx_queued : 0;
+	wake = ks->tx_space >= KS_TX_WAKE;
+	spin_unlock_bh(&ks->statelock);
+
+	netif_dbg(ks, tx_done, ks->netdev,
+		  "%s: txmir %d, txspace %d\n", __func__, txmir, ks->tx_space);
+
+	if (wake && netif_queue_stopped(ks->netdev))
+		netif_wake_queue(ks->netdev);
 }
 
 /**
@@ -616,10 +866,19 @@ static void ks8851_irq_work(struct work_struct *work)
 	struct ks8851_net *ks = container_of(work, struct ks8851_net, irq_work);
 	unsigned status;
 	unsigned handled = 0;
+	unsigned rxfc;
+	unsigned slot;
 
 	mutex_lock(&ks->lock);
 
-	status = ks8851_rdreg16(ks, KS_ISR);
+	/* fetch the interrupt status and the frame count in one go */
+	ks8851_batch_init(ks);
+	slot = ks8851_batch_rdreg16(ks, KS_ISR);
+	ks8851_batch_rdreg16(ks, KS_RXFCTR);
+	ks8851_batch_sync(ks);
+
+	status = ks8851_batch_get16(ks, slot);
+	rxfc = RXFCTR_RXFC_GET(ks8851_batch_get16(ks, slot + 1));
 
 	netif_dbg(ks, intr, ks->netdev,
 		  "%s: status 0x%04x\n", __func__, status);
@@ -641,14 +900,9 @@ static void ks8851_irq_work(struct work_struct *work)
 	if (status & IRQ_TXI) {
 		handled |= IRQ_TXI;
 
-		/* no lock here, tx queue should have been stopped */
-
 		/* update our idea of how much tx space is available to the
-		 * system */
-		ks->tx_space = ks8851_rdreg16(ks, KS_TXMIR);
-
-		netif_dbg(ks, intr, ks->netdev,
-			  "%s: txspace %d\n", __func__, ks->tx_space);
+		 * system, waking the queue if it has dropped enough */
+		ks8851_update_tx_space(ks, ks8851_rdreg16(ks, KS_TXMIR));
 	}
 
 	if (status & IRQ_RXI)
@@ -661,13 +915,13 @@ static void ks8851_irq_work(struct work_struct *work)
 
 	ks8851_wrreg16(ks, KS_ISR, handled);
 
-	if (status & IRQ_RXI) {
+	if ((status & IRQ_RXI) || ks->rx_more) {
 		/* the datasheet says to disable the rx interrupt during
 		 * packet read-out, however we're masking the interrupt
 		 * from the device so do not bother masking just the RX
 		 * from the device. */
 
-		ks8851_rx_pkts(ks);
+		ks->rx_more = ks8851_rx_pkts(ks, rxfc);
 	}
 
 	/* if something stopped the rx process, probably due to wanting
@@ -691,10 +945,18 @@ static void ks8851_irq_work(struct work_struct *work)
 	if (status & IRQ_LCI)
 		mii_check_link(&ks->mii);
 
-	if (status & IRQ_TXI)
-		netif_wake_queue(ks->netdev);
+	/* bh off so the poll runs as soon as we re-enable, rather than at
+	 * the next hardware interrupt */
+	if (!skb_queue_empty(&ks->rxq) || ks->rx_more) {
+		local_bh_disable();
+		napi_schedule(&ks->napi);
+		local_bh_enable();
+	}
 
-	enable_irq(ks->netdev->irq);
+	/* keep the interrupt masked until ks8851_poll() has drained the
+	 * RXQ, it calls us back directly for the remaining frames */
+	if (!ks->rx_more)
+		enable_irq(ks->netdev->irq);
 }
 
 /**
@@ -710,22 +972,23 @@ static inline unsigned calc_txlen(unsigned len)
 }
 
 /**
- * ks8851_wrpkt - write packet to TX FIFO
+ * ks8851_wrpkt - queue a packet write to the TX FIFO on the batch
  * @ks: The device state.
  * @txp: The sk_buff to transmit.
+ * @txh: The header space for this frame, one of @ks->txh.
  * @irq: IRQ on completion of the packet.
  *
  * Send the @txp to the chip. This means creating the relevant packet header
  * specifying the length of the packet and the other information the chip
- * needs, such as IRQ on completion. Send the header and the packet data to
- * the device.
+ * needs, such as IRQ on completion. The header and the packet data are
+ * queued as one command on @ks->batch, to go out with the next
+ * ks8851_batch_sync().
  */
-static void ks8851_wrpkt(struct ks8851_net *ks, struct sk_buff *txp, bool irq)
+static void ks8851_wrpkt(struct ks8851_net *ks, struct sk_buff *txp,
+			 union ks8851_tx_hdr *txh, bool irq)
 {
-	struct spi_transfer *xfer = ks->spi_xfer2;
-	struct spi_message *msg = &ks->spi_msg2;
+	struct spi_transfer *xfer;
 	unsigned fid = 0;
-	int ret;
 
 	netif_dbg(ks, tx_queued, ks->netdev, "%s: skb %p, %d@%p, irq %d\n",
 			__func__, txp, txp->len, txp->data, irq);
@@ -737,22 +1000,15 @@ static void ks8851_wrpkt(struct ks8851_net *ks, struct sk_buff *txp, bool irq)
 		fid |= TXFR_TXIC;	/* irq on completion */
 
 	/* start header at txb[1] to align txw entries */
-	ks->txh.txb[1] = KS_SPIOP_TXFIFO;
-	ks->txh.txw[1] = cpu_to_le16(fid);
-	ks->txh.txw[2] = cpu_to_le16(txp->len);
-
-	xfer->tx_buf = &ks->txh.txb[1];
-	xfer->rx_buf = NULL;
-	xfer->len = 5;
+	txh->txb[1] = KS_SPIOP_TXFIFO;
+	txh->txw[1] = cpu_to_le16(fid);
+	txh->txw[2] = cpu_to_le16(txp->len);
 
-	xfer++;
-	xfer->tx_buf = txp->data;
-	xfer->rx_buf = NULL;
-	xfer->len = ALIGN(txp->len, 4);
+	/* the data follows the header within the same chip select */
+	xfer = ks8851_batch_add(ks, &txh->txb[1], NULL, 5);
+	xfer->cs_change = 0;
 
-	ret = spi_sync(ks->spidev, msg);
-	if (ret < 0)
-		ks_err(ks, "%s: spi_sync() failed\n", __func__);
+	ks8851_batch_add(ks, txp->data, NULL, ALIGN(txp->len, 4));
 }
 
 /**
@@ -776,27 +1032,56 @@ static void ks8851_done_tx(struct ks8851_net *ks, struct sk_buff *txb)
  *
  * This is called when a number of packets have been scheduled for
  * transmission and need to be sent to the device.
+ *
+ * Up to KS_TX_BATCH frames are written in one DMA window and enqueued
+ * together, in a single SPI message which also reads back TXMIR so the
+ * free space is known without waiting for the TX interrupt. Only the last
+ * frame queued asks for a completion interrupt.
  */
 static void ks8851_tx_work(struct work_struct *work)
 {
 	struct ks8851_net *ks = container_of(work, struct ks8851_net, tx_work);
-	struct sk_buff *txb;
-	bool last = skb_queue_empty(&ks->txq);
+	struct sk_buff *txb[KS_TX_BATCH];
+	unsigned needed;
+	unsigned slot;
+	unsigned nr;
+	unsigned i;
+	bool last;
 
 	mutex_lock(&ks->lock);
 
-	while (!last) {
-		txb = skb_dequeue(&ks->txq);
+	for (;;) {
+		needed = 0;
+
+		spin_lock_bh(&ks->statelock);
+		for (nr = 0; nr < KS_TX_BATCH; nr++) {
+			txb[nr] = skb_dequeue(&ks->txq);
+			if (!txb[nr])
+				break;
+			needed += calc_txlen(txb[nr]->len);
+		}
+		ks->tx_queued -= needed;
 		last = skb_queue_empty(&ks->txq);
+		spin_unlock_bh(&ks->statelock);
 
-		if (txb != NULL) {
-		ks8851_wrreg16(ks, KS_RXQCR, ks->rc_rxqcr | RXQCR_SDA);
-		ks8851_wrpkt(ks, txb, last);
-		ks8851_wrreg16(ks, KS_RXQCR, ks->rc_rxqcr);
-		ks8851_wrreg16(ks, KS_TXQCR, TXQCR_METFE);
+		if (nr == 0)
+			break;
 
-		ks8851_done_tx(ks, txb);
-	}
+		ks8851_batch_init(ks);
+		ks8851_batch_wrreg16(ks, KS_RXQCR, ks->rc_rxqcr | RXQCR_SDA);
+
+		for (i = 0; i < nr; i++)
+			ks8851_wrpkt(ks, txb[i], &ks->txh[i], last && i == nr - 1);
+
+		ks8851_batch_wrreg16(ks, KS_RXQCR, ks->rc_rxqcr);
+		ks8851_batch_wrreg16(ks, KS_TXQCR, TXQCR_METFE);
+		slot = ks8851_batch_rdreg16(ks, KS_TXMIR);
+		ks8851_batch_sync(ks);
+
+		for (i = 0; i < nr; i++)
+			ks8851_done_tx(ks, txb[i]);
+
+		ks8851_update_tx_space(ks, ks8851_batch_get16(ks, slot));
 	}
 
 	mutex_unlock(&ks->lock);
@@ -871,6 +1156,7 @@ static int ks8851_net_open(struct net_device *dev)
 	ks8851_wrreg16(ks, KS_ISR, STD_IRQ);
 	ks8851_wrreg16(ks, KS_IER, STD_IRQ);
 
+	napi_enable(&ks->napi);
 	netif_start_queue(ks->netdev);
 
 	netif_dbg(ks, ifup, ks->netdev, "network device up\n");
@@ -903,9 +1189,18 @@ static int ks8851_net_stop(struct net_device *dev)
 
 	/* stop any outstanding work */
 	flush_work(&ks->irq_work);
+	napi_disable(&ks->napi);
+	flush_work(&ks->irq_work);
 	flush_work(&ks->tx_work);
 	flush_work(&ks->rxctrl_work);
 
+	/* frames left in the chip are dropped by the RXQ shutdown below */
+	if (ks->rx_more) {
+		ks->rx_more = false;
+		enable_irq(dev->irq);
+	}
+	skb_queue_purge(&ks->rxq);
+
 	mutex_lock(&ks->lock);
 	/* shutdown RX process */
 	ks8851_wrreg16(ks, KS_RXCR1, 0x0000);
@@ -927,6 +1222,10 @@ static int ks8851_net_stop(struct net_device *dev)
 		dev_kfree_skb(txb);
 	}
 
+	/* give back the space claimed by the dropped frames */
+	ks->tx_space += ks->tx_queued;
+	ks->tx_queued = 0;
+
 	return 0;
 }
 
@@ -942,6 +1241,10 @@ static int ks8851_net_stop(struct net_device *dev)
  * We do this to firstly avoid sleeping with the network device locked,
  * and secondly so we can round up more than one packet to transmit which
  * means we can try and avoid generating too many transmit done interrupts.
+ *
+ * The queue is only stopped once the TXQ memory left could not take
+ * another full sized frame, so several frames can be waiting for
+ * ks8851_tx_work() to write them out in one go.
  */
 static netdev_tx_t ks8851_start_xmit(struct sk_buff *skb,
 				     struct net_device *dev)
@@ -960,7 +1263,11 @@ static netdev_tx_t ks8851_start_xmit(struct sk_buff *skb,
 		ret = NETDEV_TX_BUSY;
 	} else {
 		ks->tx_space -= needed;
+		ks->tx_queued += needed;
 		skb_queue_tail(&ks->txq, skb);
+
+		if (ks->tx_space < KS_TX_STOP)
+			netif_stop_queue(dev);
 	}
 
 	spin_unlock(&ks->statelock);
@@ -1334,6 +1641,9 @@ static int __devinit ks8851_probe(struct spi_device *spi)
 						     NETIF_MSG_LINK));
 
 	skb_queue_head_init(&ks->txq);
+	skb_queue_head_init(&ks->rxq);
+
+	netif_napi_add(ndev, &ks->napi, ks8851_poll, KS_NAPI_WEIGHT);
 
 	SET_ETHTOOL_OPS(ndev, &ks8851_ethtool_ops);
 	SET_NETDEV_DEV(ndev, &spi->dev);
@@ -125,6 +125,7 @@
 #define RXCR2_RXSAF				(1 << 0)
 
 #define KS_TXMIR				0x78
+#define TXMIR_TXMA_MASK				(0x1fff << 0)
 
 #define KS_RXFHSR				0x7C
 #define RXFSHR_RXFV				(1 << 15)
@@ -43,7 +43,22 @@
 
 /****************************************************************************/
 
-#define RX_SLOT_SIZE(pp) ((pp)->dma_buffer_size / 2)
+/*
+ * The RX DMA buffer is split in two slots, one for the primary and one for
+ * the alternate control structure of the channel, which fill them in
+ * ping-pong mode. Each time one completes it is re-armed with its own slot
+ * while the other one keeps receiving, so reception never stops while a
+ * slot is handed to the tty layer. Ping-pong never has more than two
+ * transfers armed, so more slots would only make each of them smaller.
+ */
+#define RX_SLOTS 2
+#define RX_SLOT_SIZE(pp) ((pp)->dma_buffer_size / RX_SLOTS)
+
+/*
+ * TX reads straight from the circular buffer: a page split at most once
+ * where it wraps, in chunks of DMA_MAX_TRANSFER_SIZE bytes.
+ */
+#define TX_SG_TASKS (UART_XMIT_SIZE / DMA_MAX_TRANSFER_SIZE + 1)
 
 /*
  *  Local per-uart structure.
@@ -57,15 +72,13 @@ struct lm3s_serial_port {
 	uint32_t dma_tx_channel;
 	void    *dma_tx_buffer;
 	uint32_t tx_busy;
+	uint32_t tx_size;             /* Bytes the DMA reads from xmit, tail not yet moved */
+	struct lm3s_dma_channel tx_tasks[TX_SG_TASKS];
 
 	uint32_t dma_rx_channel;
-	void    *rx_slot_a;
-	void    *rx_slot_b;
-	uint32_t rx_busy;
-
-	int   cur_bytes_received;
-
-	struct work_struct rx_work;
+	unsigned char *rx_ring;
+	unsigned int rx_alt;          /* Control structure, and slot, being filled */
+	unsigned int rx_pushed;       /* Bytes of that slot already given to the tty */
 #endif
 };
 
@@ -107,7 +120,7 @@ static void lm3s_enable_uart(struct uart_port *port)
 	lm3s_putreg32(UART_DMACTL_TXDMAE | UART_DMACTL_RXDMAE,
 	              port->membase + LM3S_UART_DMACTL_OFFSET);
 	pp->tx_busy = 0;
-	pp->rx_busy = 0;
+	pp->tx_size = 0;
 #endif
 }
 
@@ -201,8 +214,15 @@ static void lm3s_stop_tx(struct uart_port *port)
   spin_lock_irqsave(&port->lock, flags);
 
 #ifdef CONFIG_LM3S_DMA
-	dma_stop_xfer(pp->dma_tx_channel);
-	pp->tx_busy = 0;
+	/*
+	 * A transfer reading from the circular buffer is left to complete,
+	 * the completion interrupt sees uart_tx_stopped() and stops there.
+	 */
+	if( !pp->tx_size )
+	{
+		dma_stop_xfer(pp->dma_tx_channel);
+		pp->tx_busy = 0;
+	}
 #else
   regval = lm3s_getreg32(port->membase + LM3S_UART_IM_OFFSET);
   regval &= ~UART_IM_TXIM;
@@ -214,13 +234,28 @@ static void lm3s_stop_tx(struct uart_port *port)
 
 /****************************************************************************/
 
+#ifdef CONFIG_LM3S_DMA
+/* Called with the port lock held when the circular buffer is emptied */
+static void lm3s_flush_buffer(struct uart_port *port)
+{
+	struct lm3s_serial_port *pp = container_of(port, struct lm3s_serial_port, port);
+
+	dev_dbg(port->dev, "%s\n", __func__);
+
+	dma_stop_xfer(pp->dma_tx_channel);
+	pp->tx_busy = 0;
+	pp->tx_size = 0;
+}
+#endif
+
+/****************************************************************************/
+
 static void lm3s_stop_rx(struct uart_port *port)
 {
   unsigned long flags;
+	uint32_t regval;
 #ifdef CONFIG_LM3S_DMA
 	struct lm3s_serial_port *pp = container_of(port, struct lm3s_serial_port, port);
-#else
-	uint32_t regval;
 #endif
 
   dev_dbg(port->dev, "%s\n", __func__);
@@ -229,11 +264,10 @@ static void lm3s_stop_rx(struct uart_port *port)
 
 #ifdef CONFIG_LM3S_DMA
 	dma_stop_xfer(pp->dma_rx_channel);
-#else
+#endif
   regval = lm3s_getreg32(port->membase + LM3S_UART_IM_OFFSET);
   regval &= ~(UART_IM_RXIM | UART_IM_RTIM);
   lm3s_putreg32(regval, port->membase + LM3S_UART_IM_OFFSET);
-#endif
 
   spin_unlock_irqrestore(&port->lock, flags);
 }
@@ -284,6 +318,9 @@ static int lm3s_startup(struct uart_port *port)
 
 #ifdef CONFIG_LM3S_DMA
 	lm3s_start_rx_dma(pp);
+
+	/* The receive timeout flushes partially filled slots */
+	lm3s_putreg32(UART_IM_RTIM, port->membase + LM3S_UART_IM_OFFSET);
 #else
   /* Enable RX interrupts now */
   lm3s_putreg32(UART_IM_RXIM | UART_IM_RTIM,
@@ -435,49 +472,46 @@ static void lm3s_set_termios(struct uart_port *port, struct ktermios *termios,
 /****************************************************************************/
 
 #ifdef CONFIG_LM3S_DMA
-static void __sram lm3s_start_rx_dma(struct lm3s_serial_port *pp)
+static void __sram lm3s_arm_rx_slot(struct lm3s_serial_port *pp,
+                                    unsigned int alt)
 {
 	struct uart_port *port = &pp->port;
-	void *slot = pp->rx_slot_a;
 
 	dma_setup_xfer(pp->dma_rx_channel,
-	               slot,
-	               port->membase + LM3S_UART_DR_OFFSET,
-	               1,
-	               DMA_XFER_DEVICE_TO_MEMORY | DMA_XFER_UNIT_BYTE | DMA_XFER_MODE_PINGPONG);
-	dma_setup_xfer(pp->dma_rx_channel,
-	               (char*)slot + 1,
+	               pp->rx_ring + alt * RX_SLOT_SIZE(pp),
 	               port->membase + LM3S_UART_DR_OFFSET,
-	               RX_SLOT_SIZE(pp) - 1,
-	               DMA_XFER_DEVICE_TO_MEMORY | DMA_XFER_UNIT_BYTE | DMA_XFER_MODE_PINGPONG | DMA_XFER_ALT);
+	               RX_SLOT_SIZE(pp),
+	               DMA_XFER_DEVICE_TO_MEMORY | DMA_XFER_UNIT_BYTE | DMA_XFER_MODE_PINGPONG |
+	               (alt ? DMA_XFER_ALT : 0));
+}
+
+static void __sram lm3s_start_rx_dma(struct lm3s_serial_port *pp)
+{
+	lm3s_arm_rx_slot(pp, 0);
+	lm3s_arm_rx_slot(pp, 1);
+
+	pp->rx_alt = 0;
+	pp->rx_pushed = 0;
 
 	dma_start_xfer(pp->dma_rx_channel);
 }
 
-static void __sram lm3s_rx_chars(struct lm3s_serial_port *pp);
-
-static void __sram do_rx_chars(struct work_struct *work)
+/*
+ * Give the bytes of the current slot up to 'filled' to the tty layer.
+ */
+static void __sram lm3s_push_rx_slot(struct lm3s_serial_port *pp,
+                                     unsigned int filled)
 {
-	struct lm3s_serial_port *pp = container_of(work, struct lm3s_serial_port, rx_work);
 	struct uart_port *port = &pp->port;
 	struct tty_struct *tty = port->state->port.tty;
-	int i;
-	unsigned char* slot = pp->rx_slot_b;
-	int bytes_received = pp->cur_bytes_received;
-	int old_low_latency = tty->low_latency;
-	unsigned long flags;
-
-	tty_insert_flip_string(tty, slot, bytes_received);
-	port->icount.rx += bytes_received;
+	unsigned char *slot = pp->rx_ring + pp->rx_alt * RX_SLOT_SIZE(pp);
 
-	tty->low_latency = 1;
-	tty_flip_buffer_push(tty);
-	tty->low_latency = old_low_latency;
+	if( filled <= pp->rx_pushed )
+		return;
 
-	local_irq_save(flags);
-	pp->rx_busy = 0;
-	lm3s_rx_chars(pp);
-	local_irq_restore(flags);
+	tty_insert_flip_string(tty, slot + pp->rx_pushed, filled - pp->rx_pushed);
+	port->icount.rx += filled - pp->rx_pushed;
+	pp->rx_pushed = filled;
 }
 #endif
 
@@ -485,7 +519,9 @@ static void __sram lm3s_rx_chars(struct lm3s_serial_port *pp)
 {
 	struct uart_port *port = &pp->port;
 #ifdef CONFIG_LM3S_DMA
-	int bytes_received;
+	struct tty_struct *tty = port->state->port.tty;
+	unsigned int slot_size = RX_SLOT_SIZE(pp);
+	uint32_t rxdata;
 #else
   unsigned char ch;
   unsigned int flag;
@@ -495,26 +531,53 @@ static void __sram lm3s_rx_chars(struct lm3s_serial_port *pp)
   dev_vdbg(port->dev, "%s\n", __func__);
 
 #ifdef CONFIG_LM3S_DMA
-	if( pp->rx_busy )
-		return;
-
-	dma_stop_xfer(pp->dma_rx_channel);
+	/*
+	 * The ring and icount are shared with lm3s_startup() and the TX path,
+	 * and set_termios() may reprogram the UART meanwhile.
+	 */
+	spin_lock(&port->lock);
+
+	/*
+	 * Hold off the uDMA while we look at the ring, so that the bytes it
+	 * leaves in the FIFO below the burst level can be read in order.
+	 */
+	dma_pause_xfer(pp->dma_rx_channel);
+
+	/* Hand over every completed slot and re-arm its control structure */
+	while( get_units_left(pp->dma_rx_channel, pp->rx_alt) == 0 )
+	{
+		lm3s_push_rx_slot(pp, slot_size);
+		lm3s_arm_rx_slot(pp, pp->rx_alt);
 
-	swap(pp->rx_slot_a, pp->rx_slot_b);
+		pp->rx_alt ^= 1;
+		pp->rx_pushed = 0;
+	}
 
-	bytes_received  = RX_SLOT_SIZE(pp);
-	bytes_received -= get_units_left(pp->dma_rx_channel, 0);
-	bytes_received -= get_units_left(pp->dma_rx_channel, 1);
+	if( !dma_xfer_running(pp->dma_rx_channel) )
+	{
+		/* Both slots filled up before we got here, start over */
+		port->icount.buf_overrun++;
+		lm3s_start_rx_dma(pp);
+	}
 
-	lm3s_start_rx_dma(pp);
+	/* Partially filled slot */
+	lm3s_push_rx_slot(pp, slot_size - get_units_left(pp->dma_rx_channel, pp->rx_alt));
 
-	if( bytes_received > 0 )
+	while( (lm3s_getreg32(port->membase + LM3S_UART_FR_OFFSET) & UART_FR_RXFE) == 0 )
 	{
-		pp->cur_bytes_received = bytes_received;
-		pp->rx_busy = 1;
-		schedule_work(&pp->rx_work);
+		rxdata = lm3s_getreg32(port->membase + LM3S_UART_DR_OFFSET);
+		tty_insert_flip_char(tty, rxdata & UART_DR_DATA_MASK, TTY_NORMAL);
+		port->icount.rx++;
 	}
+
+	dma_resume_xfer(pp->dma_rx_channel);
+
+	spin_unlock(&port->lock);
+
+	tty_flip_buffer_push(tty);
 #else
+  spin_lock(&port->lock);
+
   while( ((lm3s_getreg32(port->membase + LM3S_UART_FR_OFFSET)) & UART_FR_RXFE) == 0 )
   {
     rxdata = lm3s_getreg32(port->membase + LM3S_UART_DR_OFFSET);
@@ -555,6 +618,8 @@ static void __sram lm3s_rx_chars(struct lm3s_serial_port *pp)
 		}
   }
 
+  spin_unlock(&port->lock);
+
   tty_flip_buffer_push(port->state->port.tty);
 #endif
 }
@@ -568,12 +633,24 @@ static int __sram lm3s_tx_chars(struct lm3s_serial_port *pp)
 #ifdef CONFIG_LM3S_DMA
 	size_t xfer_size;
 	size_t bytes_to_transmit;
+	int ntasks;
+	int n;
 #else
 	uint32_t regval;
 #endif
 
   dev_vdbg(port->dev, "%s\n", __func__);
 
+#ifdef CONFIG_LM3S_DMA
+	/* The previous transfer read from xmit, release what it sent */
+	if( pp->tx_size )
+	{
+		xmit->tail = (xmit->tail + pp->tx_size) & (UART_XMIT_SIZE - 1);
+		port->icount.tx += pp->tx_size;
+		pp->tx_size = 0;
+	}
+#endif
+
   if (uart_circ_empty(xmit) || uart_tx_stopped(port)) {
 		dev_vdbg(port->dev, "%s TX complete\n", __func__);
 #ifdef CONFIG_LM3S_DMA
@@ -597,14 +674,44 @@ static int __sram lm3s_tx_chars(struct lm3s_serial_port *pp)
 #ifdef CONFIG_LM3S_DMA
 	pp->tx_busy = 1;
 	bytes_to_transmit = CIRC_CNT_TO_END(xmit->head, xmit->tail, UART_XMIT_SIZE);
-  xfer_size = min(bytes_to_transmit, pp->dma_buffer_size);
-	dma_memcpy(pp->dma_tx_buffer, xmit->buf + xmit->tail, xfer_size);
-	xmit->tail = (xmit->tail + xfer_size) & (UART_XMIT_SIZE - 1);
-	dma_setup_xfer(pp->dma_tx_channel,
-								 port->membase + LM3S_UART_DR_OFFSET,
-								 pp->dma_tx_buffer,
-								 xfer_size,
-								 DMA_XFER_MEMORY_TO_DEVICE | DMA_XFER_UNIT_BYTE);
+
+	if( dma_buffer_reachable(xmit->buf, UART_XMIT_SIZE) )
+	{
+		/* Up to the end of the buffer, then from its start if it wraps */
+		ntasks = dma_build_sg_list(pp->tx_tasks, TX_SG_TASKS,
+		                           port->membase + LM3S_UART_DR_OFFSET,
+		                           xmit->buf + xmit->tail, bytes_to_transmit,
+		                           DMA_XFER_MEMORY_TO_DEVICE | DMA_XFER_UNIT_BYTE);
+		xfer_size = bytes_to_transmit;
+
+		bytes_to_transmit = uart_circ_chars_pending(xmit) - bytes_to_transmit;
+		if( bytes_to_transmit )
+		{
+			n = dma_build_sg_list(pp->tx_tasks + ntasks, TX_SG_TASKS - ntasks,
+			                      port->membase + LM3S_UART_DR_OFFSET,
+			                      xmit->buf, bytes_to_transmit,
+			                      DMA_XFER_MEMORY_TO_DEVICE | DMA_XFER_UNIT_BYTE);
+			ntasks += n;
+			xfer_size += bytes_to_transmit;
+		}
+
+		/* Tail moves on completion, the DMA is still reading the data */
+		pp->tx_size = xfer_size;
+		dma_setup_sg_xfer(pp->dma_tx_channel, pp->tx_tasks, ntasks,
+		                  DMA_XFER_MEMORY_TO_DEVICE | DMA_XFER_UNIT_BYTE);
+	}
+	else
+	{
+		xfer_size = min(bytes_to_transmit, pp->dma_buffer_size);
+		dma_memcpy(pp->dma_tx_buffer, xmit->buf + xmit->tail, xfer_size);
+		xmit->tail = (xmit->tail + xfer_size) & (UART_XMIT_SIZE - 1);
+		port->icount.tx += xfer_size;
+		dma_setup_xfer(pp->dma_tx_channel,
+									 port->membase + LM3S_UART_DR_OFFSET,
+									 pp->dma_tx_buffer,
+									 xfer_size,
+									 DMA_XFER_MEMORY_TO_DEVICE | DMA_XFER_UNIT_BYTE);
+	}
 	dma_start_xfer(pp->dma_tx_channel);
 
 	dev_vdbg(port->dev, "%s: dma_ch %x, xfer_size %u, dst %p\n",
@@ -650,7 +757,7 @@ static irqreturn_t __sram lm3s_interrupt(int irq, void *data)
 	dev_vdbg(port->dev, "%s ISR 0x%x\n", __func__, isr);
 
 #ifdef CONFIG_LM3S_DMA
-	if (dma_ack_interrupt(pp->dma_rx_channel))
+	if (dma_ack_interrupt(pp->dma_rx_channel) || (isr & UART_MIS_RTMIS))
 	{
 		dev_vdbg(port->dev, "%s RX\n", __func__);
 		lm3s_rx_chars(pp);
@@ -659,7 +766,9 @@ static irqreturn_t __sram lm3s_interrupt(int irq, void *data)
 	if (dma_ack_interrupt(pp->dma_tx_channel))
 	{
 		dev_vdbg(port->dev, "%s TX\n", __func__);
+		spin_lock(&port->lock);
 		lm3s_tx_chars(pp);
+		spin_unlock(&port->lock);
 	}
 #else
   if (isr & (UART_MIS_RXMIS | UART_MIS_RTMIS))
@@ -696,7 +805,8 @@ static void lm3s_config_port(struct uart_port *port, int flags)
 #ifdef CONFIG_LM3S_DMA
 	dev_vdbg(port->dev, "%s setup channel\n", __func__);
 	dma_setup_channel(pp->dma_tx_channel, DMA_DEFAULT_CONFIG);
-	dma_setup_channel(pp->dma_rx_channel, DMA_DEFAULT_CONFIG);
+	/* Bursts only, so the receive timeout sees the bytes left in the FIFO */
+	dma_setup_channel(pp->dma_rx_channel, DMA_USE_BURST);
 #endif
 }
 
@@ -740,6 +850,9 @@ static struct uart_ops lm3s_uart_ops = {
   .set_mctrl  = lm3s_set_mctrl,
   .start_tx = lm3s_start_tx,
   .stop_tx  = lm3s_stop_tx,
+#ifdef CONFIG_LM3S_DMA
+  .flush_buffer = lm3s_flush_buffer,
+#endif
   .stop_rx  = lm3s_stop_rx,
   .enable_ms  = lm3s_enable_ms,
   .break_ctl  = lm3s_break_ctl,
@@ -871,13 +984,7 @@ static int __devinit lm3s_probe(struct platform_device *pdev)
 		pp->tx_busy        = 0;
 
 		pp->dma_rx_channel = platp[i].dma_rx_channel;
-		pp->rx_slot_a      = platp[i].dma_rx_buffer;
-		pp->rx_slot_b      = (char*)pp->rx_slot_a + RX_SLOT_SIZE(pp);
-		pp->rx_busy        = 0;
-
-		pp->cur_bytes_received = 0;
-
-		INIT_WORK(&pp->rx_work, do_rx_chars);
+		pp->rx_ring        = platp[i].dma_rx_buffer;
 #endif
 
     port->dev = &pdev->dev;
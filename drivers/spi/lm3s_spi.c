@@ -32,7 +32,6 @@
 #endif
 
 #include <linux/clk.h>
-#include <linux/completion.h>
 #include <linux/delay.h>
 #include <linux/err.h>
 #include <linux/gpio.h>
@@ -41,10 +40,11 @@
 #include <linux/io.h>
 #include <linux/irq.h>
 #include <linux/kernel.h>
+#include <linux/list.h>
 #include <linux/module.h>
 #include <linux/platform_device.h>
+#include <linux/spinlock.h>
 #include <linux/spi/spi.h>
-#include <linux/spi/spi_bitbang.h>
 #include <linux/types.h>
 
 #include <mach/lm3s_spi.h>
@@ -61,6 +61,11 @@
 #define LM3S_TXFIFO_WORDS  8
 #define CONFIG_SSI_TXLIMIT (LM3S_TXFIFO_WORDS/2)
 
+#ifdef CONFIG_SPI_LM3S_ZERO_COPY
+/* Max number of DMA_MAX_TRANSFER_SIZE chunks chained per interrupt */
+#  define LM3S_SG_TASKS    16
+#endif
+
 /***************************************************************************/
 /*                         Data structures                                 */
 /***************************************************************************/
@@ -69,6 +74,7 @@ struct spi_lm3s_config {
   uint32_t cpsdvsr;
   uint32_t cr0;
   uint32_t gpio_chipselect;
+  uint32_t gpio_chipselect_data;          /* Masked DATA alias of the CS pin */
 
   uint32_t mode;
   uint32_t bits_per_word;
@@ -78,12 +84,22 @@ struct spi_lm3s_config {
 /***************************************************************************/
 
 struct spi_lm3s_data {
-  struct spi_bitbang bitbang;
+  struct spi_master *master;
+
+  spinlock_t lock;                        /* Protects the message queue */
+  struct list_head queue;                 /* Messages waiting for the bus */
+  int busy;                               /* Someone is working the queue */
+  int shutdown;                           /* Master is going away */
+  int cs_pending;                         /* Select the chip once set up */
+  struct spi_message *cur_msg;            /* Message in progress */
+  struct spi_transfer *cur_xfer;          /* Transfer in progress */
+  struct spi_lm3s_config *cur_config;     /* Settings of the current transfer */
+  struct spi_lm3s_config xfer_config;     /* Per-transfer speed/word overrides */
 
-  struct completion xfer_done;
   void *base;
   int irq;
   uint32_t *chipselect;
+  uint32_t rcgc1_mask;          /* Clock gate of this SSI instance */
 
   void  *txbuffer;              /* Source buffer */
   void  *rxbuffer;              /* Destination buffer */
@@ -100,10 +116,24 @@ struct spi_lm3s_data {
 	void *dma_rx_buffer;
 	void *dma_tx_buffer;
 	uint32_t xfer_size;
+
+#ifdef CONFIG_SPI_LM3S_ZERO_COPY
+	int zero_copy;                /* Current transfer uses caller buffers */
+	struct lm3s_dma_channel rx_tasks[LM3S_SG_TASKS];
+	struct lm3s_dma_channel tx_tasks[LM3S_SG_TASKS];
+#endif
+	unsigned long zero_copy_xfers; /* Transfers done from caller buffers */
+	unsigned long bounce_xfers;    /* Transfers done through SRAM buffers */
 #else
   void  (*txword)(struct spi_lm3s_data *priv);
   void  (*rxword)(struct spi_lm3s_data *priv);
 #endif
+
+  int      hw_valid;            /* CR0/CPSR below are loaded and SSE is set */
+  uint32_t hw_cr0;              /* Last value written to CR0 */
+  uint32_t hw_cpsdvsr;          /* Last value written to CPSR */
+  unsigned long reconfigs;      /* Transfers that reprogrammed the SSI */
+  unsigned long reconfigs_skipped; /* Transfers that reused the settings */
 };
 
 /***************************************************************************/
@@ -144,21 +174,21 @@ static void ssi_enable(struct spi_lm3s_data *priv)
 
 /***************************************************************************/
 
-static void enable_ssi_clock(void)
+static void enable_ssi_clock(struct spi_lm3s_data *priv)
 {
   uint32_t regval;
   regval = lm3s_getreg32(LM3S_SYSCON_RCGC1);
-  regval |= SYSCON_RCGC1_SSI0;
+  regval |= priv->rcgc1_mask;
   lm3s_putreg32(regval, LM3S_SYSCON_RCGC1);
 }
 
 /***************************************************************************/
 
-static void disable_ssi_clock(void)
+static void disable_ssi_clock(struct spi_lm3s_data *priv)
 {
   uint32_t regval;
   regval = lm3s_getreg32(LM3S_SYSCON_RCGC1);
-  regval &= ~SYSCON_RCGC1_SSI0;
+  regval &= ~priv->rcgc1_mask;
   lm3s_putreg32(regval, LM3S_SYSCON_RCGC1);
 }
 
@@ -276,14 +306,14 @@ static int lm3s_config(struct spi_lm3s_config *config,
 #ifndef CONFIG_LM3S_DMA
 static void __sram ssi_txnull(struct spi_lm3s_data *priv)
 {
-  dev_vdbg(&priv->bitbang.master->dev, "TX: ->0x0000\n");
+  dev_vdbg(&priv->master->dev, "TX: ->0x0000\n");
   ssi_putreg(priv, LM3S_SSI_DR_OFFSET, 0x0000);
 }
 
 static void __sram ssi_txuint16(struct spi_lm3s_data *priv)
 {
   uint16_t *ptr    = (uint16_t*)priv->txbuffer;
-  dev_vdbg(&priv->bitbang.master->dev, "TX: %p->%04x\n", ptr, *ptr);
+  dev_vdbg(&priv->master->dev, "TX: %p->%04x\n", ptr, *ptr);
   ssi_putreg(priv, LM3S_SSI_DR_OFFSET, (uint32_t)(*ptr++));
   priv->txbuffer = (void*)ptr;
 }
@@ -291,7 +321,7 @@ static void __sram ssi_txuint16(struct spi_lm3s_data *priv)
 static void __sram ssi_txuint8(struct spi_lm3s_data *priv)
 {
   uint8_t *ptr   = (uint8_t*)priv->txbuffer;
-  dev_vdbg(&priv->bitbang.master->dev, "TX: %p->%02x\n", ptr, *ptr);
+  dev_vdbg(&priv->master->dev, "TX: %p->%02x\n", ptr, *ptr);
   ssi_putreg(priv, LM3S_SSI_DR_OFFSET, (uint32_t)(*ptr++));
   priv->txbuffer = (void*)ptr;
 }
@@ -299,14 +329,14 @@ static void __sram ssi_txuint8(struct spi_lm3s_data *priv)
 static void __sram ssi_rxnull(struct spi_lm3s_data *priv)
 {
   uint32_t regval  = ssi_getreg(priv, LM3S_SSI_DR_OFFSET);
-  dev_vdbg(&priv->bitbang.master->dev, "RX: discard %04x\n", regval);
+  dev_vdbg(&priv->master->dev, "RX: discard %04x\n", regval);
 }
 
 static void __sram ssi_rxuint16(struct spi_lm3s_data *priv)
 {
   uint16_t *ptr    = (uint16_t*)priv->rxbuffer;
   *ptr           = (uint16_t)ssi_getreg(priv, LM3S_SSI_DR_OFFSET);
-  dev_vdbg(&priv->bitbang.master->dev, "RX: %p<-%04x\n", ptr, *ptr);
+  dev_vdbg(&priv->master->dev, "RX: %p<-%04x\n", ptr, *ptr);
   priv->rxbuffer = (void*)(++ptr);
 }
 
@@ -314,7 +344,7 @@ static void __sram ssi_rxuint8(struct spi_lm3s_data *priv)
 {
   uint8_t *ptr   = (uint8_t*)priv->rxbuffer;
   *ptr           = (uint8_t)ssi_getreg(priv, LM3S_SSI_DR_OFFSET);
-  dev_vdbg(&priv->bitbang.master->dev, "RX: %p<-%02x\n", ptr, *ptr);
+  dev_vdbg(&priv->master->dev, "RX: %p<-%02x\n", ptr, *ptr);
   priv->rxbuffer = (void*)(++ptr);
 }
 #endif
@@ -449,9 +479,81 @@ static void __sram ssi_performrx(struct spi_lm3s_data *priv)
 
 /***************************************************************************/
 
+#ifdef CONFIG_SPI_LM3S_ZERO_COPY
+static int spi_lm3s_can_zero_copy(struct spi_transfer *transfer,
+                                  uint32_t bits_per_word)
+{
+  const void *bufs[2] = { transfer->tx_buf, transfer->rx_buf };
+  int i;
+
+  for (i = 0; i < 2; i++)
+  {
+    if (!bufs[i])
+      continue;
+    if (bits_per_word > 8 && ((uint32_t)bufs[i] & 1))
+      return 0;
+    if (!dma_buffer_reachable(bufs[i], transfer->len))
+      return 0;
+  }
+
+  return 1;
+}
+
+/***************************************************************************/
+
+/*
+ * Chain up to LM3S_SG_TASKS chunks straight from/to the caller buffers.
+ * A missing tx or rx buffer is replaced by the SRAM bounce buffer which
+ * is then simply reused by every task of the chain.
+ */
+static void __sram spi_lm3s_start_zero_copy(struct spi_lm3s_data *priv)
+{
+  void *dr = priv->base + LM3S_SSI_DR_OFFSET;
+  char *tx = priv->txbuffer;
+  char *rx = priv->rxbuffer;
+  size_t left = priv->ntxwords;
+  int ntasks = 0;
+
+  priv->xfer_size = 0;
+
+  while (left && ntasks < LM3S_SG_TASKS)
+  {
+    size_t chunk = min_t(size_t, left, DMA_MAX_TRANSFER_SIZE);
+
+    dma_setup_sg_task(&priv->rx_tasks[ntasks], rx ? rx : priv->dma_rx_buffer,
+                      dr, chunk, priv->dma_rx_flags);
+    dma_setup_sg_task(&priv->tx_tasks[ntasks], dr,
+                      tx ? tx : priv->dma_tx_buffer, chunk, priv->dma_tx_flags);
+
+    if (rx)
+      rx += chunk;
+    if (tx)
+      tx += chunk;
+
+    left -= chunk;
+    priv->xfer_size += chunk;
+    ntasks++;
+  }
+
+  dev_vdbg(&priv->master->dev, "%s: xfer_size %u, %d tasks\n",
+           __func__, priv->xfer_size, ntasks);
+
+  dma_setup_sg_xfer(priv->dma_rx_channel, priv->rx_tasks, ntasks, priv->dma_rx_flags);
+  dma_setup_sg_xfer(priv->dma_tx_channel, priv->tx_tasks, ntasks, priv->dma_tx_flags);
+  dma_start_xfer(priv->dma_rx_channel);
+  dma_start_xfer(priv->dma_tx_channel);
+}
+#endif
+
+/***************************************************************************/
+
+/*
+ * Move the current transfer forward. Returns 0 once it is complete and
+ * 1 while more is to come.
+ */
 static int __sram spi_lm3s_transfer_step(struct spi_lm3s_data *priv)
 {
-  dev_vdbg(&priv->bitbang.master->dev, "%s: ntxwords %d, nrxwords %d, nwords %d, SR %08x\n",
+  dev_vdbg(&priv->master->dev, "%s: ntxwords %d, nrxwords %d, nwords %d, SR %08x\n",
           __func__, priv->ntxwords, priv->nrxwords, priv->nwords,
           ssi_getreg(priv, LM3S_SSI_SR_OFFSET));
 
@@ -459,12 +561,18 @@ static int __sram spi_lm3s_transfer_step(struct spi_lm3s_data *priv)
 		/* Check if the transfer is complete */
   if (priv->ntxwords == 0)
   {
-		dev_dbg(&priv->bitbang.master->dev, "Transfer complete\n");
-    /* Wake up the waiting thread */
-    complete(&priv->xfer_done);
+		dev_dbg(&priv->master->dev, "Transfer complete\n");
     return 0;
   }
 
+#ifdef CONFIG_SPI_LM3S_ZERO_COPY
+	if( priv->zero_copy )
+	{
+		spi_lm3s_start_zero_copy(priv);
+		return 1;
+	}
+#endif
+
 	priv->xfer_size = min(priv->ntxwords, DMA_MAX_TRANSFER_SIZE);
 
 	if( priv->txbuffer )
@@ -473,7 +581,7 @@ static int __sram spi_lm3s_transfer_step(struct spi_lm3s_data *priv)
 		priv->txbuffer = (char*)priv->txbuffer + priv->xfer_size;
 	}
 
-	dev_vdbg(&priv->bitbang.master->dev, "%s: xfer_size %u\n", __func__, priv->xfer_size);
+	dev_vdbg(&priv->master->dev, "%s: xfer_size %u\n", __func__, priv->xfer_size);
 
 	dma_setup_xfer(priv->dma_rx_channel, priv->dma_rx_buffer,
 								 priv->base + LM3S_SSI_DR_OFFSET, priv->xfer_size, priv->dma_rx_flags);
@@ -488,7 +596,7 @@ static int __sram spi_lm3s_transfer_step(struct spi_lm3s_data *priv)
   /* Handle incoming Rx FIFO transfers */
   ssi_performrx(priv);
 
-  dev_vdbg(&priv->bitbang.master->dev, "ntxwords: %d nrxwords: %d nwords: %d SR: %08x IM: %08x\n",
+  dev_vdbg(&priv->master->dev, "ntxwords: %d nrxwords: %d nwords: %d SR: %08x IM: %08x\n",
           priv->ntxwords, priv->nrxwords, priv->nwords,
           ssi_getreg(priv, LM3S_SSI_SR_OFFSET),
           ssi_getreg(priv, LM3S_SSI_IM_OFFSET));
@@ -499,12 +607,9 @@ static int __sram spi_lm3s_transfer_step(struct spi_lm3s_data *priv)
 #ifndef POLLING_MODE
     /* Yes.. Disable all SSI interrupt sources */
     ssi_putreg(priv, LM3S_SSI_IM_OFFSET, 0);
-
-    /* Wake up the waiting thread */
-    complete(&priv->xfer_done);
 #endif
 
-    dev_dbg(&priv->bitbang.master->dev, "Transfer complete\n");
+    dev_dbg(&priv->master->dev, "Transfer complete\n");
 
     return 0;
   }
@@ -515,14 +620,24 @@ static int __sram spi_lm3s_transfer_step(struct spi_lm3s_data *priv)
 
 /***************************************************************************/
 
+static void __sram spi_lm3s_transfer_done(struct spi_lm3s_data *priv,
+                                          unsigned long *flags);
+static void __sram spi_lm3s_pump(struct spi_lm3s_data *priv,
+                                 unsigned long *flags);
+
+/***************************************************************************/
+
 #ifndef POLLING_MODE
 static irqreturn_t __sram spi_lm3s_isr(int irq, void *dev_id)
 {
 	uint32_t regval;
-  int ntxd;
+  int more = 1;
   struct spi_lm3s_data *priv = dev_id;
+  unsigned long flags;
+
+  dev_vdbg(&priv->master->dev, "%s\n", __func__);
 
-  dev_vdbg(&priv->bitbang.master->dev, "%s\n", __func__);
+  spin_lock_irqsave(&priv->lock, flags);
 
   /* Clear pending interrupts */
   regval = ssi_getreg(priv, LM3S_SSI_RIS_OFFSET);
@@ -533,6 +648,16 @@ static irqreturn_t __sram spi_lm3s_isr(int irq, void *dev_id)
 
 	if( dma_ack_interrupt(priv->dma_rx_channel) )
 	{
+#ifdef CONFIG_SPI_LM3S_ZERO_COPY
+		if( priv->zero_copy )
+		{
+			if( priv->txbuffer )
+				priv->txbuffer = (char*)priv->txbuffer + priv->xfer_size;
+			if( priv->rxbuffer )
+				priv->rxbuffer = (char*)priv->rxbuffer + priv->xfer_size;
+		}
+		else
+#endif
 		if( priv->rxbuffer )
 		{
 			dma_memcpy(priv->rxbuffer, priv->dma_rx_buffer, priv->xfer_size);
@@ -541,139 +666,384 @@ static irqreturn_t __sram spi_lm3s_isr(int irq, void *dev_id)
 		priv->nrxwords += priv->xfer_size;
 		priv->ntxwords -= priv->xfer_size;
 
-		spi_lm3s_transfer_step(priv);
+		more = spi_lm3s_transfer_step(priv);
 	}
 #else
-	spi_lm3s_transfer_step(priv);
+	more = spi_lm3s_transfer_step(priv);
 #endif
 
+  /* Finish the transfer and carry on with the queue */
+  if (!more && priv->cur_msg)
+  {
+    spi_lm3s_transfer_done(priv, &flags);
+    spi_lm3s_pump(priv, &flags);
+  }
+
+  spin_unlock_irqrestore(&priv->lock, flags);
+
   return IRQ_HANDLED;
 }
 #endif
 
 /***************************************************************************/
 
-static int __sram spi_lm3s_transfer(struct spi_device *spi,
-        struct spi_transfer *transfer)
+static void __sram spi_lm3s_chipselect(struct spi_device *spi, int active)
+{
+  struct spi_lm3s_config *priv_dev = spi_get_ctldata(spi);
+
+  int dev_is_lowactive = !(spi->mode & SPI_CS_HIGH);
+  int value = dev_is_lowactive ^ active;
+
+  dev_dbg(&spi->dev, "%s: cs %i [0x%X], value %i\n", __func__,
+          spi->chip_select, priv_dev->gpio_chipselect, value);
+
+  lm3s_gpioputdata(priv_dev->gpio_chipselect_data, value ? 0xff : 0);
+}
+
+/***************************************************************************/
+
+/*
+ * Select the settings of a transfer: the device defaults computed in
+ * spi_lm3s_setup() unless the transfer overrides speed or word size.
+ */
+static struct spi_lm3s_config * __sram spi_lm3s_setupxfer(struct spi_lm3s_data *priv,
+                                                         struct spi_device *spi,
+                                                         struct spi_transfer *t)
+{
+  struct spi_lm3s_config *priv_dev = spi_get_ctldata(spi);
+  uint32_t bits_per_word = t->bits_per_word;
+  uint32_t speed_hz = t->speed_hz;
+
+  if (!speed_hz && !bits_per_word)
+    return priv_dev;
+
+  if (!speed_hz)
+    speed_hz = spi->max_speed_hz;
+  if (!bits_per_word)
+    bits_per_word = spi->bits_per_word;
+
+  dev_dbg(&spi->dev, "%s speed_hz %i, bits_per_word %i\n", __func__,
+          speed_hz, bits_per_word);
+
+  if (priv->xfer_config.mode != spi->mode ||
+      priv->xfer_config.bits_per_word != bits_per_word ||
+      priv->xfer_config.speed_hz != speed_hz)
+    lm3s_config(&priv->xfer_config, spi->mode, bits_per_word, speed_hz);
+  priv->xfer_config.gpio_chipselect = priv_dev->gpio_chipselect;
+  priv->xfer_config.gpio_chipselect_data = priv_dev->gpio_chipselect_data;
+
+  return &priv->xfer_config;
+}
+
+/***************************************************************************/
+
+/*
+ * Program the SSI for the current transfer and select the chip if that
+ * is pending. spi_lm3s_pump() then kicks it off with
+ * spi_lm3s_transfer_step().
+ *
+ * Called with priv->lock held.
+ */
+static void __sram spi_lm3s_start_transfer(struct spi_lm3s_data *priv)
 {
-  struct spi_lm3s_data *priv_master = spi_master_get_devdata(spi->master);
-  struct spi_lm3s_config *dev_priv = spi_get_ctldata(spi);
+  struct spi_device *spi = priv->cur_msg->spi;
+  struct spi_transfer *transfer = priv->cur_xfer;
+  struct spi_lm3s_config *config;
+
+  config = spi_lm3s_setupxfer(priv, spi, transfer);
+  priv->cur_config = config;
 
   dev_dbg(&spi->dev, "%s: tx_buf %p, rx_buf %p, len %u, cr0 0x%x, cpsdvsr 0x%x\n", __func__,
      transfer->tx_buf, transfer->rx_buf, transfer->len,
-     dev_priv->cr0, dev_priv->cpsdvsr);
+     config->cr0, config->cpsdvsr);
 
   /* Set up to perform the transfer */
 
-  priv_master->txbuffer     = (uint8_t*)transfer->tx_buf; /* Source buffer */
-  priv_master->rxbuffer     = (uint8_t*)transfer->rx_buf; /* Destination buffer */
-  priv_master->ntxwords     = transfer->len;              /* Number of words left to send */
-  priv_master->nrxwords     = 0;                          /* Number of words received */
-  priv_master->nwords       = transfer->len;              /* Total number of exchanges */
+  priv->txbuffer     = (uint8_t*)transfer->tx_buf; /* Source buffer */
+  priv->rxbuffer     = (uint8_t*)transfer->rx_buf; /* Destination buffer */
+  priv->ntxwords     = transfer->len;              /* Number of words left to send */
+  priv->nrxwords     = 0;                          /* Number of words received */
+  priv->nwords       = transfer->len;              /* Total number of exchanges */
 
 #ifdef CONFIG_LM3S_DMA
-	priv_master->dma_tx_flags = DMA_XFER_MEMORY_TO_DEVICE;
-	priv_master->dma_rx_flags = DMA_XFER_DEVICE_TO_MEMORY;
+	priv->dma_tx_flags = DMA_XFER_MEMORY_TO_DEVICE;
+	priv->dma_rx_flags = DMA_XFER_DEVICE_TO_MEMORY;
 
-	if (dev_priv->bits_per_word > 8)
+	if (config->bits_per_word > 8)
 	{
-		priv_master->dma_tx_flags |= DMA_XFER_UNIT_WORD;
-		priv_master->dma_rx_flags |= DMA_XFER_UNIT_WORD;
+		priv->dma_tx_flags |= DMA_XFER_UNIT_WORD;
+		priv->dma_rx_flags |= DMA_XFER_UNIT_WORD;
 	}
   else
 	{
-		priv_master->dma_tx_flags |= DMA_XFER_UNIT_BYTE;
-		priv_master->dma_rx_flags |= DMA_XFER_UNIT_BYTE;
+		priv->dma_tx_flags |= DMA_XFER_UNIT_BYTE;
+		priv->dma_rx_flags |= DMA_XFER_UNIT_BYTE;
 	}
+
+#ifdef CONFIG_SPI_LM3S_ZERO_COPY
+	priv->zero_copy = spi_lm3s_can_zero_copy(transfer, config->bits_per_word);
+	if( priv->zero_copy )
+		priv->zero_copy_xfers++;
+	else
+#endif
+		priv->bounce_xfers++;
 #else
-  if (!priv_master->txbuffer)
-    priv_master->txword = ssi_txnull;
+  if (!priv->txbuffer)
+    priv->txword = ssi_txnull;
   else
   {
-    if (dev_priv->bits_per_word > 8)
-      priv_master->txword = ssi_txuint16;
+    if (config->bits_per_word > 8)
+      priv->txword = ssi_txuint16;
     else
-      priv_master->txword = ssi_txuint8;
+      priv->txword = ssi_txuint8;
   }
 
-  if (!priv_master->rxbuffer)
-    priv_master->rxword = ssi_rxnull;
+  if (!priv->rxbuffer)
+    priv->rxword = ssi_rxnull;
   else
   {
-    if (dev_priv->bits_per_word > 8)
-      priv_master->rxword = ssi_rxuint16;
+    if (config->bits_per_word > 8)
+      priv->rxword = ssi_rxuint16;
     else
-      priv_master->rxword = ssi_rxuint8;
+      priv->rxword = ssi_rxuint8;
   }
 #endif
 
-  /* Set CR1 */
-  ssi_putreg(priv_master, LM3S_SSI_CR1_OFFSET, 0);
+  /*
+   * The SSI stays enabled between transfers, so only go through the
+   * disable/reprogram/enable sequence when the clock or frame format
+   * actually differs from what the hardware already holds.
+   */
+  if (priv->hw_valid &&
+      priv->hw_cr0 == config->cr0 && priv->hw_cpsdvsr == config->cpsdvsr)
+  {
+    priv->reconfigs_skipped++;
+  }
+  else
+  {
+    /* Set CR1, this also clears SSE */
+    ssi_putreg(priv, LM3S_SSI_CR1_OFFSET, 0);
+
+    /* Set CPDVSR */
+    ssi_putreg(priv, LM3S_SSI_CPSR_OFFSET, config->cpsdvsr);
 
-  /* Set CPDVSR */
-  ssi_putreg(priv_master, LM3S_SSI_CPSR_OFFSET, dev_priv->cpsdvsr);
+    /* Set CR0 */
+    ssi_putreg(priv, LM3S_SSI_CR0_OFFSET, config->cr0);
 
-  /* Set CR0 */
-  ssi_putreg(priv_master, LM3S_SSI_CR0_OFFSET, dev_priv->cr0);
+    ssi_enable(priv);
 
-#ifndef POLLING_MODE
-  init_completion(&priv_master->xfer_done);
-#endif
+    priv->hw_cr0 = config->cr0;
+    priv->hw_cpsdvsr = config->cpsdvsr;
+    priv->hw_valid = 1;
+    priv->reconfigs++;
+  }
 
-  ssi_enable(priv_master);
+  /* Only select the chip now that clock polarity and rate are right */
+  if (priv->cs_pending)
+  {
+    spi_lm3s_chipselect(spi, 1);
+    priv->cs_pending = 0;
+  }
+}
 
-#ifndef POLLING_MODE
-  spi_lm3s_transfer_step(priv_master);
-#else
-  while( spi_lm3s_transfer_step(priv_master) ) {};
-#endif
+/***************************************************************************/
 
-#ifndef POLLING_MODE
-  wait_for_completion(&priv_master->xfer_done);
+/*
+ * The current transfer is over: apply its delay and chip select change,
+ * then step to the next transfer of the message, or give the message back
+ * if it was the last one.
+ *
+ * Called with priv->lock held; the lock is dropped around msg->complete()
+ * so the callback may queue new messages.
+ */
+static void __sram spi_lm3s_transfer_done(struct spi_lm3s_data *priv,
+                                          unsigned long *flags)
+{
+  struct spi_message *msg = priv->cur_msg;
+  struct spi_transfer *t = priv->cur_xfer;
+
+  msg->actual_length += t->len;
+
+  if (t->delay_usecs)
+    udelay(t->delay_usecs);
+
+  if (t->transfer_list.next == &msg->transfers)
+  {
+    /* cs_change on the last transfer keeps the chip selected */
+    if (!t->cs_change)
+      spi_lm3s_chipselect(msg->spi, 0);
+
+    priv->cur_msg = NULL;
+    priv->cur_xfer = NULL;
+
+    msg->status = 0;
+    if (msg->complete)
+    {
+      spin_unlock_irqrestore(&priv->lock, *flags);
+      msg->complete(msg->context);
+      spin_lock_irqsave(&priv->lock, *flags);
+    }
+    return;
+  }
+
+  if (t->cs_change)
+  {
+    /* Short deselect between transfers to terminate a command */
+    spi_lm3s_chipselect(msg->spi, 0);
+    ndelay(100);
+    priv->cs_pending = 1;
+  }
+
+  priv->cur_xfer = list_entry(t->transfer_list.next, struct spi_transfer,
+                              transfer_list);
+}
+
+/***************************************************************************/
+
+/*
+ * Run transfers off the queue until it is empty or a transfer has to wait
+ * for the completion interrupt, which then calls back in here. This is a
+ * loop rather than a chain of calls, so a long queue of short transfers
+ * does not eat into the stack.
+ *
+ * In polling mode the FIFOs are worked with the lock dropped; priv->busy
+ * keeps everybody else to just queueing meanwhile.
+ *
+ * Called with priv->lock held.
+ */
+static void __sram spi_lm3s_pump(struct spi_lm3s_data *priv,
+                                 unsigned long *flags)
+{
+  priv->busy = 1;
+
+  for (;;)
+  {
+    if (!priv->cur_msg)
+    {
+      struct spi_message *msg;
+
+      if (list_empty(&priv->queue))
+        break;
+
+      msg = list_first_entry(&priv->queue, struct spi_message, queue);
+      list_del_init(&msg->queue);
+
+      priv->cur_msg = msg;
+      priv->cur_xfer = list_first_entry(&msg->transfers, struct spi_transfer,
+                                        transfer_list);
+      priv->cs_pending = 1;
+    }
+
+    spi_lm3s_start_transfer(priv);
+
+#ifdef POLLING_MODE
+    spin_unlock_irqrestore(&priv->lock, *flags);
+    while (spi_lm3s_transfer_step(priv))
+      cpu_relax();
+    spin_lock_irqsave(&priv->lock, *flags);
+#else
+    /* Anything but an empty transfer finishes in spi_lm3s_isr() */
+    if (spi_lm3s_transfer_step(priv))
+      return;
 #endif
 
-  ssi_disable(priv_master);
+    spi_lm3s_transfer_done(priv, flags);
+  }
 
-  return transfer->len;
+  priv->busy = 0;
 }
 
 /***************************************************************************/
 
-static int spi_lm3s_setupxfer(struct spi_device *spi,
-         struct spi_transfer *t)
+/*
+ * Queue a message. If the bus is idle the first transfer starts right
+ * away; the following ones are chained from the completion interrupt so
+ * back-to-back messages never wait for a thread to be scheduled. In
+ * polling mode the queue is run here, with the lock dropped around the
+ * FIFO work.
+ */
+static int spi_lm3s_transfer(struct spi_device *spi, struct spi_message *msg)
 {
-  struct spi_lm3s_config *priv_dev = spi_get_ctldata(spi);
+  struct spi_lm3s_data *priv = spi_master_get_devdata(spi->master);
+  struct spi_transfer *t;
+  unsigned long flags;
 
-  uint32_t mode = spi->mode;
-  uint32_t bits_per_word = t ? t->bits_per_word : spi->bits_per_word;
-  uint32_t speed_hz = t ? t->speed_hz : spi->max_speed_hz;
+  list_for_each_entry(t, &msg->transfers, transfer_list)
+  {
+    if (!t->tx_buf && !t->rx_buf && t->len)
+      return -EINVAL;
+    if (t->bits_per_word && (t->bits_per_word < 4 || t->bits_per_word > 16))
+      return -EINVAL;
+  }
 
-  if (!speed_hz)
-    speed_hz = spi->max_speed_hz;
-  if (!bits_per_word)
-    bits_per_word = spi->bits_per_word;
+  if (list_empty(&msg->transfers))
+    return -EINVAL;
 
-  dev_dbg(&spi->dev, "%s speed_hz %i, mode %i\n", __func__, speed_hz, mode);
+  msg->actual_length = 0;
+  msg->status = -EINPROGRESS;
 
-  lm3s_config(priv_dev, mode, bits_per_word, speed_hz);
+  spin_lock_irqsave(&priv->lock, flags);
+  if (priv->shutdown)
+  {
+    spin_unlock_irqrestore(&priv->lock, flags);
+    return -ESHUTDOWN;
+  }
+  list_add_tail(&msg->queue, &priv->queue);
+  if (!priv->busy)
+    spi_lm3s_pump(priv, &flags);
+  spin_unlock_irqrestore(&priv->lock, flags);
 
   return 0;
 }
 
 /***************************************************************************/
 
-static void spi_lm3s_chipselect(struct spi_device *spi, int is_active)
+/*
+ * Refuse new messages, take the waiting ones off the queue into failed and
+ * give the message on the bus a while to finish.
+ */
+static void spi_lm3s_stop_queue(struct spi_lm3s_data *priv,
+                                struct list_head *failed)
 {
-  struct spi_lm3s_config *priv_dev = spi_get_ctldata(spi);
+  unsigned long flags;
+  int tries = 100;
 
-  int active = is_active != BITBANG_CS_INACTIVE;
-  int dev_is_lowactive = !(spi->mode & SPI_CS_HIGH);
-  int value = dev_is_lowactive ^ active;
+  spin_lock_irqsave(&priv->lock, flags);
+  priv->shutdown = 1;
+  list_splice_init(&priv->queue, failed);
 
-  dev_dbg(&spi->dev, "%s: cs %i [0x%X], value %i\n", __func__,
-          spi->chip_select, priv_dev->gpio_chipselect, value);
+  while (priv->busy && tries--)
+  {
+    spin_unlock_irqrestore(&priv->lock, flags);
+    msleep(10);
+    spin_lock_irqsave(&priv->lock, flags);
+  }
+  spin_unlock_irqrestore(&priv->lock, flags);
+}
+
+/*
+ * Give messages which never made it onto the bus back to their owners.
+ * Called with the SSI and its interrupt shut down.
+ */
+static void spi_lm3s_fail_queue(struct spi_lm3s_data *priv,
+                                struct list_head *failed)
+{
+  struct spi_message *msg, *tmp;
 
-  lm3s_gpiowrite(priv_dev->gpio_chipselect, value);
+  /* A message stuck on the bus is not going to finish either */
+  if (priv->cur_msg)
+  {
+    list_add(&priv->cur_msg->queue, failed);
+    priv->cur_msg = NULL;
+  }
+
+  list_for_each_entry_safe(msg, tmp, failed, queue)
+  {
+    list_del_init(&msg->queue);
+    msg->status = -ESHUTDOWN;
+    if (msg->complete)
+      msg->complete(msg->context);
+  }
 }
 
 /***************************************************************************/
@@ -695,8 +1065,9 @@ static int spi_lm3s_setup(struct spi_device *spi)
   spi_set_ctldata(spi, priv_dev);
 
   priv_dev->gpio_chipselect = priv_master->chipselect[spi->chip_select];
+  priv_dev->gpio_chipselect_data = lm3s_gpiodata(priv_dev->gpio_chipselect);
   lm3s_config(priv_dev, spi->mode, spi->bits_per_word, spi->max_speed_hz);
-  spi_lm3s_chipselect(spi, BITBANG_CS_INACTIVE);
+  spi_lm3s_chipselect(spi, 0);
 
   dev_dbg(&spi->dev, "%s: mode %d, %u bpw, %d hz\n", __func__,
      spi->mode, spi->bits_per_word, spi->max_speed_hz);
@@ -713,13 +1084,34 @@ static void spi_lm3s_cleanup(struct spi_device *spi)
 
 /***************************************************************************/
 
+static ssize_t spi_lm3s_show_stats(struct device *dev,
+                                   struct device_attribute *attr, char *buf)
+{
+  struct spi_master *master = dev_get_drvdata(dev);
+  struct spi_lm3s_data *priv = spi_master_get_devdata(master);
+  ssize_t len = 0;
+
+#ifdef CONFIG_LM3S_DMA
+  len += sprintf(buf + len, "zero_copy: %lu\nbounce: %lu\n",
+                 priv->zero_copy_xfers, priv->bounce_xfers);
+#endif
+  len += sprintf(buf + len, "reconfig: %lu\nreconfig_skipped: %lu\n",
+                 priv->reconfigs, priv->reconfigs_skipped);
+
+  return len;
+}
+
+static DEVICE_ATTR(stats, S_IRUGO, spi_lm3s_show_stats, NULL);
+
+/***************************************************************************/
+
 static int __devinit spi_lm3s_probe(struct platform_device *pdev)
 {
   struct spi_lm3s_master *lm3s_platform_info;
   struct spi_master *master;
   struct spi_lm3s_data *priv;
   struct resource *res;
-  int ret;
+  int ret, i;
 
   lm3s_platform_info = dev_get_platdata(&pdev->dev);
   if (!lm3s_platform_info) {
@@ -737,9 +1129,14 @@ static int __devinit spi_lm3s_probe(struct platform_device *pdev)
   master->num_chipselect = lm3s_platform_info->num_chipselect;
 
   priv = spi_master_get_devdata(master);
-  priv->bitbang.master = spi_master_get(master);
+  priv->master = spi_master_get(master);
   priv->chipselect = lm3s_platform_info->chipselect;
 
+  /* Boards that predate the field only have SSI0 */
+  priv->rcgc1_mask = lm3s_platform_info->rcgc1_mask;
+  if (!priv->rcgc1_mask)
+    priv->rcgc1_mask = SYSCON_RCGC1_SSI0;
+
 #ifdef CONFIG_LM3S_DMA
 	priv->dma_tx_buffer = lm3s_platform_info->dma_tx_buffer;
 	priv->dma_rx_buffer = lm3s_platform_info->dma_rx_buffer;
@@ -750,14 +1147,13 @@ static int __devinit spi_lm3s_probe(struct platform_device *pdev)
 	dma_setup_channel(priv->dma_rx_channel, DMA_DEFAULT_CONFIG);
 #endif
 
-  priv->bitbang.chipselect = spi_lm3s_chipselect;
-  priv->bitbang.setup_transfer = spi_lm3s_setupxfer;
-  priv->bitbang.txrx_bufs = spi_lm3s_transfer;
-  priv->bitbang.master->setup = spi_lm3s_setup;
-  priv->bitbang.master->cleanup = spi_lm3s_cleanup;
-  priv->bitbang.master->mode_bits = SPI_CPOL | SPI_CPHA | SPI_CS_HIGH;
+  master->transfer = spi_lm3s_transfer;
+  master->setup = spi_lm3s_setup;
+  master->cleanup = spi_lm3s_cleanup;
+  master->mode_bits = SPI_CPOL | SPI_CPHA | SPI_CS_HIGH;
 
-  init_completion(&priv->xfer_done);
+  spin_lock_init(&priv->lock);
+  INIT_LIST_HEAD(&priv->queue);
 
   res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
   if (!res) {
@@ -792,18 +1188,24 @@ static int __devinit spi_lm3s_probe(struct platform_device *pdev)
   }
 #endif
 
-  enable_ssi_clock();
+  for (i = 0; i < lm3s_platform_info->num_pins; i++)
+    lm3s_configgpio(lm3s_platform_info->pins[i]);
+
+  enable_ssi_clock(priv);
 
 #ifdef CONFIG_LM3S_DMA
 	lm3s_putreg32(SSI_DMACTL_RXDMAE | SSI_DMACTL_TXDMAE, priv->base + LM3S_SSI_DMACTL_OFFSET);
 #endif
 
-  ret = spi_bitbang_start(&priv->bitbang);
+  ret = spi_register_master(master);
   if (ret) {
-    dev_err(&pdev->dev, "bitbang start failed with %d\n", ret);
+    dev_err(&pdev->dev, "can't register master: %d\n", ret);
     goto out_free_irq;
   }
 
+  if (device_create_file(&pdev->dev, &dev_attr_stats))
+    dev_warn(&pdev->dev, "can't create stats file\n");
+
   dev_info(&pdev->dev, "probed\n");
 
   return ret;
@@ -830,12 +1232,22 @@ static int __devexit spi_lm3s_remove(struct platform_device *pdev)
   struct spi_master *master = platform_get_drvdata(pdev);
   struct resource *res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
   struct spi_lm3s_data *priv = spi_master_get_devdata(master);
+  LIST_HEAD(failed);
+
+  device_remove_file(&pdev->dev, &dev_attr_stats);
+
+  spi_unregister_master(master);
 
-  spi_bitbang_stop(&priv->bitbang);
+  spi_lm3s_stop_queue(priv, &failed);
+
+  ssi_disable(priv);
 
 #ifndef POLLING_MODE
   free_irq(priv->irq, priv);
 #endif
+
+  spi_lm3s_fail_queue(priv, &failed);
+
   iounmap(priv->base);
 
   spi_master_put(master);
@@ -844,7 +1256,7 @@ static int __devexit spi_lm3s_remove(struct platform_device *pdev)
 
   platform_set_drvdata(pdev, NULL);
 
-	disable_ssi_clock();
+	disable_ssi_clock(priv);
 
   return 0;
 }
@@ -266,6 +266,7 @@ static long do_sys_truncate(const char __user *pathname, loff_t length)
 	error = get_write_access(inode);
 	if (error)
 		goto mnt_drop_write_and_out;
+	exec_pool_invalidate_inode(inode);
 
 	/*
 	 * Make sure that there are no leases.  get_write_access() protects
@@ -804,6 +805,7 @@ static inline int __get_file_write_access(struct inode *inode,
 	error = get_write_access(inode);
 	if (error)
 		return error;
+	exec_pool_invalidate_inode(inode);
 	/*
 	 * Do not take mount writer counts on
 	 * special files since no writes to
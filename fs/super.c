@@ -21,6 +21,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/mm.h>
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/smp_lock.h>
@@ -318,6 +319,7 @@ void generic_shutdown_super(struct super_block *sb)
 		}
 		put_fs_excl();
 	}
+	exec_pool_invalidate_sb(sb);
 	spin_lock(&sb_lock);
 	/* should be initialized for __put_super_and_need_restart() */
 	list_del_init(&sb->s_list);
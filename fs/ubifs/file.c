@@ -1329,7 +1329,8 @@ int ubifs_fsync(struct file *file, struct dentry *dentry, int datasync)
 	if (err)
 		return err;
 
-	return 0;
+	/* And UBI or the flash driver may still buffer them */
+	return ubi_sync(c->vi.ubi_num);
 }
 
 /**
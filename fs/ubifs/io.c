@@ -340,7 +340,8 @@ static void cancel_wbuf_timer_nolock(struct ubifs_wbuf *wbuf)
  * @wbuf: write-buffer to synchronize
  *
  * This function synchronizes write-buffer @buf and returns zero in case of
- * success or a negative error code in case of failure.
+ * success or a negative error code in case of failure. UBI buffers are
+ * flushed as well, so the data are on the media when this function returns.
  */
 int ubifs_wbuf_sync_nolock(struct ubifs_wbuf *wbuf)
 {
@@ -349,8 +350,11 @@ int ubifs_wbuf_sync_nolock(struct ubifs_wbuf *wbuf)
 
 	cancel_wbuf_timer_nolock(wbuf);
 	if (!wbuf->used || wbuf->lnum == -1)
-		/* Write-buffer is empty or not seeked */
-		return 0;
+		/*
+		 * Write-buffer is empty or not seeked, but earlier writes may
+		 * still sit in the UBI write-combining buffer.
+		 */
+		return ubi_sync(c->vi.ubi_num);
 
 	dbg_io("LEB %d:%d, %d bytes, jhead %s",
 	       wbuf->lnum, wbuf->offs, wbuf->used, dbg_jhead(wbuf->jhead));
@@ -371,6 +375,11 @@ int ubifs_wbuf_sync_nolock(struct ubifs_wbuf *wbuf)
 		return err;
 	}
 
+	/* Make sure UBI does not keep the data in its write-combining buffer */
+	err = ubi_sync(c->vi.ubi_num);
+	if (err)
+		return err;
+
 	dirt = wbuf->avail;
 
 	spin_lock(&wbuf->lock);
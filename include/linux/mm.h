@@ -19,6 +19,7 @@ struct file_ra_state;
 struct user_struct;
 struct writeback_control;
 struct rlimit;
+struct super_block;
 
 #ifndef CONFIG_DISCONTIGMEM          /* Don't use mapnrs, do it properly */
 extern unsigned long max_mapnr;
@@ -1091,6 +1092,15 @@ extern void zone_pcp_update(struct zone *zone);
 extern atomic_long_t mmap_pages_allocated;
 extern int nommu_shrink_inode_mappings(struct inode *, size_t, size_t);
 
+/* nommu_exec_pool.c */
+#ifdef CONFIG_NOMMU_EXEC_POOL
+extern void exec_pool_invalidate_inode(struct inode *inode);
+extern void exec_pool_invalidate_sb(struct super_block *sb);
+#else
+static inline void exec_pool_invalidate_inode(struct inode *inode) {}
+static inline void exec_pool_invalidate_sb(struct super_block *sb) {}
+#endif
+
 /* prio_tree.c */
 void vma_prio_tree_add(struct vm_area_struct *, struct vm_area_struct *old);
 void vma_prio_tree_insert(struct vm_area_struct *, struct prio_tree_root *);
@@ -255,6 +255,11 @@ int __get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
 extern void* exec_pool_allocate(size_t size);
 extern void  exec_pool_free(void *ptr);
 extern void  exec_pool_show_free_space(void);
+extern void* exec_pool_get_text(struct inode *inode, unsigned long pgoff,
+				size_t size);
+extern void  exec_pool_set_text(void *ptr, struct inode *inode,
+				unsigned long pgoff);
+extern void  exec_pool_dirty_text(void *ptr);
 #endif
 
 extern int hwpoison_filter(struct page *p);
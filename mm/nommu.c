@@ -129,6 +129,22 @@ unsigned int kobjsize(const void *objp)
 	return PAGE_SIZE << compound_order(page);
 }
 
+#ifdef CONFIG_NOMMU_EXEC_POOL
+/*
+ * text being written through ptrace or get_user_pages() no longer matches
+ * the file, so it mustn't be kept in the execution pool for later execs
+ */
+static void exec_text_written(struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_EXEC)
+		exec_pool_dirty_text((void *) vma->vm_region->vm_start);
+}
+#else
+static inline void exec_text_written(struct vm_area_struct *vma)
+{
+}
+#endif
+
 int __get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
 		     unsigned long start, int nr_pages, unsigned int foll_flags,
 		     struct page **pages, struct vm_area_struct **vmas)
@@ -155,6 +171,9 @@ int __get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
 		    !(vm_flags & vma->vm_flags))
 			goto finish_or_fault;
 
+		if (foll_flags & FOLL_WRITE)
+			exec_text_written(vma);
+
 		if (pages) {
 			pages[i] = virt_to_page(start);
 			if (pages[i])
@@ -597,11 +616,15 @@ static void protect_vma(struct vm_area_struct *vma, unsigned long flags)
 {
 #ifdef CONFIG_MPU
 	struct mm_struct *mm = vma->vm_mm;
+#ifdef __HAVE_ARCH_PROTECT_RANGE
+	protect_range(mm, vma->vm_start, vma->vm_end, flags);
+#else
 	long start = vma->vm_start & PAGE_MASK;
 	while (start < vma->vm_end) {
 		protect_page(mm, start, flags);
 		start += PAGE_SIZE;
 	}
+#endif
 	update_protections(mm);
 #endif
 }
@@ -1051,6 +1074,21 @@ static int do_mmap_shared_file(struct vm_area_struct *vma)
 	return -ENODEV;
 }
 
+#ifdef CONFIG_NOMMU_EXEC_POOL
+/*
+ * read-only text which may be shared is kept in the execution pool after
+ * its last user has gone, unless the process is being traced or somebody
+ * holds the file open for writing - their writes would not invalidate it
+ */
+static inline int exec_text_shareable(struct vm_area_struct *vma)
+{
+	return vma->vm_file &&
+		(vma->vm_flags & (VM_EXEC | VM_MAYSHARE | VM_WRITE)) ==
+		(VM_EXEC | VM_MAYSHARE) &&
+		atomic_read(&vma->vm_file->f_path.dentry->d_inode->i_writecount) <= 0;
+}
+#endif
+
 /*
  * set up a private mapping or an anonymous shared mapping
  */
@@ -1062,7 +1100,7 @@ static int do_mmap_private(struct vm_area_struct *vma,
 	struct page *pages;
 	unsigned long total, point, n, rlen;
 	void *base;
-	int ret, order;
+	int ret, order, cached = 0;
 
 	/* invoke the file's mapping function so that it can keep track of
 	 * shared mappings on devices or memory
@@ -1088,7 +1126,15 @@ static int do_mmap_private(struct vm_area_struct *vma,
 
 #ifdef CONFIG_NOMMU_EXEC_POOL
 	if (vma->vm_flags & VM_EXEC) {
-		base = exec_pool_allocate(rlen);
+		base = NULL;
+		if (exec_text_shareable(vma)) {
+			base = exec_pool_get_text(
+				vma->vm_file->f_path.dentry->d_inode,
+				vma->vm_pgoff, rlen);
+			cached = base != NULL;
+		}
+		if (!base)
+			base = exec_pool_allocate(rlen);
 		if (base <= 0)
 			goto enomem;
 		total = rlen >> PAGE_SHIFT;
@@ -1140,7 +1186,7 @@ static int do_mmap_private(struct vm_area_struct *vma,
 	vma->vm_start = region->vm_start;
 	vma->vm_end   = region->vm_start + len;
 
-	if (vma->vm_file) {
+	if (vma->vm_file && !cached) {
 		/* read the contents of a file into the copy */
 		mm_segment_t old_fs;
 		loff_t fpos;
@@ -1160,6 +1206,12 @@ static int do_mmap_private(struct vm_area_struct *vma,
 		if (ret < rlen)
 			memset(base + ret, 0, rlen - ret);
 
+#ifdef CONFIG_NOMMU_EXEC_POOL
+		if (exec_text_shareable(vma))
+			exec_pool_set_text(base,
+				vma->vm_file->f_path.dentry->d_inode,
+				vma->vm_pgoff);
+#endif
 	}
 
 	return 0;
@@ -1930,10 +1982,11 @@ int access_process_vm(struct task_struct *tsk, unsigned long addr, void *buf, in
 			len = vma->vm_end - addr;
 
 		/* only read or write mappings where it is permitted */
-		if (write && vma->vm_flags & VM_MAYWRITE)
+		if (write && vma->vm_flags & VM_MAYWRITE) {
+			exec_text_written(vma);
 			copy_to_user_page(vma, NULL, addr,
 					 (void *) addr, buf, len);
-		else if (!write && vma->vm_flags & VM_MAYREAD)
+		} else if (!write && vma->vm_flags & VM_MAYREAD)
 			copy_from_user_page(vma, NULL, addr,
 					    buf, (void *) addr, len);
 		else
@@ -1,7 +1,13 @@
 #include <linux/types.h>
+#include <linux/init.h>
 #include <linux/slab.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/sched.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/fs.h>
+#include <linux/pagemap.h>
 
 static inline __attribute__((format(printf, 1, 2)))
 void no_printk(const char *fmt, ...)
@@ -24,115 +30,459 @@ void no_printk(const char *fmt, ...)
 	no_printk(KERN_DEBUG FMT"\n", ##__VA_ARGS__)
 #endif
 
+/*
+ * The pool is carved into slots which cover it completely and are kept on
+ * a list in address order, so the neighbours of a slot are found in O(1)
+ * when it is freed and adjacent free slots are merged right away.
+ *
+ * Free slots are also indexed by (size, address) for best-fit lookups and
+ * busy slots by address for exec_pool_free(), both in O(log n).
+ *
+ * A busy slot holding the read-only text of a file is also indexed by the
+ * file it came from and is reference counted. When the last user goes away
+ * the slot stays allocated on an LRU list, so the next exec of the same
+ * program maps it again instead of reading it from flash. Idle text is
+ * given back as soon as an allocation would fail otherwise.
+ *
+ * The text of a file is dropped from the index when the file is opened for
+ * writing or truncated, when its inode leaves the inode cache and when its
+ * filesystem is unmounted, so neither a rewritten file, a reused inode
+ * number nor a new superblock at the same address can match it. AS_EXEC_TEXT
+ * on the mapping of the inode tells those paths, without the pool lock,
+ * whether there may be anything to drop.
+ */
+struct execution_text
+{
+	struct super_block *sb;
+	unsigned long ino;
+	__u32 generation;
+	unsigned long pgoff;
+};
+
 struct execution_slot
 {
 	size_t size;
 	int busy;
 	void *ptr;
 	struct list_head list;
+	struct rb_node node;	/* in pool.free_slots or pool.busy_slots */
+
+	int refs;
+	int shared;		/* text is valid and indexed in pool.text_slots */
+	struct execution_text text;
+	struct rb_node text_node;
+	struct list_head lru;	/* idle text, refs == 0 */
 };
 
 struct exec_pool
 {
 	void* memory;
-	void* free_memory;
 	size_t size;
 	size_t free_space;
 	struct mutex lock;
 	struct list_head slots;
+	struct rb_root free_slots;
+	struct rb_root busy_slots;
+	struct rb_root text_slots;
+	struct list_head idle_text;
+
+	unsigned long nr_free;
+	unsigned long nr_busy;
+	unsigned long failures;
+
+	unsigned long nr_text;
+	unsigned long nr_idle;
+	size_t idle_space;
+	unsigned long text_hits;
+	unsigned long text_evictions;
 };
 
 static struct exec_pool pool;
 
+/****************************************************************************/
+
+static void insert_free_slot(struct execution_slot *slot)
+{
+	struct rb_node **p = &pool.free_slots.rb_node;
+	struct rb_node *parent = NULL;
+	struct execution_slot *tmp;
+
+	while( *p )
+	{
+		parent = *p;
+		tmp = rb_entry(parent, struct execution_slot, node);
+
+		if( slot->size < tmp->size ||
+		    (slot->size == tmp->size && slot->ptr < tmp->ptr) )
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&slot->node, parent, p);
+	rb_insert_color(&slot->node, &pool.free_slots);
+	pool.nr_free++;
+}
+
+static void remove_free_slot(struct execution_slot *slot)
+{
+	rb_erase(&slot->node, &pool.free_slots);
+	pool.nr_free--;
+}
+
+/* Smallest free slot of at least size bytes, lowest address first */
 static struct execution_slot *find_free_slot_by_size(size_t size)
 {
+	struct rb_node *n = pool.free_slots.rb_node;
+	struct execution_slot *best = 0;
 	struct execution_slot *slot;
-	list_for_each_entry(slot, &pool.slots, list) {
-		if( slot->busy == 0 && slot->size == size )
+
+	while( n )
+	{
+		slot = rb_entry(n, struct execution_slot, node);
+
+		if( slot->size >= size )
+		{
+			best = slot;
+			n = n->rb_left;
+		}
+		else
+			n = n->rb_right;
+	}
+
+	return best;
+}
+
+/****************************************************************************/
+
+static void insert_busy_slot(struct execution_slot *slot)
+{
+	struct rb_node **p = &pool.busy_slots.rb_node;
+	struct rb_node *parent = NULL;
+	struct execution_slot *tmp;
+
+	while( *p )
+	{
+		parent = *p;
+		tmp = rb_entry(parent, struct execution_slot, node);
+
+		if( slot->ptr < tmp->ptr )
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&slot->node, parent, p);
+	rb_insert_color(&slot->node, &pool.busy_slots);
+	pool.nr_busy++;
+}
+
+static void remove_busy_slot(struct execution_slot *slot)
+{
+	rb_erase(&slot->node, &pool.busy_slots);
+	pool.nr_busy--;
+}
+
+static struct execution_slot *find_slot_by_ptr(void *ptr)
+{
+	struct rb_node *n = pool.busy_slots.rb_node;
+	struct execution_slot *slot;
+
+	while( n )
+	{
+		slot = rb_entry(n, struct execution_slot, node);
+
+		if( ptr < slot->ptr )
+			n = n->rb_left;
+		else if( ptr > slot->ptr )
+			n = n->rb_right;
+		else
 			return slot;
 	}
-	
+
 	return 0;
 }
 
-static struct execution_slot *find_slot_by_ptr(void *ptr)
+/****************************************************************************/
+
+static int compare_text(const struct execution_text *a, size_t a_size,
+                        const struct execution_text *b, size_t b_size)
+{
+	if( a->sb != b->sb )
+		return a->sb < b->sb ? -1 : 1;
+	if( a->ino != b->ino )
+		return a->ino < b->ino ? -1 : 1;
+	if( a->generation != b->generation )
+		return a->generation < b->generation ? -1 : 1;
+	if( a->pgoff != b->pgoff )
+		return a->pgoff < b->pgoff ? -1 : 1;
+	if( a_size != b_size )
+		return a_size < b_size ? -1 : 1;
+	return 0;
+}
+
+static int insert_text_slot(struct execution_slot *slot)
+{
+	struct rb_node **p = &pool.text_slots.rb_node;
+	struct rb_node *parent = NULL;
+	struct execution_slot *tmp;
+	int cmp;
+
+	while( *p )
+	{
+		parent = *p;
+		tmp = rb_entry(parent, struct execution_slot, text_node);
+
+		cmp = compare_text(&slot->text, slot->size, &tmp->text, tmp->size);
+		if( cmp < 0 )
+			p = &parent->rb_left;
+		else if( cmp > 0 )
+			p = &parent->rb_right;
+		else
+			return -EEXIST;
+	}
+
+	rb_link_node(&slot->text_node, parent, p);
+	rb_insert_color(&slot->text_node, &pool.text_slots);
+	slot->shared = 1;
+	pool.nr_text++;
+
+	return 0;
+}
+
+static void remove_text_slot(struct execution_slot *slot)
 {
+	rb_erase(&slot->text_node, &pool.text_slots);
+	slot->shared = 0;
+	pool.nr_text--;
+}
+
+static struct execution_slot *find_text_slot(const struct execution_text *text,
+                                             size_t size)
+{
+	struct rb_node *n = pool.text_slots.rb_node;
 	struct execution_slot *slot;
-	list_for_each_entry(slot, &pool.slots, list) {
-		if( slot->ptr == ptr )
+	int cmp;
+
+	while( n )
+	{
+		slot = rb_entry(n, struct execution_slot, text_node);
+
+		cmp = compare_text(text, size, &slot->text, slot->size);
+		if( cmp < 0 )
+			n = n->rb_left;
+		else if( cmp > 0 )
+			n = n->rb_right;
+		else
 			return slot;
 	}
-	
+
 	return 0;
 }
 
-static struct execution_slot *allocate_slot(size_t size)
+static void make_text_key(struct execution_text *text, struct inode *inode,
+                          unsigned long pgoff)
 {
+	text->sb = inode->i_sb;
+	text->ino = inode->i_ino;
+	text->generation = inode->i_generation;
+	text->pgoff = pgoff;
+}
+
+/*
+ * First text slot of a superblock, or of one of its inodes if ino is not
+ * zero, in the order of compare_text().
+ */
+static struct execution_slot *first_text_slot(struct super_block *sb,
+                                              unsigned long ino)
+{
+	struct rb_node *n = pool.text_slots.rb_node;
 	struct execution_slot *slot;
-	
-	if( pool.free_space < size )
-		return 0;
-	
-	slot = (struct execution_slot *)kmalloc(sizeof(struct execution_slot), GFP_KERNEL);
-	if( slot == 0 )
-		return 0;
-	
-	slot->ptr = pool.free_memory;
-	slot->size = size;
+	struct execution_slot *first = 0;
+
+	while( n )
+	{
+		slot = rb_entry(n, struct execution_slot, text_node);
+
+		if( sb < slot->text.sb ||
+		    (sb == slot->text.sb && ino <= slot->text.ino) )
+		{
+			first = slot;
+			n = n->rb_left;
+		}
+		else
+			n = n->rb_right;
+	}
+
+	return first;
+}
+
+/****************************************************************************/
+
+/*
+ * Merge a slot which is not in either tree with the free neighbour behind
+ * it, the neighbour is released.
+ */
+static void merge_with_next(struct execution_slot *slot)
+{
+	struct execution_slot *next;
+
+	if( slot->list.next == &pool.slots )
+		return;
+
+	next = list_entry(slot->list.next, struct execution_slot, list);
+	if( next->busy )
+		return;
+
+	remove_free_slot(next);
+	slot->size += next->size;
+	list_del(&next->list);
+	kfree(next);
+}
+
+/* Give a busy slot back to the free space, merging it with its neighbours */
+static void release_slot(struct execution_slot *slot)
+{
+	struct execution_slot *prev;
+
+	if( slot->shared )
+		remove_text_slot(slot);
+
+	remove_busy_slot(slot);
 	slot->busy = 0;
-	
-	list_add(&slot->list, &pool.slots);
-	
-	pool.free_memory = (char*)pool.free_memory + size;
-	pool.free_space -= size;
-	
-	kdebug("allocate new slot, free_space=%u", pool.free_space);
-	
-	return slot;
+	pool.free_space += slot->size;
+
+	merge_with_next(slot);
+
+	if( slot->list.prev != &pool.slots )
+	{
+		prev = list_entry(slot->list.prev, struct execution_slot, list);
+		if( !prev->busy )
+		{
+			remove_free_slot(prev);
+			prev->size += slot->size;
+			list_del(&slot->list);
+			kfree(slot);
+			slot = prev;
+		}
+	}
+
+	insert_free_slot(slot);
+
+	kdebug("free slot, free_space=%u", pool.free_space);
 }
 
-static void free_slot(struct execution_slot* slot)
+static void unidle_slot(struct execution_slot *slot)
 {
-	list_del(&slot->list);
-	kfree(slot);
+	list_del(&slot->lru);
+	pool.nr_idle--;
+	pool.idle_space -= slot->size;
 }
 
-static void free_unused_tail_slots(void)
+/*
+ * Take text out of the index, idle text is released right away and mapped
+ * text goes when its last user calls exec_pool_free().
+ */
+static void forget_text_slot(struct execution_slot *slot)
 {
-	struct execution_slot *slot, *next;
+	kdebug("forget text at %p", slot->ptr);
 
-	list_for_each_entry_safe(slot, next, &pool.slots, list) {
-		if( slot->busy )
-			return;
-		
-		pool.free_memory = (char*)pool.free_memory - slot->size;
-		pool.free_space += slot->size;
-		
-		if( pool.free_memory != slot->ptr )
-			kdebug("!!!!!!!!!!!!!!!!!!!!! ERROR: pool.free_memory != slot->ptr");
-		
-		kdebug("free tail slot, free_space=%u", pool.free_space);
-		
-		free_slot(slot);
+	if( slot->refs == 0 )
+	{
+		unidle_slot(slot);
+		release_slot(slot);
+	}
+	else
+		remove_text_slot(slot);
+}
+
+/* Forget the text of one inode of sb, or of all of them if ino is zero */
+static void forget_text(struct super_block *sb, unsigned long ino)
+{
+	struct execution_slot *slot;
+	struct rb_node *next;
+
+	slot = first_text_slot(sb, ino);
+	while( slot && slot->text.sb == sb && (ino == 0 || slot->text.ino == ino) )
+	{
+		next = rb_next(&slot->text_node);
+		forget_text_slot(slot);
+		slot = next ? rb_entry(next, struct execution_slot, text_node) : 0;
 	}
 }
 
+/* Release idle text, oldest first, until a block of size bytes fits */
+static struct execution_slot *evict_idle_text(size_t size)
+{
+	struct execution_slot *slot = 0;
+	struct execution_slot *victim;
+
+	while( slot == 0 && !list_empty(&pool.idle_text) )
+	{
+		victim = list_first_entry(&pool.idle_text, struct execution_slot, lru);
+		kdebug("evict idle text at %p", victim->ptr);
+
+		unidle_slot(victim);
+		release_slot(victim);
+		pool.text_evictions++;
+
+		slot = find_free_slot_by_size(size);
+	}
+
+	return slot;
+}
+
+/****************************************************************************/
+
 void* exec_pool_allocate(size_t size)
 {
 	struct execution_slot *slot = 0;
-	
+	struct execution_slot *rest;
+
 	kdebug("allocate %u bytes for process %s", size, current->comm);
-	
+
+	/* the tail left over by a split, if any */
+	rest = (struct execution_slot *)kmalloc(sizeof(struct execution_slot), GFP_KERNEL);
+	if( rest == 0 )
+		return 0;
+
 	mutex_lock(&pool.lock);
-	
+
 	slot = find_free_slot_by_size(size);
 	if( slot == 0 )
-		slot = allocate_slot(size);
+		slot = evict_idle_text(size);
 	if( slot )
+	{
+		remove_free_slot(slot);
+
+		if( slot->size > size )
+		{
+			rest->ptr = (char*)slot->ptr + size;
+			rest->size = slot->size - size;
+			rest->busy = 0;
+			rest->shared = 0;
+			list_add(&rest->list, &slot->list);
+			insert_free_slot(rest);
+			rest = 0;
+
+			slot->size = size;
+		}
+
 		slot->busy = 1;
-	
+		slot->refs = 1;
+		slot->shared = 0;
+		insert_busy_slot(slot);
+		pool.free_space -= size;
+
+		kdebug("allocate slot, free_space=%u", pool.free_space);
+	}
+	else
+		pool.failures++;
+
 	mutex_unlock(&pool.lock);
-	
+
+	kfree(rest);
+
 	if( slot )
 	{
 		kdebug("memory allocated at %p", slot->ptr);
@@ -145,43 +495,247 @@ void* exec_pool_allocate(size_t size)
 void exec_pool_free(void *ptr)
 {
 	struct execution_slot *slot = 0;
-	
+
 	kdebug("free memory of process %s", current->comm);
-	
+
 	mutex_lock(&pool.lock);
-	
+
 	slot = find_slot_by_ptr(ptr);
+	if( slot == 0 )
+		printk(KERN_WARNING "exec_pool: free of unknown block %p\n", ptr);
+	else if( --slot->refs == 0 )
+	{
+		if( slot->shared )
+		{
+			/* keep the text around for the next exec */
+			list_add_tail(&slot->lru, &pool.idle_text);
+			pool.nr_idle++;
+			pool.idle_space += slot->size;
+			kdebug("text at %p is idle", slot->ptr);
+		}
+		else
+			release_slot(slot);
+	}
+
+	mutex_unlock(&pool.lock);
+}
+
+/*
+ * Look for the text of a file which is already in the pool, either mapped
+ * by somebody else or left idle by a program which has exited.
+ */
+void* exec_pool_get_text(struct inode *inode, unsigned long pgoff, size_t size)
+{
+	struct execution_text text;
+	struct execution_slot *slot;
+	void *ptr = 0;
+
+	make_text_key(&text, inode, pgoff);
+
+	mutex_lock(&pool.lock);
+
+	slot = find_text_slot(&text, size);
 	if( slot )
 	{
-		slot->busy = 0;
-		free_unused_tail_slots();
+		if( slot->refs++ == 0 )
+			unidle_slot(slot);
+		pool.text_hits++;
+		ptr = slot->ptr;
+		kdebug("reuse text at %p for process %s", ptr, current->comm);
 	}
-	
+
 	mutex_unlock(&pool.lock);
+
+	return ptr;
+}
+
+/*
+ * Offer a block returned by exec_pool_allocate(), which now holds the
+ * read-only text of a file, for sharing with later execs. A writer which
+ * turned up meanwhile either finds the block in the index when it calls
+ * exec_pool_invalidate_inode() or is seen here.
+ */
+void exec_pool_set_text(void *ptr, struct inode *inode, unsigned long pgoff)
+{
+	struct execution_slot *slot;
+
+	mutex_lock(&pool.lock);
+
+	slot = find_slot_by_ptr(ptr);
+	if( slot && !slot->shared )
+	{
+		make_text_key(&slot->text, inode, pgoff);
+		/* on a clash the block simply stays private */
+		if( insert_text_slot(slot) == 0 )
+		{
+			set_bit(AS_EXEC_TEXT, &inode->i_mapping->flags);
+			/* pairs with exec_pool_invalidate_inode() */
+			smp_mb__after_set_bit();
+			if( atomic_read(&inode->i_writecount) > 0 )
+			{
+				/* opened for writing while it was read */
+				remove_text_slot(slot);
+			}
+		}
+	}
+
+	mutex_unlock(&pool.lock);
+}
+
+/*
+ * The text in a block is being written in place, by a debugger setting
+ * breakpoints say. Its current users keep it, but it is no longer a copy
+ * of the file and must not be handed to the next exec.
+ */
+void exec_pool_dirty_text(void *ptr)
+{
+	struct execution_slot *slot;
+
+	mutex_lock(&pool.lock);
+
+	slot = find_slot_by_ptr(ptr);
+	if( slot && slot->shared )
+	{
+		kdebug("text at %p written by process %s", ptr, current->comm);
+		forget_text_slot(slot);
+	}
+
+	mutex_unlock(&pool.lock);
+}
+
+/*
+ * The file is about to be written or truncated, or its inode is about to
+ * be freed, the text read from it so far must not be handed out again.
+ * This is on the path of every open for writing, so files which never had
+ * text in the pool do not take the lock.
+ */
+void exec_pool_invalidate_inode(struct inode *inode)
+{
+	if( !S_ISREG(inode->i_mode) )
+		return;
+
+	/* i_writecount was raised before, pairs with exec_pool_set_text() */
+	smp_mb();
+	if( !test_bit(AS_EXEC_TEXT, &inode->i_mapping->flags) )
+		return;
+
+	mutex_lock(&pool.lock);
+	forget_text(inode->i_sb, inode->i_ino);
+	clear_bit(AS_EXEC_TEXT, &inode->i_mapping->flags);
+	mutex_unlock(&pool.lock);
+}
+
+/* The filesystem goes away, its superblock may be reused by the next mount */
+void exec_pool_invalidate_sb(struct super_block *sb)
+{
+	mutex_lock(&pool.lock);
+	if( pool.nr_text )
+		forget_text(sb, 0);
+	mutex_unlock(&pool.lock);
+}
+
+static size_t largest_free_slot(void)
+{
+	struct rb_node *n = rb_last(&pool.free_slots);
+
+	return n ? rb_entry(n, struct execution_slot, node)->size : 0;
 }
 
 void exec_pool_show_free_space(void)
 {
-	printk("exec_pool: free_space=%u\n", pool.free_space);
+	printk("exec_pool: free_space=%u, largest free block=%u, %lu free blocks, "
+	       "%u bytes of idle text\n",
+	       pool.free_space, largest_free_slot(), pool.nr_free, pool.idle_space);
+}
+
+/****************************************************************************/
+
+static int exec_pool_proc_show(struct seq_file *m, void *v)
+{
+	size_t largest;
+
+	mutex_lock(&pool.lock);
+
+	largest = largest_free_slot();
+
+	seq_printf(m, "size:          %u\n", pool.size);
+	seq_printf(m, "free:          %u\n", pool.free_space);
+	seq_printf(m, "largest_free:  %u\n", largest);
+	seq_printf(m, "free_blocks:   %lu\n", pool.nr_free);
+	seq_printf(m, "used_blocks:   %lu\n", pool.nr_busy);
+	/* share of the free space which is not usable by the largest request */
+	seq_printf(m, "fragmentation: %u%%\n",
+	           pool.free_space ? 100 - largest * 100 / pool.free_space : 0);
+	seq_printf(m, "failures:      %lu\n", pool.failures);
+	seq_printf(m, "text_blocks:   %lu\n", pool.nr_text);
+	seq_printf(m, "idle_text:     %lu (%u bytes)\n", pool.nr_idle, pool.idle_space);
+	seq_printf(m, "text_hits:     %lu\n", pool.text_hits);
+	seq_printf(m, "text_evicted:  %lu\n", pool.text_evictions);
+
+	mutex_unlock(&pool.lock);
+
+	return 0;
+}
+
+static int exec_pool_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, exec_pool_proc_show, NULL);
 }
 
+static const struct file_operations exec_pool_proc_fops = {
+	.open		= exec_pool_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 /****************************************************************************/
 
 static int __init init_exec_pool(void)
 {
+	struct execution_slot *slot;
+
 	pool.size = CONFIG_NOMMU_EXEC_POOL_SIZE * 1024;
 	pool.free_space = pool.size;
-	
+
 	INIT_LIST_HEAD(&pool.slots);
+	pool.free_slots = RB_ROOT;
+	pool.busy_slots = RB_ROOT;
+	pool.text_slots = RB_ROOT;
+	INIT_LIST_HEAD(&pool.idle_text);
 	mutex_init(&pool.lock);
 
-	pool.memory = pool.free_memory = kmalloc(pool.size, GFP_ATOMIC);
+	pool.memory = kmalloc(pool.size, GFP_ATOMIC);
 	if( pool.memory == 0 )
 		return -ENOMEM;
-	
+
+	/* the whole pool starts out as one free slot */
+	slot = (struct execution_slot *)kmalloc(sizeof(struct execution_slot), GFP_KERNEL);
+	if( slot == 0 )
+	{
+		kfree(pool.memory);
+		pool.memory = 0;
+		return -ENOMEM;
+	}
+
+	slot->ptr = pool.memory;
+	slot->size = pool.size;
+	slot->busy = 0;
+	slot->shared = 0;
+	list_add(&slot->list, &pool.slots);
+	insert_free_slot(slot);
+
 	return 0;
 }
 
 core_initcall(init_exec_pool);
 
-/****************************************************************************/
\ No newline at end of file
+static int __init exec_pool_proc_init(void)
+{
+	proc_create("exec_pool", S_IRUGO, NULL, &exec_pool_proc_fops);
+	return 0;
+}
+
+module_init(exec_pool_proc_init);
+
+/****************************************************************************/
@@ -0,0 +1,237 @@
+#!/usr/bin/perl -w
+#
+# Turn a sampled PC profile into a list of input sections for the LM3S
+# internal SRAM (CONFIG_LM3S_SRAM_HOT), hottest code per byte first.
+#
+# usage:
+#	perl scripts/profile2sramlist.pl [-b budget] [-w waitstates] \
+#		[-o objtree] System.map profile > arch/arm/mach-lm3s/sram-hot.lds
+#
+#   budget      bytes of SRAM for hot code (CONFIG_LM3S_SRAM_HOT_SIZE),
+#               default 4096
+#   waitstates  extra cycles an instruction fetch costs outside SRAM,
+#               used for the estimate in the report, default 4
+#   objtree     kernel build directory, for the sizes of the assembler
+#               objects below, default the current directory
+#
+# The profile is either a list of sampled PCs, one hex address per line with
+# an optional leading sample count ("1234 c0012345"), e.g. from a debugger
+# or from profile=1 dumps, or the per function output of readprofile
+# ("hits function load").  The report goes to stderr.
+#
+# C functions are found in .text.<name> as the kernel is built with
+# -ffunction-sections when CONFIG_LM3S_SRAM_HOT is set.  Assembler routines
+# share .text with the rest of their object, the few worth moving are
+# mapped to their object file below.  Such an object is placed as a whole,
+# so it is charged with the size of all its code, taken with nm -S
+# ($CROSS_COMPILE is honoured); it is left out if nm cannot tell.  Likewise
+# a pattern for a static function places every function of that name, so
+# all of them are charged.
+#
+
+use strict;
+use Getopt::Std;
+
+my %opts;
+my $usage = "usage: $0 [-b budget] [-w waitstates] [-o objtree] System.map profile\n";
+getopts('b:w:o:', \%opts) or die $usage;
+
+my $budget = defined $opts{'b'} ? $opts{'b'} : 4096;
+my $waitstates = defined $opts{'w'} ? $opts{'w'} : 4;
+my $objtree = defined $opts{'o'} ? $opts{'o'} : '.';
+my $nm = (defined $ENV{'CROSS_COMPILE'} ? $ENV{'CROSS_COMPILE'} : '') . 'nm';
+
+die $usage unless @ARGV == 2;
+my ($mapfile, $proffile) = @ARGV;
+
+# Assembler routines from arch/arm/lib (lib.a members) placed as a whole
+my %asm_objects = (
+	'memcpy'		=> 'memcpy.o',
+	'memmove'		=> 'memmove.o',
+	'memset'		=> 'memset.o',
+	'__memzero'		=> 'memzero.o',
+	'__aeabi_uidiv'		=> 'lib1funcs.o',
+	'__aeabi_idiv'		=> 'lib1funcs.o',
+	'__udivsi3'		=> 'lib1funcs.o',
+	'__divsi3'		=> 'lib1funcs.o',
+	'__do_div64'		=> 'div64.o',
+	'csum_partial'		=> 'csumpartial.o',
+	'csum_partial_copy_nocheck' => 'csumpartialcopy.o',
+);
+
+# System.map: code symbols sorted by address, sizes from the next symbol
+my @syms;
+my ($sinittext, $einittext) = (0, 0);
+
+open(MAP, '<', $mapfile) or die "$mapfile: $!\n";
+while (<MAP>) {
+	next unless /^([0-9a-fA-F]+)\s+(\S)\s+(\S+)/;
+	my ($addr, $type, $name) = (hex($1), $2, $3);
+
+	$sinittext = $addr if $name eq '_sinittext';
+	$einittext = $addr if $name eq '_einittext';
+	push @syms, { addr => $addr, type => $type, name => $name };
+}
+close(MAP);
+
+@syms = sort { $a->{addr} <=> $b->{addr} } @syms;
+for (my $i = 0; $i < $#syms; $i++) {
+	$syms[$i]{size} = $syms[$i + 1]{addr} - $syms[$i]{addr};
+}
+$syms[$#syms]{size} = 0 if @syms;
+
+my %byname;
+my %namesize;	# all functions of a name, as placed by *(.text.<name>)
+my @text;
+foreach my $s (@syms) {
+	next unless $s->{type} =~ /^[tTwW]$/;
+	next if $s->{addr} >= $sinittext && $s->{addr} < $einittext;
+	$byname{$s->{name}} = $s;
+	$namesize{$s->{name}} += ($s->{size} + 3) & ~3;
+	push @text, $s;
+}
+
+# Code size of an assembler object from arch/arm/lib, undef if unknown
+my %objsize;
+sub object_size {
+	my ($obj) = @_;
+	my $size = 0;
+
+	return $objsize{$obj} if exists $objsize{$obj};
+	$objsize{$obj} = undef;
+	open(NM, "$nm -S $objtree/arch/arm/lib/$obj 2>/dev/null |") or return undef;
+	while (<NM>) {
+		$size += (hex($1) + 3) & ~3 if /^[0-9a-fA-F]+\s+([0-9a-fA-F]+)\s+[tT]\s/;
+	}
+	close(NM);
+	if ($size) {
+		$objsize{$obj} = $size;
+	} else {
+		print STDERR "$obj: size unknown, not placed\n";
+	}
+	return $objsize{$obj};
+}
+
+sub lookup_pc {
+	my ($pc) = @_;
+	my ($lo, $hi) = (0, $#text);
+
+	return undef if !@text || $pc < $text[0]{addr};
+	while ($lo < $hi) {
+		my $mid = int(($lo + $hi + 1) / 2);
+		if ($text[$mid]{addr} <= $pc) {
+			$lo = $mid;
+		} else {
+			$hi = $mid - 1;
+		}
+	}
+	return undef if $pc >= $text[$lo]{addr} + $text[$lo]{size};
+	return $text[$lo];
+}
+
+# Accumulate samples per function
+my %hits;
+my $total = 0;
+my $unknown = 0;
+
+open(PROF, '<', $proffile) or die "$proffile: $!\n";
+while (<PROF>) {
+	if (/^\s*(\d+)\s+([A-Za-z_][\w.]*)\s+[\d.]+\s*$/) {
+		next if $2 eq 'total';
+		$total += $1;
+		if ($byname{$2}) {
+			$hits{$2} += $1;
+		} else {
+			$unknown += $1;
+		}
+	} elsif (/^\s*(?:(\d+)\s+)?(?:0x)?([0-9a-fA-F]+)\s*$/) {
+		my $count = defined $1 ? $1 : 1;
+		my $s = lookup_pc(hex($2));
+		$total += $count;
+		if ($s) {
+			$hits{$s->{name}} += $count;
+		} else {
+			$unknown += $count;
+		}
+	}
+}
+close(PROF);
+
+die "$proffile: no samples\n" unless $total;
+
+# Functions already tagged __sram live in the SRAM, 0x20000000-0x2000ffff
+sub in_sram {
+	my ($s) = @_;
+	return $s->{addr} >= 0x20000000 && $s->{addr} < 0x20010000;
+}
+
+# Rank by hits per byte and fill the budget greedily
+my @cand;
+my $sram_hits = 0;
+foreach my $name (keys %hits) {
+	my $s = $byname{$name};
+	if (in_sram($s)) {
+		$sram_hits += $hits{$name};
+		next;
+	}
+	my $size = $namesize{$name};
+	my $obj = $asm_objects{$name};
+	if ($obj) {
+		$size = object_size($obj);
+	}
+	next unless $size;
+	push @cand, { name => $name, size => $size, hits => $hits{$name},
+		      density => $hits{$name} / $size };
+}
+@cand = sort { $b->{density} <=> $a->{density} || $b->{hits} <=> $a->{hits} } @cand;
+
+my @placed;
+my %objects;
+my $used = 0;
+my $placed_hits = 0;
+foreach my $c (@cand) {
+	my $obj = $asm_objects{$c->{name}};
+
+	# another entry point of an object already placed
+	if ($obj && $objects{$obj}) {
+		$placed_hits += $c->{hits};
+		next;
+	}
+	next if $used + $c->{size} > $budget;
+
+	$objects{$obj} = 1 if $obj;
+	$c->{section} = $obj ? "*lib.a:$obj(.text)" : "*(.text.$c->{name})";
+	push @placed, $c;
+	$used += $c->{size};
+	$placed_hits += $c->{hits};
+}
+
+# Linker list
+print "/*\n";
+print " * Generated by scripts/profile2sramlist.pl, budget $budget bytes.\n";
+print " * Functions ranked by profile hits per byte.\n";
+print " */\n";
+foreach my $c (@placed) {
+	printf "%-48s /* %6d bytes %8d hits */\n", $c->{section}, $c->{size}, $c->{hits};
+}
+
+# Report.  Samples measure time; assume the time of placed code is fetch
+# bound, so it shrinks by (1 + waitstates) once it runs from the SRAM.
+printf STDERR "%4s  %-32s %6s %8s %9s %6s\n", 'rank', 'function', 'bytes', 'hits', 'hits/byte', 'cum%';
+my $cum = 0;
+my $rank = 0;
+foreach my $c (@placed) {
+	$cum += $c->{hits};
+	printf STDERR "%4d  %-32s %6d %8d %9.3f %5.1f%%\n", ++$rank, $c->{name},
+		$c->{size}, $c->{hits}, $c->{density}, 100 * $cum / $total;
+}
+
+my $f = $placed_hits / $total;
+my $after = $total - $placed_hits * $waitstates / (1 + $waitstates);
+
+printf STDERR "\n%d samples, %d outside known text, %d already in SRAM\n",
+	$total, $unknown, $sram_hits;
+printf STDERR "placed %d functions, %d of %d bytes, %.1f%% of samples\n",
+	scalar(@placed), $used, $budget, 100 * $f;
+printf STDERR "estimated speedup %.1f%% at %d wait states per fetch\n",
+	100 * ($total / $after - 1), $waitstates;